@@ -0,0 +1,144 @@
+#include "lz4.h"
+#include <stdbool.h>
+#include <string.h>
+
+// LZ4 block format: each sequence is a token (literal length << 4 | match
+// length - 4, 15 meaning more length bytes follow), the literals, then a
+// 16-bit little-endian match offset. The last sequence has literals only.
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5             // the block always ends with literals
+#define MFLIMIT 12                  // no match starts in the last 12 bytes
+#define HASH_LOG 12
+#define SKIP_SHIFT 6                // step up after 64 bytes without a match
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned int hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+// Length bytes past the 15 of the token
+static uint8_t *write_length(uint8_t *op, size_t len) {
+    for (; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+size_t lz4_compress(const void *src, size_t len, void *dst, size_t cap) {
+    const uint8_t *const in = src;
+    const uint8_t *const end = in + len;
+    const uint8_t *anchor = in;
+    const uint8_t *ip = in;
+    uint8_t *op = dst;
+    uint8_t *const oend = op + cap;
+    uint16_t table[1 << HASH_LOG];
+
+    if (len > LZ4_MAX_INPUT) return 0;
+    memset(table, 0, sizeof(table));
+
+    if (len > MFLIMIT) {
+        const uint8_t *const match_limit = end - MFLIMIT;
+        const uint8_t *const match_end = end - LAST_LITERALS;
+
+        ip++;
+        while (ip < match_limit) {
+            uint32_t seq = read32(ip);
+            unsigned int h = hash4(seq);
+            const uint8_t *ref = in + table[h];
+
+            table[h] = (uint16_t)(ip - in);
+            if (ref >= ip || read32(ref) != seq) {
+                ip += 1 + ((size_t)(ip - anchor) >> SKIP_SHIFT);
+                continue;
+            }
+
+            // Catch up on bytes the hash missed, then extend forward
+            while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            size_t match = MIN_MATCH;
+            while (ip + match < match_end && ip[match] == ref[match]) match++;
+
+            size_t literals = (size_t)(ip - anchor);
+            if ((size_t)(oend - op) < 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1) return 0;
+
+            uint8_t *token = op++;
+            *token = (uint8_t)((literals < 15 ? literals : 15) << 4);
+            if (literals >= 15) op = write_length(op, literals - 15);
+            memcpy(op, anchor, literals);
+            op += literals;
+
+            uint16_t offset = (uint16_t)(ip - ref);
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
+            size_t extra = match - MIN_MATCH;
+            *token |= (uint8_t)(extra < 15 ? extra : 15);
+            if (extra >= 15) op = write_length(op, extra - 15);
+
+            ip += match;
+            anchor = ip;
+            // Index a position inside the match, repeats are often close
+            if (ip - 2 > in) table[hash4(read32(ip - 2))] = (uint16_t)(ip - 2 - in);
+        }
+    }
+
+    size_t literals = (size_t)(end - anchor);
+    if ((size_t)(oend - op) < 1 + literals / 255 + 1 + literals) return 0;
+    *op++ = (uint8_t)((literals < 15 ? literals : 15) << 4);
+    if (literals >= 15) op = write_length(op, literals - 15);
+    memcpy(op, anchor, literals);
+    op += literals;
+    return (size_t)(op - (uint8_t *)dst);
+}
+
+// Add the length bytes that follow a saturated token nibble
+static bool read_length(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+    uint8_t b;
+
+    do {
+        if (*ip >= iend) return false;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+ssize_t lz4_decompress(const void *src, size_t len, void *dst, size_t cap) {
+    const uint8_t *ip = src;
+    const uint8_t *const iend = ip + len;
+    uint8_t *op = dst;
+    uint8_t *const oend = op + cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+
+        if (literals == 15 && !read_length(&ip, iend, &literals)) return -1;
+        if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op)) return -1;
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return -1;
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst)) return -1;
+
+        size_t match = token & 15;
+        if (match == 15 && !read_length(&ip, iend, &match)) return -1;
+        match += MIN_MATCH;
+        if (match > (size_t)(oend - op)) return -1;
+
+        // Byte by byte: the match may overlap the bytes it produces
+        const uint8_t *ref = op - offset;
+        while (match--) *op++ = *ref++;
+    }
+    return op - (uint8_t *)dst;
+}
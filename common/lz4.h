@@ -0,0 +1,35 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+// LZ4 block format (no frame): a sequence of literal runs and back
+// references of at most 64 KiB distance. Compression is a single greedy
+// pass with a 4096-entry hash table on the stack, fast enough to batch log
+// lines without competing with the daemons; decompression checks every
+// length and offset against both buffers. Blocks are interchangeable with
+// LZ4_compress_default()/LZ4_decompress_safe() output.
+
+#define LZ4_MAX_INPUT 65536         // positions are kept in 16 bits
+
+// Worst case compressed size of len bytes
+#define LZ4_BOUND(len) ((len) + (len) / 255 + 16)
+
+// Compress len bytes of src into dst; returns the compressed size, or 0 if
+// len exceeds LZ4_MAX_INPUT or the result does not fit in cap
+size_t lz4_compress(const void *src, size_t len, void *dst, size_t cap);
+
+// Decompress a block into dst; returns its size, or -1 if it is malformed
+// or would not fit in cap
+ssize_t lz4_decompress(const void *src, size_t len, void *dst, size_t cap);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -8,6 +8,7 @@ char *_nvram_get(const char *name);
 int _nvram_set(const char *name, const char *value, int is_temp);
 int _nvram_unset(const char *name);
 int _nvram_getall(char *buf, int count, int include_temp);
+int _nvram_foreach(int (*fn)(struct nvram_tuple *t, void *arg), void *arg);
 int _nvram_init(struct nvram_header *header);
 void _nvram_uninit(void);
 int _nvram_generate(struct nvram_header *header, int rehash);
@@ -30,6 +30,7 @@ char * _nvram_get(const char *name);
 int _nvram_set(const char *name, const char *value, int is_temp);
 int _nvram_unset(const char *name);
 int _nvram_getall(char *buf, int count, int include_temp);
+int _nvram_foreach(int (*fn)(struct nvram_tuple *t, void *arg), void *arg);
 int _nvram_generate(struct nvram_header *header, int rehash);
 int _nvram_init(struct nvram_header *header);
 void _nvram_uninit(void);
@@ -275,6 +276,23 @@ int _nvram_getall(char *buf, int count, int include_temp)
 	return 0;
 }
 
+/* Call fn for each tuple until it returns non-zero. Should be locked. */
+int _nvram_foreach(int (*fn)(struct nvram_tuple *t, void *arg), void *arg)
+{
+	uint32_t i;
+	struct nvram_tuple *t;
+	int ret;
+
+	for (i = 0; i < ARRAYSIZE(nvram_hash); i++) {
+		for (t = nvram_hash[i]; t; t = t->next) {
+			if ((ret = fn(t, arg)) != 0)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
 /* Regenerate NVRAM. Should be locked. */
 int _nvram_generate(struct nvram_header *header, int rehash)
 {
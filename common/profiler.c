@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+#include "profiler.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <link.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#define MAX_MODULES 32
+#define MAX_THREADS 64
+#define MAX_FRAME_SIZE (1 << 20)    // larger steps mean fp is not a frame pointer
+#define LINE_SIZE (PROFILER_MAX_DEPTH * 64 + 32)
+
+// Where the saved frame pointer and return address sit relative to the
+// frame pointer: GCC's ARM frames point fp at the saved lr, everyone else
+// at the saved fp
+#if defined(__arm__)
+#define FRAME_OFFSET (-4)
+#else
+#define FRAME_OFFSET 0
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__) || defined(__arm__)
+#define HAVE_FRAME_REGISTERS
+#endif
+
+struct sample {
+    pid_t tid;
+    uint32_t depth;
+    uintptr_t pc[PROFILER_MAX_DEPTH];   // interrupted pc, then return addresses
+};
+
+static pthread_mutex_t profiler_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool handler_installed = false;
+static bool started = false;            // under profiler_lock
+static pid_t pid;
+
+// Shared with the signal handler
+static struct sample *samples = NULL;
+static size_t capacity = 0;
+static size_t next_sample = 0;
+static bool sampling = false;
+static int active = 0;                  // handlers running right now
+
+static bool frame_registers(const void *context, uintptr_t *pc, uintptr_t *fp, uintptr_t *sp) {
+    const ucontext_t *uc = context;
+
+#if defined(__x86_64__)
+    *pc = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+    *fp = (uintptr_t)uc->uc_mcontext.gregs[REG_RBP];
+    *sp = (uintptr_t)uc->uc_mcontext.gregs[REG_RSP];
+#elif defined(__i386__)
+    *pc = (uintptr_t)uc->uc_mcontext.gregs[REG_EIP];
+    *fp = (uintptr_t)uc->uc_mcontext.gregs[REG_EBP];
+    *sp = (uintptr_t)uc->uc_mcontext.gregs[REG_ESP];
+#elif defined(__aarch64__)
+    *pc = (uintptr_t)uc->uc_mcontext.pc;
+    *fp = (uintptr_t)uc->uc_mcontext.regs[29];
+    *sp = (uintptr_t)uc->uc_mcontext.sp;
+#elif defined(__arm__)
+    *pc = (uintptr_t)uc->uc_mcontext.arm_pc;
+    *fp = (uintptr_t)uc->uc_mcontext.arm_fp;
+    *sp = (uintptr_t)uc->uc_mcontext.arm_sp;
+#endif
+#ifndef HAVE_FRAME_REGISTERS
+    (void)uc;
+    return false;
+#else
+    return true;
+#endif
+}
+
+// Saved frame pointer and return address of the frame at fp, without
+// faulting if fp points nowhere
+static bool read_frame(uintptr_t fp, uintptr_t frame[2]) {
+    struct iovec local = { frame, 2 * sizeof(uintptr_t) };
+    struct iovec remote = { (void *)(fp + FRAME_OFFSET), 2 * sizeof(uintptr_t) };
+
+    return process_vm_readv(pid, &local, 1, &remote, 1, 0) == (ssize_t)(2 * sizeof(uintptr_t));
+}
+
+static void record(struct sample *s, const void *context) {
+    uintptr_t pc, fp, sp;
+
+    s->tid = (pid_t)syscall(SYS_gettid);
+    s->depth = 0;
+    if (!frame_registers(context, &pc, &fp, &sp)) return;
+
+    s->pc[s->depth++] = pc;
+    if (fp < sp) return;
+
+    while (s->depth < PROFILER_MAX_DEPTH && fp % sizeof(uintptr_t) == 0) {
+        uintptr_t frame[2];
+
+        if (!read_frame(fp, frame) || frame[1] == 0) break;
+        s->pc[s->depth++] = frame[1];
+
+        // The stack grows down, so callers' frames are strictly above
+        if (frame[0] <= fp || frame[0] - fp > MAX_FRAME_SIZE) break;
+        fp = frame[0];
+    }
+}
+
+static void on_sigprof(int sig, siginfo_t *info, void *context) {
+    int saved_errno = errno;
+    (void)sig;
+    (void)info;
+
+    __atomic_add_fetch(&active, 1, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&sampling, __ATOMIC_ACQUIRE)) {
+        size_t i = __atomic_fetch_add(&next_sample, 1, __ATOMIC_RELAXED);
+        if (i < capacity) record(&samples[i], context);
+    }
+    __atomic_sub_fetch(&active, 1, __ATOMIC_RELEASE);
+    errno = saved_errno;
+}
+
+static void set_timer(unsigned int hz) {
+    struct itimerval timer = { { 0, 0 }, { 0, 0 } };
+
+    if (hz) {
+        timer.it_interval.tv_usec = (suseconds_t)(1000000 / hz);
+        timer.it_value = timer.it_interval;
+    }
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+int profiler_start(unsigned int hz, size_t max_samples) {
+    int ret = -1;
+
+#ifndef HAVE_FRAME_REGISTERS
+    return -1;
+#endif
+    if (hz == 0 || hz > 1000 || max_samples == 0) return -1;
+
+    pthread_mutex_lock(&profiler_lock);
+    if (started) goto out;
+
+    struct sample *buf = malloc(max_samples * sizeof(*buf));
+    if (buf == NULL) goto out;
+    free(samples);
+    samples = buf;
+    capacity = max_samples;
+    next_sample = 0;
+    pid = getpid();
+
+    // The handler stays installed once profiling ran: a SIGPROF still
+    // pending after the timer stops must not meet the default action,
+    // which terminates the process
+    if (!handler_installed) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = on_sigprof;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGPROF, &sa, NULL) != 0) goto out;
+        handler_installed = true;
+    }
+
+    __atomic_store_n(&sampling, true, __ATOMIC_RELEASE);
+    set_timer(hz);
+    started = true;
+    ret = 0;
+
+out:
+    pthread_mutex_unlock(&profiler_lock);
+    return ret;
+}
+
+void profiler_stop(void) {
+    pthread_mutex_lock(&profiler_lock);
+    if (started) {
+        set_timer(0);
+        __atomic_store_n(&sampling, false, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&active, __ATOMIC_ACQUIRE) != 0) sched_yield();
+        started = false;
+    }
+    pthread_mutex_unlock(&profiler_lock);
+}
+
+struct module {
+    uintptr_t start;
+    uintptr_t end;
+    uintptr_t bias;             // subtracted to get addresses of the ELF file
+    char name[48];
+};
+
+struct symbolizer {
+    struct module modules[MAX_MODULES];
+    size_t module_count;
+    struct {
+        pid_t tid;
+        char name[20];
+    } threads[MAX_THREADS];
+    size_t thread_count;
+};
+
+static int add_module(struct dl_phdr_info *info, size_t size, void *arg) {
+    struct symbolizer *sym = arg;
+    (void)size;
+
+    if (sym->module_count == MAX_MODULES) return 1;
+
+    struct module *m = &sym->modules[sym->module_count];
+    m->start = UINTPTR_MAX;
+    m->end = 0;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X)) continue;
+        uintptr_t start = info->dlpi_addr + ph->p_vaddr;
+        if (start < m->start) m->start = start;
+        if (start + ph->p_memsz > m->end) m->end = start + ph->p_memsz;
+    }
+    if (m->end == 0) return 0;
+
+    const char *name = info->dlpi_name && *info->dlpi_name ? info->dlpi_name : program_invocation_name;
+    const char *base = strrchr(name, '/');
+    snprintf(m->name, sizeof(m->name), "%s", base ? base + 1 : name);
+    m->bias = info->dlpi_addr;
+    sym->module_count++;
+    return 0;
+}
+
+static const char *thread_name(struct symbolizer *sym, pid_t tid) {
+    for (size_t i = 0; i < sym->thread_count; i++) {
+        if (sym->threads[i].tid == tid) return sym->threads[i].name;
+    }
+
+    static char fallback[20];
+    char *name = fallback;
+    if (sym->thread_count < MAX_THREADS) {
+        sym->threads[sym->thread_count].tid = tid;
+        name = sym->threads[sym->thread_count++].name;
+    }
+
+    // Threads that are gone by now keep their id
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/comm", (int)tid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL || fgets(name, sizeof(fallback), f) == NULL) {
+        snprintf(name, sizeof(fallback), "tid-%d", (int)tid);
+    }
+    if (f) fclose(f);
+    name[strcspn(name, "\n")] = '\0';
+
+    // ';' and ' ' separate frames and the count in folded stacks
+    for (char *p = name; *p; p++) {
+        if (*p == ';' || *p == ' ') *p = '_';
+    }
+    return name;
+}
+
+static size_t format_frame(const struct symbolizer *sym, uintptr_t addr, char *buf, size_t size) {
+    Dl_info info;
+
+    if (dladdr((void *)addr, &info) && info.dli_sname) {
+        return (size_t)snprintf(buf, size, "%s", info.dli_sname);
+    }
+    for (size_t i = 0; i < sym->module_count; i++) {
+        const struct module *m = &sym->modules[i];
+        if (addr >= m->start && addr < m->end) {
+            return (size_t)snprintf(buf, size, "%s+0x%lx", m->name, (unsigned long)(addr - m->bias));
+        }
+    }
+    return (size_t)snprintf(buf, size, "0x%lx", (unsigned long)addr);
+}
+
+// "thread;outer;...;leaf", into a new string
+static char *fold(struct symbolizer *sym, const struct sample *s) {
+    char line[LINE_SIZE];
+    size_t len = (size_t)snprintf(line, sizeof(line), "%s", thread_name(sym, s->tid));
+
+    for (uint32_t i = s->depth; i-- > 0 && len + 1 < sizeof(line);) {
+        line[len++] = ';';
+        // Return addresses point after the call; look up the call itself
+        uintptr_t addr = i == 0 ? s->pc[i] : s->pc[i] - 1;
+        len += format_frame(sym, addr, line + len, sizeof(line) - len);
+        if (len >= sizeof(line)) len = sizeof(line) - 1;
+    }
+    line[len] = '\0';
+    return strdup(line);
+}
+
+static int compare_lines(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int profiler_write_folded(FILE *out, struct profiler_stats *stats) {
+    int ret = -1;
+
+    pthread_mutex_lock(&profiler_lock);
+    if (started) goto out;
+
+    size_t count = next_sample < capacity ? next_sample : capacity;
+    if (stats) {
+        stats->samples = count;
+        stats->dropped = next_sample - count;
+    }
+
+    if (out == NULL) count = 0;
+
+    struct symbolizer *sym = calloc(1, sizeof(*sym));
+    char **lines = calloc(count ? count : 1, sizeof(*lines));
+    if (sym == NULL || lines == NULL) {
+        free(sym);
+        free(lines);
+        goto out;
+    }
+    dl_iterate_phdr(add_module, sym);
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (samples[i].depth == 0) continue;
+        if ((lines[n] = fold(sym, &samples[i])) != NULL) n++;
+    }
+    qsort(lines, n, sizeof(*lines), compare_lines);
+
+    for (size_t i = 0; i < n;) {
+        size_t j = i + 1;
+        while (j < n && strcmp(lines[i], lines[j]) == 0) j++;
+        fprintf(out, "%s %zu\n", lines[i], j - i);
+        i = j;
+    }
+    for (size_t i = 0; i < n; i++) {
+        free(lines[i]);
+    }
+    free(lines);
+    free(sym);
+
+    free(samples);
+    samples = NULL;
+    capacity = 0;
+    next_sample = 0;
+    ret = 0;
+
+out:
+    pthread_mutex_unlock(&profiler_lock);
+    return ret;
+}
@@ -0,0 +1,50 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+// Sampling CPU profiler for daemons that cannot be run under perf.
+//
+// While running, ITIMER_PROF raises SIGPROF every 1/hz seconds of process
+// CPU time, in the thread that is using it. The handler walks that thread's
+// frame pointers from the interrupted context into a sample buffer
+// allocated by profiler_start(); frames are read through process_vm_readv()
+// so a bad frame pointer ends the walk instead of crashing. Code built
+// without frame pointers (-fno-omit-frame-pointer, plus -marm on 32-bit
+// ARM) still shows up, as its leaf function only.
+//
+// Only one profile runs per process. The program must not use SIGPROF or
+// ITIMER_PROF for anything else.
+
+#define PROFILER_MAX_DEPTH 24
+
+// Start sampling at hz samples per CPU second, keeping up to max_samples.
+// Returns -1 if a profile is already running or on error.
+int profiler_start(unsigned int hz, size_t max_samples);
+
+// Stop sampling; the samples stay until profiler_write_folded() or the
+// next profiler_start()
+void profiler_stop(void);
+
+struct profiler_stats {
+    size_t samples;
+    size_t dropped;         // taken after the buffer filled up
+};
+
+// Write the samples as folded stacks, one "thread;outer;...;leaf count"
+// line per distinct stack, for flamegraph.pl or speedscope, then release
+// them. Frames are symbol names where the dynamic symbol table has them,
+// otherwise module+0xoffset for addr2line on the unstripped binary.
+// out NULL only discards the samples. Returns -1 while a profile runs.
+int profiler_write_folded(FILE *out, struct profiler_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,289 @@
+#include "access_log.h"
+#include "handlers.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define ACCESS_RING_SIZE 64             // records per thread, power of two
+#define ACCESS_URL_MAX 94
+#define FLUSH_INTERVAL_US 100000
+#define WRITE_BUFFER 16384
+#define MAX_LINE_LEN 256
+
+// 128 bytes, so a thread's ring is 8 KiB
+struct access_record {
+    uint32_t time;
+    uint16_t status;
+    uint8_t family;                     // AF_INET, AF_INET6 or 0 if unknown
+    uint8_t url_len;
+    uint8_t addr[16];
+    char method[8];
+    char url[ACCESS_URL_MAX];
+};
+
+// Single producer (the owning request thread), single consumer (the writer)
+struct access_ring {
+    struct access_record records[ACCESS_RING_SIZE];
+    uint32_t head;                      // written by the owner only
+    uint32_t tail;                      // written by the writer only
+    uint32_t dropped;                   // written by the owner only
+    uint32_t reported;                  // drops already reported, writer only
+    bool orphaned;                      // owner thread has exited
+    struct access_ring *next;
+};
+
+enum sink {
+    SINK_STDOUT,
+    SINK_SYSLOG,
+    SINK_FILE,
+};
+
+// Rings are pushed by request threads and unlinked by the writer
+static struct access_ring *rings = NULL;
+static __thread struct access_ring *thread_ring = NULL;
+static pthread_key_t ring_key;
+static bool started = false;
+
+// Writer state
+static enum sink sink = SINK_STDOUT;
+static const char *file_path = NULL;
+static size_t file_max_size = 0;
+static size_t file_size = 0;
+static int file_fd = -1;
+static char write_buffer[WRITE_BUFFER];
+static size_t buffered = 0;
+
+static void ring_orphan(void *arg) {
+    struct access_ring *r = arg;
+    __atomic_store_n(&r->orphaned, true, __ATOMIC_RELEASE);
+}
+
+static struct access_ring *ring_register(void) {
+    struct access_ring *r = calloc(1, sizeof(*r));
+    if (r == NULL) return NULL;
+
+    // The writer frees the ring once the thread is gone and it is drained
+    pthread_setspecific(ring_key, r);
+    r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &r->next, r, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    thread_ring = r;
+    return r;
+}
+
+void log_request(struct MHD_Connection *connection,
+                const char *method,
+                const char *url,
+                unsigned int status_code) {
+    struct access_ring *r = thread_ring;
+
+    if (!started) return;
+    if (r == NULL && (r = ring_register()) == NULL) return;
+
+    uint32_t head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == ACCESS_RING_SIZE) {
+        __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    struct access_record *rec = &r->records[head % ACCESS_RING_SIZE];
+    size_t url_len = strlen(url);
+
+    rec->time = (uint32_t)time(NULL);
+    rec->status = (uint16_t)status_code;
+    rec->family = 0;
+    strncpy(rec->method, method, sizeof(rec->method));
+    rec->url_len = (uint8_t)(url_len < ACCESS_URL_MAX ? url_len : ACCESS_URL_MAX);
+    memcpy(rec->url, url, rec->url_len);
+
+    const union MHD_ConnectionInfo *info =
+        MHD_get_connection_info(connection, MHD_CONNECTION_INFO_CLIENT_ADDRESS);
+    if (info && info->client_addr) {
+        const struct sockaddr *addr = (const struct sockaddr *)info->client_addr;
+        if (addr->sa_family == AF_INET) {
+            rec->family = AF_INET;
+            memcpy(rec->addr, &((const struct sockaddr_in *)addr)->sin_addr, 4);
+        } else if (addr->sa_family == AF_INET6) {
+            rec->family = AF_INET6;
+            memcpy(rec->addr, &((const struct sockaddr_in6 *)addr)->sin6_addr, 16);
+        }
+    }
+
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void ring_unlink(struct access_ring *r) {
+    struct access_ring *expected = r;
+
+    if (__atomic_compare_exchange_n(&rings, &expected, r->next, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    // Not the head any more; only the writer touches the next pointers
+    for (struct access_ring *p = expected; p; p = p->next) {
+        if (p->next == r) {
+            p->next = r->next;
+            return;
+        }
+    }
+}
+
+static void sink_open(void) {
+    file_fd = open(file_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    file_size = 0;
+    if (file_fd != -1) {
+        off_t size = lseek(file_fd, 0, SEEK_END);
+        if (size > 0) file_size = (size_t)size;
+    }
+}
+
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;     // sink broken, drop the batch
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+static void flush_buffer(void) {
+    if (buffered == 0) return;
+
+    if (sink == SINK_FILE) {
+        if (file_fd != -1 && file_max_size && file_size + buffered > file_max_size) {
+            char rotated[512];
+            close(file_fd);
+            snprintf(rotated, sizeof(rotated), "%s.1", file_path);
+            rename(file_path, rotated);
+            file_fd = -1;
+        }
+        if (file_fd == -1) sink_open();
+        if (file_fd != -1) {
+            write_all(file_fd, write_buffer, buffered);
+            file_size += buffered;
+        }
+    } else {
+        write_all(STDOUT_FILENO, write_buffer, buffered);
+    }
+    buffered = 0;
+}
+
+static void emit_line(const char *line, size_t len) {
+    if (sink == SINK_SYSLOG) {
+        syslog(LOG_INFO, "%.*s", (int)len, line);
+        return;
+    }
+    if (buffered + len + 1 > sizeof(write_buffer)) flush_buffer();
+    memcpy(write_buffer + buffered, line, len);
+    write_buffer[buffered + len] = '\n';
+    buffered += len + 1;
+}
+
+static void format_record(const struct access_record *rec) {
+    // Formatting the timestamp once per second is enough for a log
+    static time_t cached_time = (time_t)-1;
+    static char timestamp[32];
+    char client_ip[INET6_ADDRSTRLEN] = "unknown";
+    char line[MAX_LINE_LEN];
+    char method[sizeof(rec->method) + 1];
+    int len;
+
+    if (rec->family == AF_INET || rec->family == AF_INET6) {
+        inet_ntop(rec->family, rec->addr, client_ip, sizeof(client_ip));
+    }
+    memcpy(method, rec->method, sizeof(rec->method));
+    method[sizeof(rec->method)] = '\0';
+
+    if (sink == SINK_SYSLOG) {
+        // syslogd adds its own timestamp
+        len = snprintf(line, sizeof(line), "%s - %s %.*s %u", client_ip, method,
+                       (int)rec->url_len, rec->url, rec->status);
+    } else {
+        if ((time_t)rec->time != cached_time) {
+            struct tm tm;
+            cached_time = (time_t)rec->time;
+            localtime_r(&cached_time, &tm);
+            strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm);
+        }
+        len = snprintf(line, sizeof(line), "[%s] %s - %s %.*s %u", timestamp, client_ip, method,
+                       (int)rec->url_len, rec->url, rec->status);
+    }
+    if (len > 0) emit_line(line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+}
+
+static void drain(void) {
+    struct access_ring *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+
+    while (r) {
+        struct access_ring *next = r->next;
+        // Read orphaned before head, so an exited thread's last records
+        // are drained before its ring is freed
+        bool orphaned = __atomic_load_n(&r->orphaned, __ATOMIC_ACQUIRE);
+        uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        uint32_t tail = r->tail;
+
+        for (; tail != head; tail++) {
+            format_record(&r->records[tail % ACCESS_RING_SIZE]);
+        }
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+        uint32_t dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+        if (dropped != r->reported) {
+            char line[64];
+            int len = snprintf(line, sizeof(line), "access log: %u requests not logged", dropped - r->reported);
+            emit_line(line, (size_t)len);
+            r->reported = dropped;
+        }
+
+        if (orphaned) {
+            ring_unlink(r);
+            free(r);
+        }
+        r = next;
+    }
+    flush_buffer();
+}
+
+static void *writer_thread(void *arg) {
+    (void)arg;
+
+    while (1) {
+        usleep(FLUSH_INTERVAL_US);
+        drain();
+    }
+    return NULL;
+}
+
+int access_log_start(const char *target, size_t max_size) {
+    pthread_t thread;
+
+    if (strcmp(target, "-") == 0) {
+        sink = SINK_STDOUT;
+    } else if (strcmp(target, "syslog") == 0) {
+        sink = SINK_SYSLOG;
+        openlog("httpd", LOG_PID, LOG_DAEMON);
+    } else {
+        sink = SINK_FILE;
+        file_path = target;
+        file_max_size = max_size;
+        sink_open();
+        if (file_fd == -1) return -1;
+    }
+
+    if (pthread_key_create(&ring_key, ring_orphan) != 0) return -1;
+    if (pthread_create(&thread, NULL, writer_thread, NULL) != 0) return -1;
+    pthread_detach(thread);
+
+    started = true;
+    return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stddef.h>
+
+// Asynchronous access log behind log_request().
+//
+// Request threads only copy a fixed-size binary record into a ring owned by
+// the calling thread; a background writer formats the records and writes
+// them out in batches. A full ring drops the record and counts it instead of
+// waiting, so a stalled sink (full flash, blocked stdout) never delays a
+// response.
+
+// Start the writer. target is "-" for stdout, "syslog", or a file path;
+// files are rotated to target.1 when they exceed max_size bytes.
+int access_log_start(const char *target, size_t max_size);
+
+#endif // ACCESS_LOG_H
@@ -0,0 +1,13 @@
+#include "assets.h"
+#include "mph.h"
+#include <string.h>
+
+const struct asset *asset_lookup(const char *path) {
+    size_t len = strlen(path);
+
+    if (assets_count == 0) return NULL;
+
+    const struct asset *a = &assets[mph_lookup(assets_seeds, assets_count, path, len)];
+    if (strcmp(a->path, path) != 0) return NULL;
+    return a;
+}
@@ -0,0 +1,29 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Web UI file compiled into the binary by tools/gen_assets.c. Everything,
+// including the header values, lives in .rodata.
+struct asset {
+    const char *path;               // URL path, e.g. "/index.html"
+    const unsigned char *data;
+    size_t size;
+    const char *content_type;
+    const char *etag;               // quoted strong validator
+    const char *cache_control;
+    const char *last_modified;      // HTTP-date of mtime
+    time_t mtime;
+};
+
+// Generated tables, indexed by mph_lookup()
+extern const struct asset assets[];
+extern const unsigned int assets_count;
+extern const uint32_t assets_seeds[];
+
+// Find an embedded file by URL path, NULL if there is none
+const struct asset *asset_lookup(const char *path);
+
+#endif // ASSETS_H
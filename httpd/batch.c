@@ -0,0 +1,195 @@
+#include "handlers.h"
+#include "request_body.h"
+#include "ratelimit.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define MAX_BATCH 16
+#define MAX_SUB_URL 512
+
+// Response of one sub-request, filled in by batch_capture()
+struct batch_item {
+    bool done;
+    bool json;
+    unsigned int status_code;
+    char *body;
+    size_t len;
+};
+
+// Set while a sub-request runs on this thread
+static __thread struct batch_item *current = NULL;
+
+bool batch_active(void) {
+    return current != NULL;
+}
+
+bool batch_capture(unsigned int status_code, const char *body, size_t len, bool json) {
+    struct batch_item *item = current;
+
+    if (item == NULL) return false;
+    if (!item->done) {
+        item->body = malloc(len ? len : 1);
+        if (item->body) memcpy(item->body, body, len);
+        item->len = item->body ? len : 0;
+        item->json = json && item->body != NULL;
+        item->status_code = item->body ? status_code : MHD_HTTP_INTERNAL_SERVER_ERROR;
+        item->done = true;
+    }
+    return true;
+}
+
+// Split "a=1&b=x%20y" in place, decoding names and values
+static bool parse_query(char *query, struct request_args *args) {
+    args->count = 0;
+    for (char *p = query; p && *p;) {
+        char *next = strchr(p, '&');
+        if (next) *next++ = '\0';
+        if (*p) {
+            if (args->count == REQUEST_MAX_ARGS) return false;
+            char *value = strchr(p, '=');
+            if (value) {
+                *value++ = '\0';
+                MHD_http_unescape(value);
+            } else {
+                value = "";
+            }
+            MHD_http_unescape(p);
+            args->names[args->count] = p;
+            args->values[args->count] = value;
+            args->count++;
+        }
+        p = next;
+    }
+    return true;
+}
+
+static void set_error(unsigned int status_code, const char *error) {
+    batch_capture(status_code, error, strlen(error), false);
+}
+
+// Run GET url through its handler, collecting the response into item.
+// Sub-requests after the first, which the batch itself paid for, take a
+// read token each, so a batch costs what its GETs would.
+static void run_sub_request(struct MHD_Connection *connection, const char *url, bool charge,
+                            struct batch_item *item) {
+    char path[MAX_SUB_URL];
+    struct request_args args = { 0 };
+    void *state = NULL;
+    size_t upload_size = 0;
+
+    current = item;
+
+    if (strlen(url) >= sizeof(path)) {
+        set_error(MHD_HTTP_URI_TOO_LONG, "URL too long");
+        goto out;
+    }
+    strcpy(path, url);
+
+    char *query = strchr(path, '?');
+    if (query) *query++ = '\0';
+
+    const struct route *r = routes_find(HTTP_GET, path);
+    if (r == NULL) {
+        set_error(MHD_HTTP_NOT_FOUND, "API endpoint not found");
+        goto out;
+    }
+    if (!r->batch) {
+        // The web UI matches this text, see www/src/api/client.ts
+        set_error(MHD_HTTP_BAD_REQUEST, "Endpoint cannot be batched");
+        goto out;
+    }
+    unsigned int retry_after;
+    if (charge && !ratelimit_admit(connection, RATE_READ, &retry_after)) {
+        set_error(MHD_HTTP_TOO_MANY_REQUESTS, "Too many requests");
+        goto out;
+    }
+    if (!parse_query(query, &args)) {
+        set_error(MHD_HTTP_BAD_REQUEST, "Too many query parameters");
+        goto out;
+    }
+
+    struct request sub = {
+        .url = path,
+        .method = "GET",
+        .upload_data = NULL,
+        .upload_data_size = &upload_size,
+        .con_cls = &state,
+        .args = &args,
+    };
+    if (r->handler(connection, &sub) == MHD_NO || !item->done) {
+        set_error(MHD_HTTP_INTERNAL_SERVER_ERROR, "Internal server error");
+    }
+    if (state) ((struct request_state *)state)->release(state, true);
+
+out:
+    current = NULL;
+}
+
+// POST /api/batch {"requests": ["/api/gateway/status", "/api/logs?limit=50"]}
+//
+// Runs each GET in order on this thread and answers with
+// {"responses": [{"status": 200, "body": {...}}, {"status": 404, "error": "..."}]}
+// Only routes marked .batch take part; their JSON helpers hand the body
+// over through batch_capture() instead of queueing a response.
+enum MHD_Result handle_batch(struct MHD_Connection *connection, const struct request *request) {
+    struct json_object *root, *requests;
+    struct json_writer w;
+
+    switch (request_body_read(connection, request, &root)) {
+    case BODY_PENDING:
+        return MHD_YES;
+    case BODY_TOO_LARGE:
+        return send_error_response(connection, request->method, request->url,
+            "Request body too large", MHD_HTTP_CONTENT_TOO_LARGE);
+    case BODY_EMPTY:
+    case BODY_INVALID:
+        return send_error_response(connection, request->method, request->url,
+            "Invalid JSON data", MHD_HTTP_BAD_REQUEST);
+    case BODY_READY:
+        break;
+    }
+
+    size_t count = 0;
+    bool valid = json_object_object_get_ex(root, "requests", &requests) &&
+                 json_object_is_type(requests, json_type_array);
+    if (valid) {
+        count = json_object_array_length(requests);
+        for (size_t i = 0; i < count; i++) {
+            if (!json_object_is_type(json_object_array_get_idx(requests, i), json_type_string)) valid = false;
+        }
+    }
+    if (!valid || count == 0 || count > MAX_BATCH) {
+        json_object_put(root);
+        return send_error_response(connection, request->method, request->url,
+            "Expected {\"requests\": [up to 16 URLs]}", MHD_HTTP_BAD_REQUEST);
+    }
+
+    jw_init_pooled(&w, 4096);
+    jw_begin_object(&w);
+    jw_key(&w, "responses");
+    jw_begin_array(&w);
+    for (size_t i = 0; i < count; i++) {
+        struct batch_item item = { 0 };
+
+        run_sub_request(connection, json_object_get_string(json_object_array_get_idx(requests, i)), i > 0, &item);
+
+        jw_begin_object(&w);
+        jw_kv_uint(&w, "status", item.status_code);
+        if (item.json) {
+            jw_key(&w, "body");
+            jw_raw(&w, item.body, item.len);
+        } else {
+            jw_key(&w, "error");
+            jw_string_len(&w, item.body ? item.body : "", item.len);
+        }
+        jw_end_object(&w);
+        free(item.body);
+    }
+    jw_end_array(&w);
+    jw_end_object(&w);
+
+    json_object_put(root);
+    return send_json_writer(connection, request->method, request->url, &w, MHD_HTTP_OK);
+}
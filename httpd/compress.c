@@ -0,0 +1,242 @@
+#include "compress.h"
+#include "respool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <zlib.h>
+
+// 8 KiB window and memLevel 6 keep a stream at about 64 KiB per thread;
+// API bodies are far from long enough to profit from the full 32 KiB
+#define WINDOW_BITS 13
+#define MEM_LEVEL 6
+
+#define GZIP_HEADER 10
+#define GZIP_TRAILER 8
+#define ZLIB_HEADER 2
+#define ZLIB_TRAILER 4
+
+struct compressor {
+    z_stream strm;
+    int level;
+};
+
+static size_t min_size = 1024;
+static int default_level = 1;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static __thread struct compressor *compressor = NULL;
+static __thread int route_level = COMPRESS_NEVER;
+
+static uint64_t responses[3];       // by enum content_encoding
+static uint64_t bytes_in = 0;
+static uint64_t bytes_out = 0;
+
+void compress_init(size_t size, int level) {
+    min_size = size;
+    if (level >= 1 && level <= COMPRESS_MAX_LEVEL) default_level = level;
+}
+
+void compress_set_route_level(int level) {
+    route_level = level;
+}
+
+static void release_compressor(void *arg) {
+    struct compressor *c = arg;
+
+    deflateEnd(&c->strm);
+    free(c);
+}
+
+static void create_key(void) {
+    pthread_key_create(&key, release_compressor);
+}
+
+// Stream of this thread, created on its first compressed response
+static struct compressor *thread_compressor(void) {
+    if (compressor) return compressor;
+
+    pthread_once(&key_once, create_key);
+    struct compressor *c = calloc(1, sizeof(*c));
+    if (c == NULL) return NULL;
+
+    c->level = default_level;
+    if (deflateInit2(&c->strm, c->level, Z_DEFLATED, -WINDOW_BITS, MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(c);
+        return NULL;
+    }
+    pthread_setspecific(key, c);
+    compressor = c;
+    return c;
+}
+
+// q-value of a list element's parameters ("; q=0.5"), in thousandths
+static unsigned int parse_q(const char *p, const char *end) {
+    while (p < end && (*p == ';' || *p == ' ' || *p == '\t')) p++;
+    if (end - p < 2 || (p[0] != 'q' && p[0] != 'Q') || p[1] != '=') return 1000;
+    p += 2;
+
+    if (p < end && *p == '1') return 1000;
+    unsigned int q = 0, scale = 1000;
+    if (p < end && *p == '0') p++;
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9' && scale > 1; p++) {
+            scale /= 10;
+            q += (unsigned int)(*p - '0') * scale;
+        }
+    }
+    return q;
+}
+
+enum content_encoding compress_negotiate(struct MHD_Connection *connection) {
+    const char *header = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+                                                     MHD_HTTP_HEADER_ACCEPT_ENCODING);
+    int gzip = -1, deflate = -1, any = -1;      // q-values, -1 if not listed
+
+    if (header == NULL) return ENCODING_IDENTITY;
+
+    for (const char *p = header; *p;) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (*p == '\0') break;
+
+        const char *end = strchr(p, ',');
+        if (end == NULL) end = p + strlen(p);
+        const char *name_end = p;
+        while (name_end < end && *name_end != ';' && *name_end != ' ' && *name_end != '\t') name_end++;
+
+        size_t name_len = (size_t)(name_end - p);
+        int q = (int)parse_q(name_end, end);
+        if ((name_len == 4 && strncasecmp(p, "gzip", 4) == 0) ||
+            (name_len == 6 && strncasecmp(p, "x-gzip", 6) == 0)) {
+            gzip = q;
+        } else if (name_len == 7 && strncasecmp(p, "deflate", 7) == 0) {
+            deflate = q;
+        } else if (name_len == 1 && *p == '*') {
+            any = q;
+        }
+        p = end;
+    }
+
+    if (gzip < 0) gzip = any;
+    if (deflate < 0) deflate = any;
+    if (gzip > 0 && gzip >= deflate) return ENCODING_GZIP;
+    if (deflate > 0) return ENCODING_DEFLATE;
+    return ENCODING_IDENTITY;
+}
+
+const char *compress_encoding_name(enum content_encoding encoding) {
+    switch (encoding) {
+    case ENCODING_GZIP:
+        return "gzip";
+    case ENCODING_DEFLATE:
+        return "deflate";
+    default:
+        return NULL;
+    }
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static size_t write_header(uint8_t *p, enum content_encoding encoding, int level) {
+    if (encoding == ENCODING_GZIP) {
+        static const uint8_t gzip[GZIP_HEADER] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+        memcpy(p, gzip, GZIP_HEADER);
+        p[8] = level == 9 ? 2 : level == 1 ? 4 : 0;
+        return GZIP_HEADER;
+    }
+
+    // CM 8 with CINFO for the window, FLEVEL from the level, FCHECK last
+    unsigned int cmf = (WINDOW_BITS - 8) << 4 | 8;
+    unsigned int flg = (level == 1 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6;
+    flg += 31 - (cmf << 8 | flg) % 31;
+    p[0] = (uint8_t)cmf;
+    p[1] = (uint8_t)flg;
+    return ZLIB_HEADER;
+}
+
+char *compress_body(enum content_encoding encoding, int level, const char *body, size_t len,
+                    size_t *out_len) {
+    if (encoding == ENCODING_IDENTITY || min_size == 0 || len > UINT32_MAX) return NULL;
+    if (level < 1 || level > COMPRESS_MAX_LEVEL) level = default_level;
+
+    struct compressor *c = thread_compressor();
+    if (c == NULL) return NULL;
+
+    size_t trailer = encoding == ENCODING_GZIP ? GZIP_TRAILER : ZLIB_TRAILER;
+    if (len <= GZIP_HEADER + trailer) return NULL;
+
+    // Only a smaller body is worth sending, so len bounds the output
+    uint8_t *out = len <= respool_size() ? respool_get() : NULL;
+    if (out == NULL) out = malloc(len);
+    if (out == NULL) return NULL;
+
+    deflateReset(&c->strm);
+    if (c->level != level && deflateParams(&c->strm, level, Z_DEFAULT_STRATEGY) == Z_OK) {
+        c->level = level;
+    }
+
+    size_t header = write_header(out, encoding, c->level);
+    c->strm.next_in = (Bytef *)body;
+    c->strm.avail_in = (uInt)len;
+    c->strm.next_out = out + header;
+    c->strm.avail_out = (uInt)(len - header - trailer);
+    if (deflate(&c->strm, Z_FINISH) != Z_STREAM_END) {
+        respool_free(out);
+        return NULL;
+    }
+
+    size_t n = header + c->strm.total_out;
+    if (encoding == ENCODING_GZIP) {
+        put_le32(out + n, (uint32_t)crc32(crc32(0, Z_NULL, 0), (const Bytef *)body, (uInt)len));
+        put_le32(out + n + 4, (uint32_t)len);
+    } else {
+        put_be32(out + n, (uint32_t)adler32(adler32(0, Z_NULL, 0), (const Bytef *)body, (uInt)len));
+    }
+    n += trailer;
+
+    __atomic_add_fetch(&responses[encoding], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&bytes_in, len, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&bytes_out, n, __ATOMIC_RELAXED);
+
+    *out_len = n;
+    return (char *)out;
+}
+
+struct MHD_Response *compress_response(struct MHD_Connection *connection, const char *body,
+                                       size_t len, size_t *sent_len) {
+    if (route_level == COMPRESS_NEVER || min_size == 0 || len < min_size) return NULL;
+
+    enum content_encoding encoding = compress_negotiate(connection);
+    char *out = compress_body(encoding, route_level, body, len, sent_len);
+    if (out == NULL) return NULL;
+
+    struct MHD_Response *response = MHD_create_response_from_buffer_with_free_callback(
+        *sent_len, out, &respool_free);
+    if (response == NULL) {
+        respool_free(out);
+        return NULL;
+    }
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_ENCODING, compress_encoding_name(encoding));
+    return response;
+}
+
+void compress_stats(struct compress_stats *stats) {
+    stats->gzip = __atomic_load_n(&responses[ENCODING_GZIP], __ATOMIC_RELAXED);
+    stats->deflate = __atomic_load_n(&responses[ENCODING_DEFLATE], __ATOMIC_RELAXED);
+    stats->bytes_in = __atomic_load_n(&bytes_in, __ATOMIC_RELAXED);
+    stats->bytes_out = __atomic_load_n(&bytes_out, __ATOMIC_RELAXED);
+}
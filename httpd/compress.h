@@ -0,0 +1,63 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <microhttpd.h>
+
+// gzip/deflate for API responses, negotiated through Accept-Encoding.
+//
+// Every thread that compresses keeps one raw deflate stream, allocated on
+// its first response and reset for each one after that, so a compressed
+// response costs no allocation beyond its output buffer (itself a pooled
+// one when it fits, see respool.h). The gzip and zlib framing is written
+// around the raw stream here, which lets the two encodings share it.
+
+#define COMPRESS_DEFAULT 0      // route level: the -Z level
+#define COMPRESS_NEVER (-1)     // route level: always send identity
+#define COMPRESS_MAX_LEVEL 9
+
+enum content_encoding {
+    ENCODING_IDENTITY,
+    ENCODING_GZIP,
+    ENCODING_DEFLATE,
+};
+
+// Bodies shorter than min_size are sent as is, 0 turns compression off;
+// level 1-9 applies to routes that do not set their own
+void compress_init(size_t min_size, int level);
+
+// Level of the route this thread is running, COMPRESS_DEFAULT/NEVER or 1-9
+void compress_set_route_level(int level);
+
+// Preferred encoding the request accepts, by q-value; gzip wins ties
+enum content_encoding compress_negotiate(struct MHD_Connection *connection);
+
+// Content-Encoding value of encoding, NULL for identity
+const char *compress_encoding_name(enum content_encoding encoding);
+
+// Compress body into a new buffer (release with respool_free()), NULL if
+// compression is off, it would not get smaller or on error. The -z
+// threshold is left to the caller: compress_response() applies it, a
+// body compressed once and served many times may be worth it below.
+char *compress_body(enum content_encoding encoding, int level, const char *body, size_t len,
+                    size_t *out_len);
+
+// Response for body in the encoding the request accepts at the level of
+// the current route, with Content-Encoding set; NULL to send body as is.
+// *sent_len is the length of the compressed body. Either way the response
+// needs Vary: Accept-Encoding, add_json_headers() sets it.
+struct MHD_Response *compress_response(struct MHD_Connection *connection, const char *body,
+                                       size_t len, size_t *sent_len);
+
+struct compress_stats {
+    uint64_t gzip;          // responses sent gzip-encoded
+    uint64_t deflate;
+    uint64_t bytes_in;      // their bodies before and after compression
+    uint64_t bytes_out;
+};
+
+void compress_stats(struct compress_stats *stats);
+
+#endif // COMPRESS_H
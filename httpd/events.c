@@ -0,0 +1,298 @@
+#include "events.h"
+#include "metrics.h"
+#include "handlers.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define EVENT_RING_SIZE 64
+#define MAX_STICKY_TYPES 4
+#define EVENT_BLOCK_SIZE 4096
+#define RETRY_MS 3000
+
+// Preformatted event, shared by the ring and every client still sending it.
+// The text starts with the "id:" line so sticky replays can skip it.
+struct event {
+    unsigned int refs;
+    uint64_t id;
+    size_t id_len;
+    size_t len;
+    char type[16];
+    char text[];
+};
+
+struct client {
+    struct MHD_Connection *connection;
+    uint64_t next_id;                       // next ring event to send
+    struct event *sticky[MAX_STICKY_TYPES]; // replays still to send
+    struct event *current;                  // event being sent
+    size_t offset;                          // bytes of current already sent
+    char scratch[96];                       // retry/ping/reset lines
+    size_t scratch_len;
+    size_t scratch_off;
+    bool suspended;
+    bool heartbeat;
+    unsigned int metrics_route;             // streamed bytes are counted here
+    struct client *next;
+};
+
+// Everything below is protected by hub_lock
+static pthread_mutex_t hub_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct event *ring[EVENT_RING_SIZE];
+static struct event *sticky[MAX_STICKY_TYPES];
+static uint64_t last_id = 0;
+static struct client *clients = NULL;
+static unsigned int heartbeat_interval = 15;
+
+static void event_unref(struct event *ev) {
+    if (ev && --ev->refs == 0) free(ev);
+}
+
+static uint64_t oldest_id(void) {
+    return last_id >= EVENT_RING_SIZE ? last_id - EVENT_RING_SIZE + 1 : 1;
+}
+
+static void wake_client(struct client *c) {
+    if (c->suspended) {
+        c->suspended = false;
+        MHD_resume_connection(c->connection);
+    }
+}
+
+void events_publish(const char *type, const char *data, bool sticky_event) {
+    size_t size = strlen(type) + strlen(data) + 64;
+    struct event *ev = malloc(sizeof(*ev) + size);
+    if (ev == NULL) return;
+
+    pthread_mutex_lock(&hub_lock);
+
+    ev->refs = 1;
+    ev->id = ++last_id;
+    snprintf(ev->type, sizeof(ev->type), "%s", type);
+    ev->id_len = (size_t)snprintf(ev->text, size, "id: %llu\n", (unsigned long long)ev->id);
+    ev->len = ev->id_len + (size_t)snprintf(ev->text + ev->id_len, size - ev->id_len,
+                                            "event: %s\ndata: %s\n\n", type, data);
+
+    struct event **slot = &ring[ev->id % EVENT_RING_SIZE];
+    event_unref(*slot);
+    *slot = ev;
+
+    if (sticky_event) {
+        for (int i = 0; i < MAX_STICKY_TYPES; i++) {
+            if (sticky[i] == NULL || strcmp(sticky[i]->type, ev->type) == 0) {
+                event_unref(sticky[i]);
+                sticky[i] = ev;
+                ev->refs++;
+                break;
+            }
+        }
+    }
+
+    for (struct client *c = clients; c; c = c->next) {
+        wake_client(c);
+    }
+
+    pthread_mutex_unlock(&hub_lock);
+}
+
+static void set_scratch(struct client *c, const char *text) {
+    c->scratch_len = (size_t)snprintf(c->scratch, sizeof(c->scratch), "%s", text);
+    c->scratch_off = 0;
+}
+
+static size_t copy_out(char *buf, size_t max, const char *src, size_t len, size_t *offset) {
+    size_t n = len - *offset;
+    if (n > max) n = max;
+    memcpy(buf, src + *offset, n);
+    *offset += n;
+    return n;
+}
+
+static ssize_t event_reader(void *cls, uint64_t pos, char *buf, size_t max) {
+    struct client *c = cls;
+    size_t n = 0;
+    (void)pos;
+
+    pthread_mutex_lock(&hub_lock);
+
+    while (n < max) {
+        if (c->current) {
+            n += copy_out(buf + n, max - n, c->current->text, c->current->len, &c->offset);
+            if (c->offset < c->current->len) break;
+            event_unref(c->current);
+            c->current = NULL;
+            continue;
+        }
+
+        if (c->scratch_off < c->scratch_len) {
+            n += copy_out(buf + n, max - n, c->scratch, c->scratch_len, &c->scratch_off);
+            continue;
+        }
+
+        bool replay = false;
+        for (int i = 0; i < MAX_STICKY_TYPES; i++) {
+            if (c->sticky[i]) {
+                // Sticky replays carry no id, the client's Last-Event-ID
+                // must keep pointing at the live stream position
+                c->current = c->sticky[i];
+                c->offset = c->current->id_len;
+                c->sticky[i] = NULL;
+                replay = true;
+                break;
+            }
+        }
+        if (replay) continue;
+
+        if (c->next_id <= last_id) {
+            if (c->next_id < oldest_id()) {
+                // Fell behind the ring; tell the client to reload its state
+                set_scratch(c, "event: reset\ndata: {}\n\n");
+                c->next_id = oldest_id();
+                continue;
+            }
+            c->current = ring[c->next_id % EVENT_RING_SIZE];
+            c->current->refs++;
+            c->offset = 0;
+            c->next_id++;
+            continue;
+        }
+
+        if (c->heartbeat) {
+            c->heartbeat = false;
+            set_scratch(c, ": ping\n\n");
+            continue;
+        }
+        break;
+    }
+
+    if (n == 0) {
+        // Nothing to send: park the connection until publish or heartbeat
+        c->suspended = true;
+        MHD_suspend_connection(c->connection);
+    }
+
+    pthread_mutex_unlock(&hub_lock);
+    metrics_add_bytes(c->metrics_route, n);
+    return (ssize_t)n;
+}
+
+static void client_free(void *cls) {
+    struct client *c = cls;
+
+    pthread_mutex_lock(&hub_lock);
+    for (struct client **p = &clients; *p; p = &(*p)->next) {
+        if (*p == c) {
+            *p = c->next;
+            break;
+        }
+    }
+    event_unref(c->current);
+    for (int i = 0; i < MAX_STICKY_TYPES; i++) {
+        event_unref(c->sticky[i]);
+    }
+    pthread_mutex_unlock(&hub_lock);
+
+    free(c);
+}
+
+// Decide where a new subscriber starts. A client resuming within the ring
+// continues right after its Last-Event-ID. Anyone else starts at the live
+// position and first gets the sticky state events; a resuming client that
+// missed events also gets a reset event so it can reload.
+static void client_start(struct client *c, const char *last_event_id) {
+    char *end = NULL;
+    unsigned long long resume = last_event_id ? strtoull(last_event_id, &end, 10) : 0;
+    bool resuming = last_event_id && end != last_event_id && *end == '\0';
+
+    if (resuming && resume <= last_id && resume + 1 >= oldest_id()) {
+        c->next_id = resume + 1;
+        c->scratch_len = (size_t)snprintf(c->scratch, sizeof(c->scratch), "retry: %d\n\n", RETRY_MS);
+        return;
+    }
+
+    c->next_id = last_id + 1;
+    c->scratch_len = (size_t)snprintf(c->scratch, sizeof(c->scratch), "retry: %d\nid: %llu\n\n%s",
+                                      RETRY_MS, (unsigned long long)last_id,
+                                      resuming ? "event: reset\ndata: {}\n\n" : "");
+    for (int i = 0; i < MAX_STICKY_TYPES; i++) {
+        if (sticky[i]) {
+            c->sticky[i] = sticky[i];
+            sticky[i]->refs++;
+        }
+    }
+}
+
+enum MHD_Result handle_events(struct MHD_Connection *connection, const struct request *request) {
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+
+    struct client *c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        return send_error_response(connection, "GET", "/api/events",
+            "Out of memory", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+    c->connection = connection;
+    c->metrics_route = metrics_current_route();
+
+    // EventSource sends Last-Event-ID when it reconnects by itself; a page
+    // reload can pass the last seen id explicitly
+    const char *last_event_id = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Last-Event-ID");
+    if (last_event_id == NULL) {
+        last_event_id = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "lastEventId");
+    }
+
+    pthread_mutex_lock(&hub_lock);
+    client_start(c, last_event_id);
+    c->next = clients;
+    clients = c;
+    pthread_mutex_unlock(&hub_lock);
+
+    response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, EVENT_BLOCK_SIZE,
+                                                 &event_reader, c, &client_free);
+    if (response == NULL) {
+        client_free(c);
+        return send_error_response(connection, "GET", "/api/events",
+            "Failed to create response", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+
+    MHD_add_response_header(response, "Content-Type", "text/event-stream");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-cache");
+    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+    ret = queue_response(connection, MHD_HTTP_OK, response, 0);
+    MHD_destroy_response(response);
+
+    log_request(connection, "GET", "/api/events", MHD_HTTP_OK);
+    return ret;
+}
+
+// Heartbeats keep proxies from closing idle streams and let MHD notice
+// clients that went away while their connection was suspended
+static void *heartbeat_thread(void *arg) {
+    (void)arg;
+
+    while (1) {
+        sleep(heartbeat_interval);
+
+        pthread_mutex_lock(&hub_lock);
+        for (struct client *c = clients; c; c = c->next) {
+            c->heartbeat = true;
+            wake_client(c);
+        }
+        pthread_mutex_unlock(&hub_lock);
+    }
+    return NULL;
+}
+
+int events_init(unsigned int interval) {
+    pthread_t thread;
+
+    heartbeat_interval = interval ? interval : 15;
+    if (pthread_create(&thread, NULL, heartbeat_thread, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
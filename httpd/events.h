@@ -0,0 +1,26 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdbool.h>
+#include <microhttpd.h>
+#include "routes.h"
+
+// Server-Sent Events hub behind /api/events.
+//
+// Published events get increasing ids and are kept in a small ring so that a
+// client reconnecting with Last-Event-ID gets what it missed. Waiting clients
+// are suspended MHD connections, resumed by events_publish() or by the
+// heartbeat timer, so an idle stream costs neither a thread nor polling.
+
+// Start the heartbeat timer
+int events_init(unsigned int heartbeat_interval);
+
+// Queue an event for all subscribers. data must be a single line (JSON).
+// The last sticky event of each type is replayed to every new subscriber, so
+// e.g. the current status is delivered immediately on connect.
+void events_publish(const char *type, const char *data, bool sticky);
+
+// GET /api/events
+enum MHD_Result handle_events(struct MHD_Connection *connection, const struct request *request);
+
+#endif // EVENTS_H
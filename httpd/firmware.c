@@ -0,0 +1,336 @@
+#include "handlers.h"
+#include "metrics.h"
+#include "mtd.h"
+#include "sha256.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <ctype.h>
+
+#define FIRMWARE_PARTITION "USER0"
+#define FILE_SIZE (16 * 1024 * 1024)    // image files standing in for USER0
+#define FILE_ERASE_SIZE 0x20000
+#define SHA256_HEADER "X-Firmware-SHA256"
+#define AUTH_REALM "gateway"
+
+// Upload of one image. The body is hashed and written an erase block at a
+// time, except for the first block: it stays in RAM and is only written
+// once the SHA-256 matched. Its flash block is erased when the upload
+// starts, so an interrupted or corrupted upload leaves an image that does
+// not mount rather than a mix of old and new blocks.
+struct upload {
+    struct request_state state;
+    struct mtd mtd;
+    sha256_context sha;
+    uint8_t expected[SHA256_DIGEST_SIZE];
+    uint8_t *first;                 // block 0
+    uint8_t *block;                 // block being filled after that
+    size_t fill;                    // bytes in the current block
+    uint64_t blocks;                // complete blocks received
+    uint64_t first_offset;          // flash offset of block 0
+    uint64_t next_offset;           // flash offset for the next block
+    uint64_t received;
+    unsigned int error_status;      // set once the upload failed
+    const char *error;
+};
+
+static const char *target = NULL;   // NULL: the USER0 partition
+static char auth_user[64];
+static char auth_password[128];
+static bool auth_configured = false;
+static bool busy = false;
+
+int firmware_init(const char *path, const char *credentials) {
+    char line[sizeof(auth_user) + sizeof(auth_password) + 2];
+    FILE *fp;
+
+    target = path;
+    if (credentials == NULL) return 0;     // uploads disabled
+
+    fp = fopen(credentials, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "firmware: cannot open %s: %s\n", credentials, strerror(errno));
+        return -1;
+    }
+    bool ok = fgets(line, sizeof(line), fp) != NULL;
+    fclose(fp);
+
+    // user:password on the first line
+    char *colon = ok ? strchr(line, ':') : NULL;
+    if (colon == NULL || colon == line || (size_t)(colon - line) >= sizeof(auth_user)) {
+        fprintf(stderr, "firmware: %s must contain user:password\n", credentials);
+        return -1;
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+    *colon = '\0';
+    snprintf(auth_user, sizeof(auth_user), "%s", line);
+    snprintf(auth_password, sizeof(auth_password), "%s", colon + 1);
+    auth_configured = true;
+    return 0;
+}
+
+// Compare without an early exit, so timing does not reveal the prefix
+static bool secret_equal(const char *a, size_t a_len, const char *b) {
+    size_t b_len = strlen(b);
+    unsigned char diff = a_len != b_len;
+
+    for (size_t i = 0; i < a_len; i++) {
+        diff |= (unsigned char)a[i] ^ (unsigned char)b[i % (b_len ? b_len : 1)];
+    }
+    return diff == 0;
+}
+
+bool credentials_configured(void) {
+    return auth_configured;
+}
+
+bool credentials_check(struct MHD_Connection *connection) {
+    struct MHD_BasicAuthInfo *info = MHD_basic_auth_get_username_password3(connection);
+    bool ok = false;
+
+    if (info == NULL) return false;
+    if (info->password) {
+        bool user_ok = secret_equal(info->username, info->username_len, auth_user);
+        bool password_ok = secret_equal(info->password, info->password_len, auth_password);
+        ok = user_ok && password_ok;
+    }
+    MHD_free(info);
+    return ok;
+}
+
+enum MHD_Result send_unauthorized(struct MHD_Connection *connection, const struct request *request) {
+    static const char message[] = "Authentication required";
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+
+    response = MHD_create_response_from_buffer(sizeof(message) - 1, (void *)message,
+                                               MHD_RESPMEM_PERSISTENT);
+    if (response == NULL) return MHD_NO;
+
+    ret = MHD_queue_basic_auth_fail_response3(connection, AUTH_REALM, MHD_NO, response);
+    MHD_destroy_response(response);
+    if (ret == MHD_YES) metrics_response(MHD_HTTP_UNAUTHORIZED, sizeof(message) - 1);
+
+    log_request(connection, request->method, request->url, MHD_HTTP_UNAUTHORIZED);
+    return ret;
+}
+
+static bool parse_digest(const char *hex, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    if (hex == NULL || strlen(hex) != 2 * SHA256_DIGEST_SIZE) return false;
+    for (size_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        unsigned int byte;
+        if (!isxdigit((unsigned char)hex[2 * i]) || !isxdigit((unsigned char)hex[2 * i + 1]) ||
+            sscanf(hex + 2 * i, "%2x", &byte) != 1) return false;
+        digest[i] = (uint8_t)byte;
+    }
+    return true;
+}
+
+static void upload_fail(struct upload *up, unsigned int status, const char *error) {
+    if (up->error_status) return;
+    up->error_status = status;
+    up->error = error;
+}
+
+// Next good erase block at or after offset
+static bool next_good_block(struct upload *up, uint64_t *offset) {
+    while (*offset < up->mtd.size && mtd_block_bad(&up->mtd, *offset)) {
+        *offset += up->mtd.erase_size;
+    }
+    return *offset < up->mtd.size;
+}
+
+static void write_block(struct upload *up, const uint8_t *data) {
+    if (!next_good_block(up, &up->next_offset)) {
+        upload_fail(up, MHD_HTTP_CONTENT_TOO_LARGE, "Image does not fit the partition");
+        return;
+    }
+    if (mtd_erase(&up->mtd, up->next_offset, up->mtd.erase_size) != 0 ||
+        mtd_write(&up->mtd, up->next_offset, data, up->mtd.erase_size) != 0) {
+        upload_fail(up, MHD_HTTP_INTERNAL_SERVER_ERROR, "Flash write failed");
+        return;
+    }
+    up->next_offset += up->mtd.erase_size;
+}
+
+static void upload_consume(struct upload *up, const char *data, size_t len) {
+    size_t erase_size = up->mtd.erase_size;
+
+    up->received += len;
+    while (len > 0 && up->error_status == 0) {
+        uint8_t *buf = up->blocks == 0 ? up->first : up->block;
+        size_t n = erase_size - up->fill;
+        if (n > len) n = len;
+
+        memcpy(buf + up->fill, data, n);
+        sha256_update(&up->sha, data, n);
+        up->fill += n;
+        data += n;
+        len -= n;
+
+        if (up->fill == erase_size) {
+            if (up->blocks > 0) write_block(up, up->block);
+            up->blocks++;
+            up->fill = 0;
+        }
+    }
+}
+
+static void upload_release(struct request_state *state, bool completed) {
+    struct upload *up = (struct upload *)state;
+
+    if (!completed) {
+        fprintf(stderr, "firmware: upload aborted after %llu bytes, no image activated\n",
+                (unsigned long long)up->received);
+    }
+    mtd_close(&up->mtd);
+    free(up->first);
+    free(up->block);
+    free(up);
+    __atomic_store_n(&busy, false, __ATOMIC_RELEASE);
+}
+
+// First call: check the request and prepare the partition
+static enum MHD_Result upload_start(struct MHD_Connection *connection, const struct request *request) {
+    char mtd_path[32];
+    const char *path = target;
+    uint8_t expected[SHA256_DIGEST_SIZE];
+
+    if (!auth_configured) {
+        return send_error_response(connection, request->method, request->url,
+            "Firmware upload is disabled", MHD_HTTP_FORBIDDEN);
+    }
+    if (!credentials_check(connection)) {
+        return send_unauthorized(connection, request);
+    }
+    if (!parse_digest(MHD_lookup_connection_value(connection, MHD_HEADER_KIND, SHA256_HEADER), expected)) {
+        return send_error_response(connection, request->method, request->url,
+            "Missing or invalid " SHA256_HEADER " header", MHD_HTTP_BAD_REQUEST);
+    }
+    if (__atomic_exchange_n(&busy, true, __ATOMIC_ACQUIRE)) {
+        return send_error_response(connection, request->method, request->url,
+            "Another upload is in progress", MHD_HTTP_CONFLICT);
+    }
+
+    struct upload *up = calloc(1, sizeof(*up));
+    if (up == NULL) goto fail;
+    up->state.release = upload_release;
+    up->mtd.fd = -1;
+    memcpy(up->expected, expected, sizeof(expected));
+    sha256_init(&up->sha);
+
+    if (path == NULL) {
+        if (mtd_find(FIRMWARE_PARTITION, mtd_path, sizeof(mtd_path)) != 0) {
+            fprintf(stderr, "firmware: no %s partition\n", FIRMWARE_PARTITION);
+            goto fail;
+        }
+        path = mtd_path;
+    }
+    if (mtd_open(&up->mtd, path, FILE_SIZE, FILE_ERASE_SIZE) != 0) {
+        fprintf(stderr, "firmware: cannot open %s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+
+    const char *length = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+                                                     MHD_HTTP_HEADER_CONTENT_LENGTH);
+    if (length && strtoull(length, NULL, 10) > up->mtd.size) {
+        upload_release(&up->state, true);
+        return send_error_response(connection, request->method, request->url,
+            "Image does not fit the partition", MHD_HTTP_CONTENT_TOO_LARGE);
+    }
+
+    up->first = malloc(up->mtd.erase_size);
+    up->block = malloc(up->mtd.erase_size);
+    if (up->first == NULL || up->block == NULL) goto fail;
+
+    // Invalidate the current image before anything else is overwritten
+    if (!next_good_block(up, &up->first_offset) ||
+        mtd_erase(&up->mtd, up->first_offset, up->mtd.erase_size) != 0) {
+        goto fail;
+    }
+    up->next_offset = up->first_offset + up->mtd.erase_size;
+
+    *request->con_cls = up;
+    return MHD_YES;
+
+fail:
+    if (up) {
+        upload_release(&up->state, true);
+    } else {
+        __atomic_store_n(&busy, false, __ATOMIC_RELEASE);
+    }
+    return send_error_response(connection, request->method, request->url,
+        "Cannot open the firmware partition", MHD_HTTP_INTERNAL_SERVER_ERROR);
+}
+
+// Last call: flush, verify and activate
+static enum MHD_Result upload_finish(struct MHD_Connection *connection, const struct request *request,
+                                     struct upload *up) {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    char hex[2 * SHA256_DIGEST_SIZE + 1];
+
+    if (up->error_status == 0 && up->received == 0) {
+        upload_fail(up, MHD_HTTP_BAD_REQUEST, "Empty image");
+    }
+
+    // Pad the last block as erased flash
+    if (up->error_status == 0 && up->fill > 0) {
+        uint8_t *buf = up->blocks == 0 ? up->first : up->block;
+        memset(buf + up->fill, 0xFF, up->mtd.erase_size - up->fill);
+        if (up->blocks > 0) write_block(up, up->block);
+    }
+
+    sha256_final(&up->sha, digest);
+    for (size_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    }
+
+    if (up->error_status == 0 && memcmp(digest, up->expected, sizeof(digest)) != 0) {
+        upload_fail(up, MHD_HTTP_BAD_REQUEST, "SHA-256 mismatch, image not activated");
+    }
+
+    if (up->error_status == 0 &&
+        (mtd_sync(&up->mtd) != 0 ||
+         mtd_write(&up->mtd, up->first_offset, up->first, up->mtd.erase_size) != 0 ||
+         mtd_sync(&up->mtd) != 0)) {
+        upload_fail(up, MHD_HTTP_INTERNAL_SERVER_ERROR, "Flash write failed");
+    }
+
+    if (up->error_status) {
+        fprintf(stderr, "firmware: upload failed: %s\n", up->error);
+        return send_error_response(connection, request->method, request->url,
+                                   up->error, up->error_status);
+    }
+
+    printf("firmware: %llu byte image written, sha256 %s\n", (unsigned long long)up->received, hex);
+    fflush(stdout);
+
+    struct json_writer w;
+    jw_init_pooled(&w, 160);
+    jw_begin_object(&w);
+    jw_kv_string(&w, "status", "ok");
+    jw_kv_uint(&w, "size", up->received);
+    jw_kv_string(&w, "sha256", hex);
+    jw_end_object(&w);
+    return send_json_writer(connection, request->method, request->url, &w, MHD_HTTP_OK);
+}
+
+enum MHD_Result handle_firmware_upload(struct MHD_Connection *connection, const struct request *request) {
+    struct upload *up = *request->con_cls;
+
+    if (up == NULL) {
+        return upload_start(connection, request);
+    }
+
+    if (*request->upload_data_size > 0) {
+        // After a failure the rest of the body is read and dropped
+        upload_consume(up, request->upload_data, *request->upload_data_size);
+        *request->upload_data_size = 0;
+        return MHD_YES;
+    }
+
+    return upload_finish(connection, request, up);
+}
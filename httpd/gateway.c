@@ -1,4 +1,7 @@
 #include "handlers.h"
+#include "events.h"
+#include "compress.h"
+#include "respool.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,37 +12,65 @@
 #include <arpa/inet.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+// Status snapshot shared by all requests. The sampler thread rebuilds the
+// document every interval, and only when the serialized result differs from
+// the current snapshot does it publish a new response with the next version.
+// Requests queue that response as is: MHD reference-counts it, so no
+// request ever builds or copies JSON. A gzip copy is made once per version
+// for clients that accept it, at the highest level since it is shared.
+struct status_snapshot {
+    struct MHD_Response *response;
+    const char *json;               // body of response, owned by it
+    size_t len;
+    struct MHD_Response *gzip_response;     // NULL if not worth compressing
+    size_t gzip_len;
+    uint64_t version;
+    char etag[32];
+    char gzip_etag[36];
+};
+
+static struct status_snapshot snapshot;
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int sample_interval = 2;
+static time_t start_time;           // keeps ETags unique across restarts
+
+static char *collect_status(void);
 
 // Get system uptime
-static char* get_uptime_string(void) {
+static void get_uptime_string(char *buf, size_t len) {
     struct sysinfo si;
     if (sysinfo(&si) != 0) {
-        return strdup("unknown");
+        snprintf(buf, len, "unknown");
+        return;
     }
 
     long days = si.uptime / (24 * 3600);
     long hours = (si.uptime % (24 * 3600)) / 3600;
     long mins = (si.uptime % 3600) / 60;
 
-    char* result = malloc(32);
     if (days > 0) {
-        snprintf(result, 32, "%ldd %ldh %ldm", days, hours, mins);
+        snprintf(buf, len, "%ldd %ldh %ldm", days, hours, mins);
     } else if (hours > 0) {
-        snprintf(result, 32, "%ldh %ldm", hours, mins);
+        snprintf(buf, len, "%ldh %ldm", hours, mins);
     } else {
-        snprintf(result, 32, "%ldm", mins);
+        snprintf(buf, len, "%ldm", mins);
     }
-    return result;
 }
 
 // Get IP address for interface
-static char* get_ip_address(const char* interface) {
+static void get_ip_address(const char *interface, char *buf, size_t len) {
     int fd;
     struct ifreq ifr;
     
+    snprintf(buf, len, "unknown");
+
     fd = socket(AF_INET, SOCK_DGRAM, 0);
     if (fd == -1) {
-        return strdup("unknown");
+        return;
     }
 
     ifr.ifr_addr.sa_family = AF_INET;
@@ -47,137 +78,233 @@ static char* get_ip_address(const char* interface) {
     
     if (ioctl(fd, SIOCGIFADDR, &ifr) == -1) {
         close(fd);
-        return strdup("unknown");
+        return;
     }
     
     close(fd);
-    return strdup(inet_ntoa(((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr));
+    inet_ntop(AF_INET, &((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr, buf, len);
 }
 
-enum MHD_Result handle_gateway_status(struct MHD_Connection *connection) {
-    struct json_object *root = json_object_new_object();
-    if (!root) {
-        return send_error_response(connection, "GET", "/api/gateway/status", 
-            "Failed to create JSON response", MHD_HTTP_INTERNAL_SERVER_ERROR);
-    }
+// Build the status document. Returns a malloc'ed JSON string or NULL.
+static char *collect_status(void) {
+    struct json_writer w;
+    char buf[64];
 
-    // Create gateway object
-    struct json_object *gateway = json_object_new_object();
-    if (!gateway) {
-        json_object_put(root);
-        return send_error_response(connection, "GET", "/api/gateway/status", 
-            "Failed to create gateway object", MHD_HTTP_INTERNAL_SERVER_ERROR);
-    }
-    json_object_object_add(gateway, "status", json_object_new_string("online"));
-    
-    // Get IP address
-    char* ip = get_ip_address("eth0");
-    json_object_object_add(gateway, "ip", json_object_new_string(ip));
-    free(ip);
+    jw_init(&w, 1024);
+    jw_begin_object(&w);
+
+    jw_key(&w, "gateway");
+    jw_begin_object(&w);
+    jw_kv_string(&w, "status", "online");
+
+    get_ip_address("eth0", buf, sizeof(buf));
+    jw_kv_string(&w, "ip", buf);
 
-    // Add uptime
-    char* uptime = get_uptime_string();
-    json_object_object_add(gateway, "uptime", json_object_new_string(uptime));
-    free(uptime);
+    get_uptime_string(buf, sizeof(buf));
+    jw_kv_string(&w, "uptime", buf);
 
     // Add version from uname
     struct utsname sys_info;
-    if (uname(&sys_info) == 0) {
-        json_object_object_add(gateway, "version", json_object_new_string(sys_info.release));
-    } else {
-        json_object_object_add(gateway, "version", json_object_new_string("unknown"));
-    }
+    jw_kv_string(&w, "version", uname(&sys_info) == 0 ? sys_info.release : "unknown");
+    jw_end_object(&w);
 
-    json_object_object_add(root, "gateway", gateway);
-
-    // Create network object
-    struct json_object *network = json_object_new_object();
-    if (!network) {
-        json_object_put(root);
-        return send_error_response(connection, "GET", "/api/gateway/status", 
-            "Failed to create network object", MHD_HTTP_INTERNAL_SERVER_ERROR);
-    }
+    jw_key(&w, "network");
+    jw_begin_object(&w);
 
     // Zigbee network status
-    struct json_object *zigbee = json_object_new_object();
-    if (!zigbee) {
-        json_object_put(root);
-        return send_error_response(connection, "GET", "/api/gateway/status", 
-            "Failed to create Zigbee status object", MHD_HTTP_INTERNAL_SERVER_ERROR);
-    }
-    json_object_object_add(zigbee, "status", json_object_new_string("active"));
-    json_object_object_add(zigbee, "signal_strength", json_object_new_int(85));
-    json_object_object_add(zigbee, "channel", json_object_new_int(15));
-    json_object_object_add(zigbee, "pan_id", json_object_new_string("0x1A2B"));
-    json_object_object_add(network, "zigbee", zigbee);
+    jw_key(&w, "zigbee");
+    jw_begin_object(&w);
+    jw_kv_string(&w, "status", "active");
+    jw_kv_int(&w, "signal_strength", 85);
+    jw_kv_int(&w, "channel", 15);
+    jw_kv_string(&w, "pan_id", "0x1A2B");
+    jw_end_object(&w);
 
     // Matter network status
-    struct json_object *matter = json_object_new_object();
-    if (!matter) {
-        json_object_put(root);
-        return send_error_response(connection, "GET", "/api/gateway/status", 
-            "Failed to create Matter status object", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    jw_key(&w, "matter");
+    jw_begin_object(&w);
+    jw_kv_string(&w, "status", "active");
+    jw_kv_string(&w, "fabric_id", "0xABCD1234");
+    jw_end_object(&w);
+
+    jw_end_object(&w);
+
+    // Devices array (mock data for now, matching the UI mocks)
+    jw_key(&w, "devices");
+    jw_begin_array(&w);
+
+    jw_begin_object(&w);
+    jw_kv_string(&w, "id", "1");
+    jw_kv_string(&w, "name", "Living Room Light");
+    jw_kv_string(&w, "type", "Light");
+    jw_kv_string(&w, "protocol", "zigbee");
+    jw_kv_string(&w, "status", "online");
+    jw_kv_string(&w, "last_seen", "2 min ago");
+    jw_end_object(&w);
+
+    jw_begin_object(&w);
+    jw_kv_string(&w, "id", "2");
+    jw_kv_string(&w, "name", "Kitchen Sensor");
+    jw_kv_string(&w, "type", "Motion Sensor");
+    jw_kv_string(&w, "protocol", "zigbee");
+    jw_kv_string(&w, "status", "online");
+    jw_kv_int(&w, "battery", 85);
+    jw_kv_string(&w, "last_seen", "5 min ago");
+    jw_end_object(&w);
+
+    jw_begin_object(&w);
+    jw_kv_string(&w, "id", "3");
+    jw_kv_string(&w, "name", "Door Lock");
+    jw_kv_string(&w, "type", "Lock");
+    jw_kv_string(&w, "protocol", "matter");
+    jw_kv_string(&w, "status", "online");
+    jw_kv_int(&w, "battery", 90);
+    jw_kv_string(&w, "last_seen", "1 min ago");
+    jw_end_object(&w);
+
+    jw_end_array(&w);
+    jw_end_object(&w);
+
+    return jw_finish(&w, NULL);
+}
+
+// The same document gzip-encoded, NULL if compression does not pay off
+static struct MHD_Response *gzip_snapshot(const char *json, const char *etag, size_t *gzip_len) {
+    size_t len;
+    char *pooled = compress_body(ENCODING_GZIP, COMPRESS_MAX_LEVEL, json, strlen(json), &len);
+    if (pooled == NULL) return NULL;
+
+    // Snapshots live for many requests, so keep them out of the response pool
+    char *body = malloc(len);
+    if (body) memcpy(body, pooled, len);
+    respool_free(pooled);
+    if (body == NULL) return NULL;
+
+    struct MHD_Response *response = MHD_create_response_from_buffer_with_free_callback(len, body, &free);
+    if (response == NULL) {
+        free(body);
+        return NULL;
     }
-    json_object_object_add(matter, "status", json_object_new_string("active"));
-    json_object_object_add(matter, "fabric_id", json_object_new_string("0xABCD1234"));
-    json_object_object_add(network, "matter", matter);
-
-    json_object_object_add(root, "network", network);
-
-    // Devices array (mock data for now)
-    struct json_object *devices = json_object_new_array();
-    if (!devices) {
-        json_object_put(root);
-        return send_error_response(connection, "GET", "/api/gateway/status", 
-            "Failed to create devices array", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    add_json_headers(response);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_ENCODING, "gzip");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ETAG, etag);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-cache");
+    *gzip_len = len;
+    return response;
+}
+
+// Publish a new snapshot if the status document changed
+static void refresh_snapshot(void) {
+    char *json = collect_status();
+    if (json == NULL) return;
+
+    pthread_mutex_lock(&snapshot_lock);
+    bool changed = snapshot.json == NULL || strcmp(snapshot.json, json) != 0;
+    uint64_t version = snapshot.version + 1;
+    pthread_mutex_unlock(&snapshot_lock);
+
+    if (!changed) {
+        free(json);
+        return;
     }
 
-    // Example devices (matching mock data)
-    struct json_object *device1 = json_object_new_object();
-    if (device1) {
-        json_object_object_add(device1, "id", json_object_new_string("1"));
-        json_object_object_add(device1, "name", json_object_new_string("Living Room Light"));
-        json_object_object_add(device1, "type", json_object_new_string("Light"));
-        json_object_object_add(device1, "protocol", json_object_new_string("zigbee"));
-        json_object_object_add(device1, "status", json_object_new_string("online"));
-        json_object_object_add(device1, "last_seen", json_object_new_string("2 min ago"));
-        json_object_array_add(devices, device1);
+    // MHD frees json together with the last reference to the response
+    struct MHD_Response *response = MHD_create_response_from_buffer_with_free_callback(
+        strlen(json), json, &free);
+    if (response == NULL) {
+        free(json);
+        return;
     }
 
-    struct json_object *device2 = json_object_new_object();
-    if (device2) {
-        json_object_object_add(device2, "id", json_object_new_string("2"));
-        json_object_object_add(device2, "name", json_object_new_string("Kitchen Sensor"));
-        json_object_object_add(device2, "type", json_object_new_string("Motion Sensor"));
-        json_object_object_add(device2, "protocol", json_object_new_string("zigbee"));
-        json_object_object_add(device2, "status", json_object_new_string("online"));
-        json_object_object_add(device2, "battery", json_object_new_int(85));
-        json_object_object_add(device2, "last_seen", json_object_new_string("5 min ago"));
-        json_object_array_add(devices, device2);
+    char etag[32];
+    snprintf(etag, sizeof(etag), "\"%lx-%llu\"", (unsigned long)start_time, (unsigned long long)version);
+    add_json_headers(response);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ETAG, etag);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-cache");
+
+    // Encodings of one version are different representations, so their
+    // ETags differ too
+    char gzip_etag[36];
+    size_t gzip_len = 0;
+    snprintf(gzip_etag, sizeof(gzip_etag), "\"%lx-%llu-gz\"", (unsigned long)start_time,
+             (unsigned long long)version);
+    struct MHD_Response *gzip_response = gzip_snapshot(json, gzip_etag, &gzip_len);
+
+    pthread_mutex_lock(&snapshot_lock);
+    struct MHD_Response *old_response = snapshot.response;
+    struct MHD_Response *old_gzip_response = snapshot.gzip_response;
+    snapshot.response = response;
+    snapshot.json = json;
+    snapshot.len = strlen(json);
+    snapshot.gzip_response = gzip_response;
+    snapshot.gzip_len = gzip_len;
+    snapshot.version = version;
+    memcpy(snapshot.etag, etag, sizeof(etag));
+    memcpy(snapshot.gzip_etag, gzip_etag, sizeof(gzip_etag));
+    pthread_mutex_unlock(&snapshot_lock);
+
+    // Connections still sending the old body hold their own reference
+    if (old_response) MHD_destroy_response(old_response);
+    if (old_gzip_response) MHD_destroy_response(old_gzip_response);
+
+    events_publish("status", json, true);
+}
+
+static void *sampler_thread(void *arg) {
+    (void)arg;
+
+    while (1) {
+        sleep(sample_interval);
+        refresh_snapshot();
     }
+    return NULL;
+}
+
+int gateway_status_start(unsigned int interval) {
+    pthread_t thread;
 
-    struct json_object *device3 = json_object_new_object();
-    if (device3) {
-        json_object_object_add(device3, "id", json_object_new_string("3"));
-        json_object_object_add(device3, "name", json_object_new_string("Door Lock"));
-        json_object_object_add(device3, "type", json_object_new_string("Lock"));
-        json_object_object_add(device3, "protocol", json_object_new_string("matter"));
-        json_object_object_add(device3, "status", json_object_new_string("online"));
-        json_object_object_add(device3, "battery", json_object_new_int(90));
-        json_object_object_add(device3, "last_seen", json_object_new_string("1 min ago"));
-        json_object_array_add(devices, device3);
+    sample_interval = interval ? interval : 1;
+    start_time = time(NULL);
+
+    // Take the first sample synchronously so requests never see no snapshot
+    refresh_snapshot();
+
+    if (pthread_create(&thread, NULL, sampler_thread, NULL) != 0) {
+        return -1;
     }
+    pthread_detach(thread);
+    return 0;
+}
 
-    json_object_object_add(root, "devices", devices);
+enum MHD_Result handle_gateway_status(struct MHD_Connection *connection, const struct request *request) {
+    enum MHD_Result ret;
+    char etag[36];
+    bool gzip = !batch_active() && compress_negotiate(connection) == ENCODING_GZIP;
 
-    const char *json_str = json_object_to_json_string(root);
-    if (!json_str) {
-        json_object_put(root);
-        return send_error_response(connection, "GET", "/api/gateway/status", 
-            "Failed to serialize JSON response", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    pthread_mutex_lock(&snapshot_lock);
+    if (snapshot.response == NULL) {
+        pthread_mutex_unlock(&snapshot_lock);
+        return send_error_response(connection, "GET", "/api/gateway/status",
+            "Gateway status not available", MHD_HTTP_SERVICE_UNAVAILABLE);
+    }
+    if (snapshot.gzip_response == NULL) gzip = false;
+
+    const char *current = gzip ? snapshot.gzip_etag : snapshot.etag;
+    if (request_is_fresh(connection, current, 0)) {
+        snprintf(etag, sizeof(etag), "%s", current);
+        pthread_mutex_unlock(&snapshot_lock);
+        return send_not_modified(connection, "GET", "/api/gateway/status", etag, "no-cache", NULL);
+    }
+
+    if (batch_capture(MHD_HTTP_OK, snapshot.json, snapshot.len, true)) {
+        ret = MHD_YES;
+    } else if (gzip) {
+        ret = queue_response(connection, MHD_HTTP_OK, snapshot.gzip_response, snapshot.gzip_len);
+    } else {
+        ret = queue_response(connection, MHD_HTTP_OK, snapshot.response, snapshot.len);
     }
+    pthread_mutex_unlock(&snapshot_lock);
 
-    enum MHD_Result ret = send_json_response(connection, "GET", "/api/gateway/status", json_str, MHD_HTTP_OK);
-    json_object_put(root);
+    log_request(connection, "GET", "/api/gateway/status", MHD_HTTP_OK);
     return ret;
 }
@@ -3,32 +3,115 @@
 
 #include <microhttpd.h>
 #include <json-c/json.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "json_writer.h"
+#include "routes.h"
 
-// Gateway status handler
-enum MHD_Result handle_gateway_status(struct MHD_Connection *connection);
+// Gateway status handler, serves the snapshot kept by the status sampler
+enum MHD_Result handle_gateway_status(struct MHD_Connection *connection, const struct request *request);
 
-// Logs handler
-enum MHD_Result handle_logs(struct MHD_Connection *connection);
+// Start the status sampler, refreshing the snapshot every interval seconds
+int gateway_status_start(unsigned int interval);
+
+// Start sampling /proc every second into the system history
+int sysstats_start(void);
+
+// System history handler, serves one tier of the history as columns
+enum MHD_Result handle_system_history(struct MHD_Connection *connection, const struct request *request);
+
+// Start sampling the services with pid files in /var/run every seconds, 0 disables it
+int services_start(unsigned int seconds);
+
+// Services handler, serves each service's resource history as columns
+enum MHD_Result handle_system_services(struct MHD_Connection *connection, const struct request *request);
+
+// Logs handler, pages through the syslogd files with a cursor
+enum MHD_Result handle_logs(struct MHD_Connection *connection, const struct request *request);
+enum MHD_Result handle_logs_file(struct MHD_Connection *connection, const struct request *request);
+enum MHD_Result handle_logs_search(struct MHD_Connection *connection, const struct request *request);
+
+// Archived logs handler, streams the flash archive for a time range (log_archive.h)
+enum MHD_Result handle_logs_archive(struct MHD_Connection *connection, const struct request *request);
+
+// Index the syslogd file at path and its rotated copies (path.0, path.1...),
+// then keep following them and publish new lines as "log" events. The
+// search index of their messages gets search_budget bytes.
+int logs_start(const char *path, size_t search_budget);
+
+// Load the settings from the NVRAM partition or image at path (NULL for
+// the "factory" MTD) and start the thread that commits PATCHes to it
+int settings_start(const char *nvram_path);
 
 // Settings handlers
-enum MHD_Result handle_settings_get(struct MHD_Connection *connection);
-enum MHD_Result handle_settings_patch(struct MHD_Connection *connection,
-                                    const char *upload_data,
-                                    size_t *upload_data_size,
-                                    void **con_cls);
+enum MHD_Result handle_settings_get(struct MHD_Connection *connection, const struct request *request);
+enum MHD_Result handle_settings_patch(struct MHD_Connection *connection, const struct request *request);
+
+// NVRAM browser, pages through the variables with prefix/regex filters
+enum MHD_Result handle_nvram(struct MHD_Connection *connection, const struct request *request);
+
+// Firmware upload to the partition or image at path (NULL for the "USER0"
+// MTD), authenticated with the user:password line of credentials; uploads
+// are refused if credentials is NULL
+int firmware_init(const char *path, const char *credentials);
+
+// Whether firmware_init() loaded credentials, and whether the request's
+// basic auth matches them; send_unauthorized() asks the client for them
+bool credentials_configured(void);
+bool credentials_check(struct MHD_Connection *connection);
+enum MHD_Result send_unauthorized(struct MHD_Connection *connection, const struct request *request);
+
+// Firmware upload handler (PUT), streams the body to flash
+enum MHD_Result handle_firmware_upload(struct MHD_Connection *connection, const struct request *request);
+
+// Sampling profiler (common/profiler.h); /api/debug/profile answers 403
+// unless enabled
+void profile_init(bool enable);
+enum MHD_Result handle_debug_profile(struct MHD_Connection *connection, const struct request *request);
+
+// Batch handler (POST), runs several GETs and returns their responses
+enum MHD_Result handle_batch(struct MHD_Connection *connection, const struct request *request);
 
 // Helper functions
+
+// Whether this thread is running a /api/batch sub-request
+bool batch_active(void);
+
+// Inside a sub-request, take its response instead of queueing one and
+// return true; the response helpers below call it first
+bool batch_capture(unsigned int status_code, const char *body, size_t len, bool json);
+
+// Queue an access log record; never blocks (see access_log.h)
 void log_request(struct MHD_Connection *connection,
                 const char *method,
                 const char *url,
                 unsigned int status_code);
 
+// MHD_queue_response() that also accounts the response in the metrics;
+// body_size is the length of the body, 0 if it is streamed
+enum MHD_Result queue_response(struct MHD_Connection *connection,
+                               unsigned int status_code,
+                               struct MHD_Response *response,
+                               uint64_t body_size);
+
 enum MHD_Result send_json_response(struct MHD_Connection *connection,
                                  const char *method,
                                  const char *url,
                                  const char *json_str,
                                  unsigned int status_code);
 
+// Finish w and send it as the response body. The buffer is handed to MHD,
+// which frees it once sent. Sends 500 if writing failed.
+enum MHD_Result send_json_writer(struct MHD_Connection *connection,
+                               const char *method,
+                               const char *url,
+                               struct json_writer *w,
+                               unsigned int status_code);
+
+// Content-Type and CORS headers of all API responses
+void add_json_headers(struct MHD_Response *response);
+
 // Send error response with logging
 enum MHD_Result send_error_response(struct MHD_Connection *connection,
                                   const char *method,
@@ -36,4 +119,57 @@ enum MHD_Result send_error_response(struct MHD_Connection *connection,
                                   const char *error_msg,
                                   unsigned int status_code);
 
+// Conditional request support: true if the client's cached copy identified
+// by If-None-Match (or, failing that, If-Modified-Since) is still current
+bool request_is_fresh(struct MHD_Connection *connection,
+                      const char *etag,
+                      time_t last_modified);
+
+// Send 304 Not Modified carrying the current validators
+enum MHD_Result send_not_modified(struct MHD_Connection *connection,
+                                const char *method,
+                                const char *url,
+                                const char *etag,
+                                const char *cache_control,
+                                const char *last_modified);
+
+// Byte range of a response body selected by the Range header
+struct byte_range {
+    uint64_t offset;
+    uint64_t length;
+};
+
+enum range_result {
+    RANGE_FULL,             // no usable Range: the whole body with 200
+    RANGE_PARTIAL,          // the range with 206
+    RANGE_UNSATISFIABLE,    // 416
+};
+
+// Single byte range of a GET for a body of size bytes: "bytes=a-b",
+// "bytes=a-" or "bytes=-n". Malformed and multi-range requests get the full
+// body, as does a stale If-Range (compared against etag or last_modified).
+// range is set to the bytes to send, the whole body for RANGE_FULL.
+enum range_result request_range(struct MHD_Connection *connection,
+                                const char *method,
+                                uint64_t size,
+                                const char *etag,
+                                time_t last_modified,
+                                struct byte_range *range);
+
+// Add Accept-Ranges, plus Content-Range for RANGE_PARTIAL, and return the
+// status code to queue response with
+unsigned int add_range_headers(struct MHD_Response *response,
+                               enum range_result result,
+                               const struct byte_range *range,
+                               uint64_t size);
+
+// Send 416 Range Not Satisfiable for a body of size bytes
+enum MHD_Result send_range_not_satisfiable(struct MHD_Connection *connection,
+                                         const char *method,
+                                         const char *url,
+                                         uint64_t size);
+
+// Format t as an HTTP-date (RFC 7231), e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+void format_http_date(time_t t, char *buf, size_t len);
+
 #endif // HANDLERS_H
@@ -0,0 +1,222 @@
+#include "json_writer.h"
+#include "respool.h"
+#include <stdlib.h>
+#include <string.h>
+
+void jw_init(struct json_writer *w, size_t size_hint) {
+    memset(w, 0, sizeof(*w));
+    w->cap = size_hint ? size_hint : 256;
+    w->buf = malloc(w->cap);
+    if (w->buf == NULL) w->failed = true;
+}
+
+void jw_init_pooled(struct json_writer *w, size_t size_hint) {
+    if (size_hint <= respool_size()) {
+        char *buf = respool_get();
+        if (buf) {
+            memset(w, 0, sizeof(*w));
+            w->buf = buf;
+            w->cap = respool_size();
+            return;
+        }
+    }
+    jw_init(w, size_hint);
+}
+
+char *jw_finish(struct json_writer *w, size_t *len) {
+    char *buf = w->buf;
+
+    if (w->failed || w->depth != 0) {
+        jw_free(w);
+        return NULL;
+    }
+    buf[w->len] = '\0';
+    if (len) *len = w->len;
+    w->buf = NULL;
+    return buf;
+}
+
+void jw_free(struct json_writer *w) {
+    respool_free(w->buf);
+    w->buf = NULL;
+    w->failed = true;
+}
+
+// Make room for n more bytes plus the terminating NUL
+static bool reserve(struct json_writer *w, size_t n) {
+    if (w->failed) return false;
+    if (w->len + n + 1 <= w->cap) return true;
+
+    size_t cap = w->cap * 2;
+    if (cap < w->len + n + 1) cap = w->len + n + 1;
+    char *buf;
+    if (respool_owns(w->buf)) {
+        // Outgrew a pooled buffer: move to the heap and give it back
+        buf = malloc(cap);
+        if (buf) {
+            memcpy(buf, w->buf, w->len);
+            respool_free(w->buf);
+        }
+    } else {
+        buf = realloc(w->buf, cap);
+    }
+    if (buf == NULL) {
+        jw_free(w);
+        return false;
+    }
+    w->buf = buf;
+    w->cap = cap;
+    return true;
+}
+
+static void put(struct json_writer *w, const char *s, size_t n) {
+    if (!reserve(w, n)) return;
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+static void put_char(struct json_writer *w, char c) {
+    if (!reserve(w, 1)) return;
+    w->buf[w->len++] = c;
+}
+
+// Separator before a new value: nothing after a key, a comma after a
+// previous element at the same depth
+static void begin_value(struct json_writer *w) {
+    if (w->after_key) {
+        w->after_key = false;
+        return;
+    }
+    if (w->has_items & (1u << w->depth)) put_char(w, ',');
+    w->has_items |= 1u << w->depth;
+}
+
+static void open_container(struct json_writer *w, char c) {
+    begin_value(w);
+    if (w->depth + 1 >= JW_MAX_DEPTH) {
+        jw_free(w);
+        return;
+    }
+    put_char(w, c);
+    w->depth++;
+    w->has_items &= ~(1u << w->depth);
+}
+
+static void close_container(struct json_writer *w, char c) {
+    if (w->depth == 0) {
+        jw_free(w);
+        return;
+    }
+    w->depth--;
+    put_char(w, c);
+}
+
+void jw_begin_object(struct json_writer *w) {
+    open_container(w, '{');
+}
+
+void jw_end_object(struct json_writer *w) {
+    close_container(w, '}');
+}
+
+void jw_begin_array(struct json_writer *w) {
+    open_container(w, '[');
+}
+
+void jw_end_array(struct json_writer *w) {
+    close_container(w, ']');
+}
+
+static void put_string(struct json_writer *w, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    size_t start = 0;
+
+    put_char(w, '"');
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        // Copy the run of plain characters, then the escape
+        put(w, s + start, i - start);
+        start = i + 1;
+        switch (c) {
+        case '"': put(w, "\\\"", 2); break;
+        case '\\': put(w, "\\\\", 2); break;
+        case '\n': put(w, "\\n", 2); break;
+        case '\r': put(w, "\\r", 2); break;
+        case '\t': put(w, "\\t", 2); break;
+        default: {
+            char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+            put(w, esc, sizeof(esc));
+            break;
+        }
+        }
+    }
+    put(w, s + start, len - start);
+    put_char(w, '"');
+}
+
+void jw_key(struct json_writer *w, const char *key) {
+    begin_value(w);
+    put_string(w, key, strlen(key));
+    put_char(w, ':');
+    w->after_key = true;
+}
+
+void jw_string(struct json_writer *w, const char *s) {
+    if (s == NULL) {
+        jw_null(w);
+        return;
+    }
+    jw_string_len(w, s, strlen(s));
+}
+
+void jw_string_len(struct json_writer *w, const char *s, size_t len) {
+    begin_value(w);
+    put_string(w, s, len);
+}
+
+static void put_uint(struct json_writer *w, uint64_t v) {
+    char digits[20];
+    size_t n = 0;
+
+    do {
+        digits[sizeof(digits) - ++n] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    put(w, digits + sizeof(digits) - n, n);
+}
+
+void jw_uint(struct json_writer *w, uint64_t v) {
+    begin_value(w);
+    put_uint(w, v);
+}
+
+void jw_int(struct json_writer *w, int64_t v) {
+    begin_value(w);
+    if (v < 0) {
+        put_char(w, '-');
+        put_uint(w, -(uint64_t)v);
+    } else {
+        put_uint(w, (uint64_t)v);
+    }
+}
+
+void jw_bool(struct json_writer *w, bool v) {
+    begin_value(w);
+    if (v) {
+        put(w, "true", 4);
+    } else {
+        put(w, "false", 5);
+    }
+}
+
+void jw_null(struct json_writer *w) {
+    begin_value(w);
+    put(w, "null", 4);
+}
+
+void jw_raw(struct json_writer *w, const char *json, size_t len) {
+    begin_value(w);
+    put(w, json, len);
+}
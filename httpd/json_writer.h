@@ -0,0 +1,92 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming JSON writer. Output is appended to a single growing buffer, so a
+// whole response costs one or two allocations instead of one per node, and
+// the finished buffer is handed to MHD as is (see send_json_writer()).
+//
+// Commas and colons are inserted automatically. Allocation failures are
+// sticky: later calls do nothing and jw_finish() returns NULL.
+//
+//     struct json_writer w;
+//     jw_init(&w, 256);
+//     jw_begin_object(&w);
+//     jw_kv_string(&w, "status", "ok");
+//     jw_end_object(&w);
+//     char *json = jw_finish(&w, &len);
+
+#define JW_MAX_DEPTH 32
+
+struct json_writer {
+    char *buf;
+    size_t len;
+    size_t cap;
+    unsigned int depth;
+    uint32_t has_items;     // bit per depth: a value was already written
+    bool after_key;
+    bool failed;
+};
+
+// Start with room for size_hint bytes
+void jw_init(struct json_writer *w, size_t size_hint);
+
+// Same, but write into a preallocated response buffer when size_hint fits
+// one and one is free (see respool.h)
+void jw_init_pooled(struct json_writer *w, size_t size_hint);
+
+// Return the NUL-terminated document (length in *len if len is not NULL)
+// and give up ownership of it, or NULL if writing failed. Free with
+// respool_free(), or free() if the writer was started with jw_init().
+char *jw_finish(struct json_writer *w, size_t *len);
+
+// Discard the document
+void jw_free(struct json_writer *w);
+
+// Drop the output written so far but keep the nesting state, so a long
+// document can be sent in pieces through one small buffer
+static inline void jw_reset(struct json_writer *w) {
+    w->len = 0;
+}
+
+void jw_begin_object(struct json_writer *w);
+void jw_end_object(struct json_writer *w);
+void jw_begin_array(struct json_writer *w);
+void jw_end_array(struct json_writer *w);
+void jw_key(struct json_writer *w, const char *key);
+
+void jw_string(struct json_writer *w, const char *s);
+void jw_string_len(struct json_writer *w, const char *s, size_t len);
+void jw_int(struct json_writer *w, int64_t v);
+void jw_uint(struct json_writer *w, uint64_t v);
+void jw_bool(struct json_writer *w, bool v);
+void jw_null(struct json_writer *w);
+
+// Insert an already serialized JSON value
+void jw_raw(struct json_writer *w, const char *json, size_t len);
+
+// Object member shorthands
+static inline void jw_kv_string(struct json_writer *w, const char *key, const char *s) {
+    jw_key(w, key);
+    jw_string(w, s);
+}
+
+static inline void jw_kv_int(struct json_writer *w, const char *key, int64_t v) {
+    jw_key(w, key);
+    jw_int(w, v);
+}
+
+static inline void jw_kv_uint(struct json_writer *w, const char *key, uint64_t v) {
+    jw_key(w, key);
+    jw_uint(w, v);
+}
+
+static inline void jw_kv_bool(struct json_writer *w, const char *key, bool v) {
+    jw_key(w, key);
+    jw_bool(w, v);
+}
+
+#endif // JSON_WRITER_H
@@ -0,0 +1,674 @@
+#include "handlers.h"
+#include "log_archive.h"
+#include "metrics.h"
+#include "lz4.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define ARCHIVE_MAGIC 0x3141474c    // "LGA1"
+#define RECORD_HEADER 6             // uint32_t time, uint16_t length, then the line
+#define MAX_RECORD_LEN 1024         // longer lines are cut, like the log index does
+#define WRITER_TICK 5
+#define MAX_READERS 2
+#define STREAM_BLOCK_SIZE 16384
+#define BLOCK_PAYLOAD_MAX LZ4_BOUND(ARCHIVE_BLOCK_SIZE)
+
+// Block header as written to flash; every target is little-endian. The
+// LZ4 block of raw_len bytes of records follows it.
+struct block_header {
+    uint32_t magic;
+    uint32_t payload_len;
+    uint32_t raw_len;
+    uint32_t records;
+    uint32_t first_time;
+    uint32_t last_time;
+    uint8_t boot_id[16];            // tells a restart of httpd from a reboot
+    uint32_t crc;                   // CRC-32 of the header (crc 0) and payload
+};
+
+enum archive_file {
+    FILE_CURRENT,                   // path, appended to
+    FILE_OLD,                       // path.0, the previous one
+};
+
+// Where a block is and which lines it holds
+struct block_ref {
+    uint32_t offset;
+    uint32_t size;                  // header and payload
+    uint32_t first_time;
+    uint32_t last_time;
+    uint8_t file;
+};
+
+// Everything below is protected by archive_lock. The writer thread appends
+// to fds[FILE_CURRENT] without it, but only adds the block to the index,
+// which is all readers look at, once it is on flash.
+static pthread_mutex_t archive_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool enabled = false;
+static const char *archive_path;
+static char old_path[PATH_MAX];
+static int fds[2] = { -1, -1 };
+static uint32_t file_end;           // size of the current file
+static struct block_ref *blocks;    // oldest first
+static size_t block_count;
+static size_t block_capacity;
+static uint8_t boot_id[16];
+static unsigned int readers;
+
+// Lines waiting to be written, as records. Offsets count every byte ever
+// queued, so the writer can tell what is left of the block it cut once
+// the oldest lines may have been dropped meanwhile.
+static uint8_t *backlog;
+static size_t backlog_len;
+static uint64_t backlog_base;       // offset of backlog[0]
+static time_t backlog_since;        // monotonic time the oldest line arrived
+static uint64_t urgent_end;         // end offset of the newest urgent line
+static time_t urgent_since;
+static uint32_t last_time;
+static struct log_archive_stats stats;
+static uint64_t writing_end;        // end offset of the block being written, 0 if none
+static uint64_t dropped_writing;    // lines of that block dropped meanwhile
+
+// A restart of httpd queues the lines still in tmpfs again; those up to
+// the newest archived one are skipped
+static bool resuming = false;
+static uint32_t resume_time;
+static uint32_t resume_skip;        // lines at resume_time already archived
+
+// Writer thread only
+static double rate;                 // bytes per second
+static double burst;                // bucket size, a quarter hour of rate
+static uint8_t *raw_block;
+static uint8_t *out_block;
+static bool failing;                // report a failing flash once
+static bool torn;                   // a failed write left bytes after file_end
+
+static time_t monotonic_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// The kernel's random id of this boot, zero if it is unavailable
+static void read_boot_id(uint8_t id[16]) {
+    char buf[64];
+    size_t n = 0;
+
+    memset(id, 0, 16);
+    FILE *f = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (f == NULL) return;
+    if (fgets(buf, sizeof(buf), f) != NULL) {
+        for (const char *p = buf; *p && n < 32; p++) {
+            int d = hex_digit(*p);
+            if (d < 0) continue;
+            id[n / 2] |= (uint8_t)(n % 2 ? d : d << 4);
+            n++;
+        }
+    }
+    fclose(f);
+}
+
+static bool add_block_ref(const struct block_ref *ref) {
+    if (block_count == block_capacity) {
+        size_t capacity = block_capacity ? block_capacity * 2 : 64;
+        struct block_ref *grown = realloc(blocks, capacity * sizeof(*grown));
+        if (grown == NULL) return false;
+        blocks = grown;
+        block_capacity = capacity;
+    }
+    blocks[block_count++] = *ref;
+    return true;
+}
+
+// Read block ref into buf (header and payload, BLOCK_PAYLOAD_MAX plus a
+// header) and decompress its records into raw. Returns the records' size,
+// -1 if the block cannot be read or is damaged.
+static ssize_t load_block(int fd, const struct block_ref *ref, uint8_t *buf, uint8_t *raw,
+                          struct block_header *header) {
+    if (ref->size < sizeof(*header) || ref->size - sizeof(*header) > BLOCK_PAYLOAD_MAX) return -1;
+    if (pread(fd, buf, ref->size, ref->offset) != (ssize_t)ref->size) return -1;
+
+    memcpy(header, buf, sizeof(*header));
+    uint32_t crc = header->crc;
+    memset(buf + offsetof(struct block_header, crc), 0, sizeof(header->crc));
+    if (crc32(0, buf, ref->size) != crc) return -1;
+
+    ssize_t n = lz4_decompress(buf + sizeof(*header), header->payload_len, raw, ARCHIVE_BLOCK_SIZE);
+    if (n < 0 || (size_t)n != header->raw_len) return -1;
+    return n;
+}
+
+// Index the blocks of a file; returns the end of the last complete one
+static uint32_t scan_file(int fd, enum archive_file file) {
+    struct block_header header;
+    struct stat st;
+    uint32_t offset = 0;
+
+    if (fstat(fd, &st) == -1) return 0;
+    while ((off_t)offset + (off_t)sizeof(header) <= st.st_size) {
+        if (pread(fd, &header, sizeof(header), offset) != (ssize_t)sizeof(header) ||
+            header.magic != ARCHIVE_MAGIC || header.payload_len > BLOCK_PAYLOAD_MAX ||
+            header.raw_len > ARCHIVE_BLOCK_SIZE ||
+            (off_t)offset + (off_t)sizeof(header) + header.payload_len > st.st_size) {
+            break;
+        }
+        struct block_ref ref = {
+            .offset = offset,
+            .size = (uint32_t)sizeof(header) + header.payload_len,
+            .first_time = header.first_time,
+            .last_time = header.last_time,
+            .file = (uint8_t)file,
+        };
+        if (!add_block_ref(&ref)) break;
+        offset += ref.size;
+    }
+    return offset;
+}
+
+// Check the newest block, which a power cut may have torn, and pick up
+// where the last run left off if it was in this boot
+static void check_last_block(void) {
+    struct block_header header;
+
+    if (block_count == 0) return;
+    uint8_t *buf = malloc(sizeof(header) + BLOCK_PAYLOAD_MAX);
+    uint8_t *raw = malloc(ARCHIVE_BLOCK_SIZE);
+    const struct block_ref *ref = &blocks[block_count - 1];
+    ssize_t n = buf && raw ? load_block(fds[ref->file], ref, buf, raw, &header) : -1;
+
+    if (n < 0 && buf && raw) {
+        fprintf(stderr, "Log archive: dropping a damaged block at the end of %s\n",
+                ref->file == FILE_CURRENT ? archive_path : old_path);
+        if (ref->file == FILE_CURRENT) file_end = ref->offset;
+        block_count--;
+    } else if (n >= 0 && memcmp(header.boot_id, boot_id, sizeof(boot_id)) == 0) {
+        resuming = true;
+        resume_time = header.last_time;
+        resume_skip = 0;
+        for (size_t pos = 0; pos + RECORD_HEADER <= (size_t)n;) {
+            uint32_t time;
+            uint16_t len;
+            memcpy(&time, raw + pos, sizeof(time));
+            memcpy(&len, raw + pos + 4, sizeof(len));
+            if (time == resume_time) resume_skip++;
+            pos += RECORD_HEADER + len;
+        }
+    }
+    free(buf);
+    free(raw);
+}
+
+// Drop the oldest records until at least need bytes are free
+static void drop_oldest(size_t need) {
+    size_t pos = 0;
+
+    while (pos < backlog_len && pos < need) {
+        uint16_t len;
+        memcpy(&len, backlog + pos + 4, sizeof(len));
+        // Lines of the block being written only count as dropped if
+        // that write does not go through
+        if (backlog_base + pos < writing_end) {
+            dropped_writing++;
+        } else {
+            stats.dropped++;
+        }
+        pos += RECORD_HEADER + len;
+    }
+    memmove(backlog, backlog + pos, backlog_len - pos);
+    backlog_len -= pos;
+    backlog_base += pos;
+}
+
+void log_archive_add(uint32_t time, bool urgent, const char *line, size_t len) {
+    pthread_mutex_lock(&archive_lock);
+    if (!enabled) {
+        pthread_mutex_unlock(&archive_lock);
+        return;
+    }
+    if (time == 0) time = last_time;
+    if (resuming) {
+        if (time < resume_time || (time == resume_time && resume_skip > 0)) {
+            if (time == resume_time) resume_skip--;
+            pthread_mutex_unlock(&archive_lock);
+            return;
+        }
+        resuming = false;
+    }
+    last_time = time;
+
+    if (len > MAX_RECORD_LEN) len = MAX_RECORD_LEN;
+    size_t need = RECORD_HEADER + len;
+    if (backlog_len + need > ARCHIVE_BACKLOG) drop_oldest(backlog_len + need - ARCHIVE_BACKLOG);
+
+    time_t now = monotonic_now();
+    uint16_t len16 = (uint16_t)len;
+    uint8_t *p = backlog + backlog_len;
+    memcpy(p, &time, sizeof(time));
+    memcpy(p + 4, &len16, sizeof(len16));
+    memcpy(p + RECORD_HEADER, line, len);
+    if (backlog_len == 0) backlog_since = now;
+    backlog_len += need;
+
+    if (urgent) {
+        if (urgent_end <= backlog_base) urgent_since = now;
+        urgent_end = backlog_base + backlog_len;
+    }
+    pthread_mutex_unlock(&archive_lock);
+}
+
+static bool flush_due(time_t now) {
+    return backlog_len >= ARCHIVE_BLOCK_SIZE ||
+           (backlog_len > 0 && now - backlog_since >= ARCHIVE_FLUSH_SECONDS) ||
+           (urgent_end > backlog_base && now - urgent_since >= ARCHIVE_URGENT_SECONDS);
+}
+
+// The current file becomes path.0; the next block starts a new one
+static int rotate(void) {
+    if (rename(archive_path, old_path) != 0) return -1;
+
+    pthread_mutex_lock(&archive_lock);
+    if (fds[FILE_OLD] != -1) close(fds[FILE_OLD]);
+    fds[FILE_OLD] = fds[FILE_CURRENT];
+    fds[FILE_CURRENT] = -1;
+    size_t kept = 0;
+    for (size_t i = 0; i < block_count; i++) {
+        if (blocks[i].file == FILE_OLD) continue;
+        blocks[i].file = FILE_OLD;
+        blocks[kept++] = blocks[i];
+    }
+    block_count = kept;
+    file_end = 0;
+    pthread_mutex_unlock(&archive_lock);
+    return 0;
+}
+
+// Append a block of size bytes from out_block and index it
+static int append_block(const struct block_ref *ref) {
+    // Blocks must follow each other without a gap, so rather than append
+    // after a torn one the next block starts a new file; scanning path.0
+    // stops at the torn bytes, which are at its end
+    if ((torn || (file_end > 0 && file_end + ref->size > ARCHIVE_FILE_SIZE)) && rotate() != 0) return -1;
+    torn = false;
+    if (fds[FILE_CURRENT] == -1) {
+        int fd = open(archive_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) return -1;
+        pthread_mutex_lock(&archive_lock);
+        fds[FILE_CURRENT] = fd;
+        pthread_mutex_unlock(&archive_lock);
+    }
+
+    int fd = fds[FILE_CURRENT];
+    if (pwrite(fd, out_block, ref->size, file_end) != (ssize_t)ref->size || fdatasync(fd) != 0) {
+        // Leave no partial block for the next one to follow
+        int saved = errno;
+        if (ftruncate(fd, file_end) != 0) {
+            fprintf(stderr, "Log archive: failed to truncate %s: %s\n", archive_path, strerror(errno));
+            torn = true;
+        }
+        errno = saved;
+        return -1;
+    }
+
+    struct block_ref added = *ref;
+    added.offset = file_end;
+    added.file = FILE_CURRENT;
+    pthread_mutex_lock(&archive_lock);
+    add_block_ref(&added);
+    file_end += ref->size;
+    pthread_mutex_unlock(&archive_lock);
+    return 0;
+}
+
+// The block being written did not make it: the lines dropped from the
+// backlog meanwhile are lost after all
+static void abandon_write(void) {
+    pthread_mutex_lock(&archive_lock);
+    stats.dropped += dropped_writing;
+    writing_end = 0;
+    pthread_mutex_unlock(&archive_lock);
+}
+
+// Cut, compress and write the next block if it is due and the budget has
+// room; returns true if one was written
+static bool flush_one(double *tokens, size_t *want) {
+    struct block_header header = { .magic = ARCHIVE_MAGIC };
+    struct block_ref ref = { 0 };
+    time_t now = monotonic_now();
+
+    // A block that did not fit is not compressed again until it would
+    if (*want > 0 && *tokens < (double)*want && *tokens < burst) return false;
+
+    pthread_mutex_lock(&archive_lock);
+    if (!flush_due(now)) {
+        pthread_mutex_unlock(&archive_lock);
+        return false;
+    }
+    uint64_t base = backlog_base;
+    size_t len = 0;
+    while (len < backlog_len) {
+        uint32_t time;
+        uint16_t rlen;
+        memcpy(&time, backlog + len, sizeof(time));
+        memcpy(&rlen, backlog + len + 4, sizeof(rlen));
+        if (len + RECORD_HEADER + rlen > ARCHIVE_BLOCK_SIZE) break;
+        if (header.records++ == 0) header.first_time = time;
+        header.last_time = time;
+        len += RECORD_HEADER + rlen;
+    }
+    memcpy(raw_block, backlog, len);
+    writing_end = base + len;
+    dropped_writing = 0;
+    pthread_mutex_unlock(&archive_lock);
+
+    header.raw_len = (uint32_t)len;
+    header.payload_len = (uint32_t)lz4_compress(raw_block, len, out_block + sizeof(header), BLOCK_PAYLOAD_MAX);
+    memcpy(header.boot_id, boot_id, sizeof(boot_id));
+    ref.size = (uint32_t)sizeof(header) + header.payload_len;
+    ref.first_time = header.first_time;
+    ref.last_time = header.last_time;
+    if (header.payload_len == 0) {
+        abandon_write();
+        return false;
+    }
+
+    // A full bucket always pays for a block, going into debt if need be
+    if ((double)ref.size > *tokens && *tokens < burst) {
+        *want = ref.size;
+        abandon_write();
+        return false;
+    }
+    *want = 0;
+
+    memcpy(out_block, &header, sizeof(header));
+    header.crc = (uint32_t)crc32(0, out_block, ref.size);
+    memcpy(out_block + offsetof(struct block_header, crc), &header.crc, sizeof(header.crc));
+    if (append_block(&ref) != 0) {
+        if (!failing) fprintf(stderr, "Log archive: failed to write %s: %s\n", archive_path, strerror(errno));
+        failing = true;
+        abandon_write();
+        return false;
+    }
+    failing = false;
+    *tokens -= ref.size;
+
+    pthread_mutex_lock(&archive_lock);
+    uint64_t end = base + len;
+    if (end > backlog_base) {
+        size_t written = (size_t)(end - backlog_base);
+        memmove(backlog, backlog + written, backlog_len - written);
+        backlog_len -= written;
+        backlog_base = end;
+    }
+    if (backlog_len > 0) backlog_since = now;
+    writing_end = 0;
+    stats.lines += header.records;
+    stats.blocks++;
+    stats.bytes_in += len;
+    stats.bytes_out += ref.size;
+    pthread_mutex_unlock(&archive_lock);
+    return true;
+}
+
+static void *writer_thread(void *arg) {
+    double tokens = burst;
+    size_t want = 0;
+    time_t refilled = monotonic_now();
+    (void)arg;
+
+    while (1) {
+        sleep(WRITER_TICK);
+        time_t now = monotonic_now();
+        tokens += (double)(now - refilled) * rate;
+        if (tokens > burst) tokens = burst;
+        refilled = now;
+
+        while (flush_one(&tokens, &want)) {
+        }
+    }
+    return NULL;
+}
+
+int log_archive_start(const char *path, unsigned int rate_kib) {
+    pthread_t thread;
+
+    if (path == NULL) return 0;
+    archive_path = path;
+    snprintf(old_path, sizeof(old_path), "%s.0", path);
+    rate = rate_kib * 1024.0 / 3600;
+    burst = rate_kib * 1024.0 / 4;
+    read_boot_id(boot_id);
+
+    backlog = malloc(ARCHIVE_BACKLOG);
+    raw_block = malloc(ARCHIVE_BLOCK_SIZE);
+    out_block = malloc(sizeof(struct block_header) + BLOCK_PAYLOAD_MAX);
+    fds[FILE_CURRENT] = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (backlog == NULL || raw_block == NULL || out_block == NULL || fds[FILE_CURRENT] == -1) {
+        fprintf(stderr, "Log archive disabled: %s: %s\n", path, strerror(errno));
+        if (fds[FILE_CURRENT] != -1) close(fds[FILE_CURRENT]);
+        fds[FILE_CURRENT] = -1;
+        free(backlog);
+        free(raw_block);
+        free(out_block);
+        return 0;
+    }
+
+    fds[FILE_OLD] = open(old_path, O_RDONLY | O_CLOEXEC);
+    if (fds[FILE_OLD] != -1) scan_file(fds[FILE_OLD], FILE_OLD);
+    file_end = scan_file(fds[FILE_CURRENT], FILE_CURRENT);
+    check_last_block();
+    if (ftruncate(fds[FILE_CURRENT], file_end) != 0) {
+        fprintf(stderr, "Log archive: failed to truncate %s: %s\n", path, strerror(errno));
+    }
+    enabled = true;
+
+    if (pthread_create(&thread, NULL, writer_thread, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+void log_archive_stats(struct log_archive_stats *out) {
+    pthread_mutex_lock(&archive_lock);
+    *out = stats;
+    out->backlog = backlog_len;
+    pthread_mutex_unlock(&archive_lock);
+}
+
+// Response state: the blocks overlapping the range, read and decompressed
+// one at a time as MHD asks for more output
+struct archive_stream {
+    int fds[2];
+    struct block_ref *refs;
+    size_t count;
+    size_t next;                    // block loaded next
+    uint32_t since;
+    uint32_t until;
+    uint8_t *buf;                   // header and payload of a block
+    uint8_t *raw;                   // its records
+    size_t raw_len;
+    size_t pos;                     // record copied out next
+    size_t line_off;                // bytes of it already copied
+    unsigned int metrics_route;
+};
+
+static void stream_free(void *cls) {
+    struct archive_stream *s = cls;
+
+    for (int i = 0; i < 2; i++) {
+        if (s->fds[i] != -1) close(s->fds[i]);
+    }
+    free(s->refs);
+    free(s->buf);
+    free(s->raw);
+    free(s);
+
+    pthread_mutex_lock(&archive_lock);
+    readers--;
+    pthread_mutex_unlock(&archive_lock);
+}
+
+// Load the next readable block; false at the end
+static bool next_block(struct archive_stream *s) {
+    struct block_header header;
+
+    while (s->next < s->count) {
+        const struct block_ref *ref = &s->refs[s->next++];
+        ssize_t n = load_block(s->fds[ref->file], ref, s->buf, s->raw, &header);
+        if (n < 0) continue;
+        s->raw_len = (size_t)n;
+        s->pos = 0;
+        s->line_off = 0;
+        return true;
+    }
+    return false;
+}
+
+static ssize_t stream_reader(void *cls, uint64_t pos, char *buf, size_t max) {
+    struct archive_stream *s = cls;
+    size_t n = 0;
+    (void)pos;
+
+    while (n < max) {
+        if (s->pos + RECORD_HEADER > s->raw_len) {
+            if (!next_block(s)) break;
+            continue;
+        }
+
+        uint32_t time;
+        uint16_t len;
+        memcpy(&time, s->raw + s->pos, sizeof(time));
+        memcpy(&len, s->raw + s->pos + 4, sizeof(len));
+        if (s->pos + RECORD_HEADER + len > s->raw_len) {
+            s->raw_len = 0;
+            continue;
+        }
+        if (time < s->since || time > s->until) {
+            s->pos += RECORD_HEADER + len;
+            continue;
+        }
+
+        // The line and its newline, possibly over several calls
+        const uint8_t *line = s->raw + s->pos + RECORD_HEADER;
+        while (n < max && s->line_off < len) {
+            size_t chunk = len - s->line_off;
+            if (chunk > max - n) chunk = max - n;
+            memcpy(buf + n, line + s->line_off, chunk);
+            s->line_off += chunk;
+            n += chunk;
+        }
+        if (n == max) break;
+        buf[n++] = '\n';
+        s->pos += RECORD_HEADER + len;
+        s->line_off = 0;
+    }
+
+    if (n == 0) return MHD_CONTENT_READER_END_OF_STREAM;
+    metrics_add_bytes(s->metrics_route, n);
+    return (ssize_t)n;
+}
+
+static bool parse_time(struct MHD_Connection *connection, const struct request *request,
+                       const char *name, uint32_t *out) {
+    const char *value = request_arg(connection, request, name);
+    char *end;
+
+    if (value == NULL) return true;
+    errno = 0;
+    unsigned long long v = strtoull(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || v > UINT32_MAX) return false;
+    *out = (uint32_t)v;
+    return true;
+}
+
+// GET /api/logs/archive?since=&until=
+//
+// The archived syslogd lines with a time (Unix seconds) in [since, until],
+// oldest first, as plain text. Only the blocks whose time range overlaps
+// are read from flash, one at a time while the response is sent. Lines
+// still waiting in memory are not included; /api/logs has them.
+enum MHD_Result handle_logs_archive(struct MHD_Connection *connection, const struct request *request) {
+    uint32_t since = 0, until = UINT32_MAX;
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+    char value[24];
+
+    if (!parse_time(connection, request, "since", &since) || !parse_time(connection, request, "until", &until)) {
+        return send_error_response(connection, request->method, request->url,
+            "Invalid query parameter", MHD_HTTP_BAD_REQUEST);
+    }
+
+    struct archive_stream *s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        return send_error_response(connection, request->method, request->url,
+            "Out of memory", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+    s->fds[0] = s->fds[1] = -1;
+    s->since = since;
+    s->until = until;
+    s->metrics_route = metrics_current_route();
+
+    pthread_mutex_lock(&archive_lock);
+    if (!enabled || readers == MAX_READERS) {
+        bool busy = enabled;
+        pthread_mutex_unlock(&archive_lock);
+        free(s);
+        return send_error_response(connection, request->method, request->url,
+            busy ? "Too many archive readers" : "Log archive is disabled", MHD_HTTP_SERVICE_UNAVAILABLE);
+    }
+    readers++;
+    s->refs = malloc((block_count ? block_count : 1) * sizeof(*s->refs));
+    if (s->refs) {
+        for (size_t i = 0; i < block_count; i++) {
+            if (blocks[i].first_time <= until && blocks[i].last_time >= since) s->refs[s->count++] = blocks[i];
+        }
+    }
+    // The writer may rotate the files away from under the index
+    for (int i = 0; i < 2; i++) {
+        if (fds[i] != -1) s->fds[i] = dup(fds[i]);
+    }
+    pthread_mutex_unlock(&archive_lock);
+
+    s->buf = malloc(sizeof(struct block_header) + BLOCK_PAYLOAD_MAX);
+    s->raw = malloc(ARCHIVE_BLOCK_SIZE);
+    if (s->refs == NULL || s->buf == NULL || s->raw == NULL) {
+        stream_free(s);
+        return send_error_response(connection, request->method, request->url,
+            "Out of memory", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+
+    response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, STREAM_BLOCK_SIZE,
+                                                 &stream_reader, s, &stream_free);
+    if (response == NULL) {
+        stream_free(s);
+        return send_error_response(connection, request->method, request->url,
+            "Failed to create response", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+
+    snprintf(value, sizeof(value), "%zu", s->count);
+    MHD_add_response_header(response, "Content-Type", "text/plain; charset=utf-8");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-store");
+    MHD_add_response_header(response, "X-Archive-Blocks", value);
+    ret = queue_response(connection, MHD_HTTP_OK, response, 0);
+    MHD_destroy_response(response);
+
+    log_request(connection, request->method, request->url, MHD_HTTP_OK);
+    return ret;
+}
@@ -0,0 +1,52 @@
+#ifndef LOG_ARCHIVE_H
+#define LOG_ARCHIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Persistent log archive on flash, so the syslogd history in tmpfs
+// survives a reboot.
+//
+// Lines handed over by the log indexer collect in memory and are cut into
+// blocks of up to ARCHIVE_BLOCK_SIZE bytes, LZ4-compressed (common/lz4.h)
+// and appended to the archive file with a header holding the time range
+// of their lines. A block is written once it is full, once its oldest line
+// has waited ARCHIVE_FLUSH_SECONDS, or ARCHIVE_URGENT_SECONDS after an
+// error line, and only while a token bucket of the configured KiB per hour
+// allows; lines wait in memory otherwise, and the oldest are dropped if
+// that backlog outgrows ARCHIVE_BACKLOG. The file is rotated to path.0 at
+// ARCHIVE_FILE_SIZE, so the archive never takes more than twice that.
+//
+// The block headers are kept in memory, so a time range lookup reads and
+// decompresses only the blocks that overlap it.
+
+#define ARCHIVE_BLOCK_SIZE (60 * 1024)
+#define ARCHIVE_BACKLOG (4 * ARCHIVE_BLOCK_SIZE)
+#define ARCHIVE_FLUSH_SECONDS 300
+#define ARCHIVE_URGENT_SECONDS 10
+#define ARCHIVE_FILE_SIZE (1024 * 1024)
+
+// Open or create the archive at path and start the writer thread, writing
+// at most rate_kib KiB per hour. A missing or unusable path only disables
+// the archive; returns -1 if the writer cannot be started.
+int log_archive_start(const char *path, unsigned int rate_kib);
+
+// Queue one line of the syslogd files, oldest first. time 0 (no parsable
+// timestamp) takes the time of the previous line; urgent lines (errors)
+// are written sooner. Lines already archived before a restart of httpd in
+// the same boot are skipped.
+void log_archive_add(uint32_t time, bool urgent, const char *line, size_t len);
+
+struct log_archive_stats {
+    uint64_t lines;         // lines written to flash
+    uint64_t dropped;       // lines dropped from a full backlog
+    uint64_t blocks;
+    uint64_t bytes_in;      // their records before and after compression
+    uint64_t bytes_out;     // with the block headers, all that went to flash
+    uint64_t backlog;       // bytes waiting in memory
+};
+
+void log_archive_stats(struct log_archive_stats *stats);
+
+#endif // LOG_ARCHIVE_H
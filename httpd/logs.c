@@ -1,31 +1,695 @@
 #include "handlers.h"
+#include "events.h"
+#include "trigram.h"
+#include "log_archive.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
-enum MHD_Result handle_logs(struct MHD_Connection *connection) {
-    // Create a sample logs response
-    struct json_object *root = json_object_new_object();
-    struct json_object *logs = json_object_new_array();
-    
-    // Add some sample log entries
-    struct json_object *log1 = json_object_new_object();
-    json_object_object_add(log1, "timestamp", json_object_new_string("2024-02-09 12:34:56"));
-    json_object_object_add(log1, "level", json_object_new_string("error"));
-    json_object_object_add(log1, "message", json_object_new_string("System started"));
-    json_object_array_add(logs, log1);
-    
-    struct json_object *log2 = json_object_new_object();
-    json_object_object_add(log2, "timestamp", json_object_new_string("2024-02-09 12:35:00"));
-    json_object_object_add(log2, "level", json_object_new_string("warning"));
-    json_object_object_add(log2, "message", json_object_new_string("Network interface eth0 up"));
-    json_object_array_add(logs, log2);
-    
-    json_object_object_add(root, "logs", logs);
-    
-    const char *json_str = json_object_to_json_string(root);
-    enum MHD_Result ret = send_json_response(connection, "GET", "/api/logs", json_str, MHD_HTTP_OK);
-    
-    json_object_put(root);
+#define MAX_LINE_LEN 1024
+#define SCAN_BUFFER 4096
+#define MAX_SEGMENTS 8          // the live file plus up to 7 rotated ones
+#define DEFAULT_PAGE_SIZE 100
+#define MAX_PAGE_SIZE 500
+
+enum log_level {
+    LEVEL_INFO,
+    LEVEL_WARNING,
+    LEVEL_ERROR
+};
+
+static const char *const level_names[] = { "info", "warning", "error" };
+
+// Index entry of one line. At 8 bytes per line the index of a full 1 MiB
+// syslogd file stays well below 100 KiB.
+struct log_line {
+    uint32_t time;
+    uint32_t offset;        // byte offset in the file, level in the top bits
+};
+
+#define LINE_LEVEL_SHIFT 30
+#define LINE_OFFSET_MASK ((1u << LINE_LEVEL_SHIFT) - 1)
+
+// One syslogd file. Tracked by inode and kept open, so rotation renaming
+// it to messages.0 neither loses its index nor forces a rescan.
+struct log_segment {
+    ino_t inode;
+    int fd;
+    off_t indexed;          // end of the last complete line seen
+    uint64_t first_id;      // id of lines[0], ids are contiguous per file
+    struct log_line *lines;
+    size_t count;
+    size_t capacity;
+};
+
+struct parsed_line {
+    time_t time;
+    enum log_level level;
+    const char *message;
+    size_t message_len;
+};
+
+// Everything below is protected by index_lock
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char *log_path = NULL;
+static struct log_segment *segments[MAX_SEGMENTS];     // oldest first
+static size_t segment_count = 0;
+static uint64_t next_id = 1;
+
+// syslogd timestamps carry no year; resolving the date with mktime() once
+// per day instead of once per line keeps the initial scan cheap
+static int cached_mon = -1;
+static int cached_mday = -1;
+static time_t cached_day;
+
+static int two_digits(const char *p) {
+    if (p[0] < '0' || p[0] > '9' || p[1] < '0' || p[1] > '9') return -1;
+    return (p[0] - '0') * 10 + (p[1] - '0');
+}
+
+// Parse "Mmm dd hh:mm:ss" into local time
+static time_t parse_timestamp(const char *ts) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    int mon;
+
+    for (mon = 0; mon < 12; mon++) {
+        if (memcmp(ts, months + mon * 3, 3) == 0) break;
+    }
+    // Days below 10 are padded with a space
+    int mday = ts[4] == ' ' && ts[5] >= '1' && ts[5] <= '9' ? ts[5] - '0' : two_digits(ts + 4);
+    int hour = two_digits(ts + 7);
+    int min = two_digits(ts + 10);
+    int sec = two_digits(ts + 13);
+    if (mon == 12 || mday < 1 || hour < 0 || min < 0 || sec < 0) return 0;
+
+    if (mon != cached_mon || mday != cached_mday) {
+        time_t now = time(NULL);
+        struct tm tm;
+
+        localtime_r(&now, &tm);
+        int year = tm.tm_year;
+        tm = (struct tm){ .tm_year = year, .tm_mon = mon, .tm_mday = mday, .tm_isdst = -1 };
+        time_t day = mktime(&tm);
+        if (day > now + 86400) {
+            // A date in the future is from last year
+            tm = (struct tm){ .tm_year = year - 1, .tm_mon = mon, .tm_mday = mday, .tm_isdst = -1 };
+            day = mktime(&tm);
+        }
+        cached_mon = mon;
+        cached_mday = mday;
+        cached_day = day;
+    }
+    return cached_day + hour * 3600 + min * 60 + sec;
+}
+
+// Map the "facility.priority" field of a syslogd line to a level
+static int priority_level(const char *prio, size_t len) {
+    const char *dot = memchr(prio, '.', len);
+    if (dot == NULL) return -1;
+
+    size_t n = len - (size_t)(dot + 1 - prio);
+    const char *p = dot + 1;
+    if ((n == 5 && strncmp(p, "emerg", 5) == 0) || (n == 5 && strncmp(p, "alert", 5) == 0) ||
+        (n == 4 && strncmp(p, "crit", 4) == 0) || (n == 3 && strncmp(p, "err", 3) == 0)) {
+        return LEVEL_ERROR;
+    }
+    if (n == 4 && strncmp(p, "warn", 4) == 0) return LEVEL_WARNING;
+    if ((n == 6 && strncmp(p, "notice", 6) == 0) || (n == 4 && strncmp(p, "info", 4) == 0) ||
+        (n == 5 && strncmp(p, "debug", 5) == 0)) {
+        return LEVEL_INFO;
+    }
+    return -1;
+}
+
+// Split a syslogd line ("Mmm dd hh:mm:ss host fac.prio message")
+static void parse_line(const char *line, size_t len, struct parsed_line *p) {
+    p->time = 0;
+    p->level = LEVEL_INFO;
+    p->message = line;
+    p->message_len = len;
+
+    if (len <= 16 || line[15] != ' ' || (p->time = parse_timestamp(line)) == 0) return;
+
+    const char *msg = line + 16;
+    const char *end = line + len;
+    p->message = msg;
+    p->message_len = (size_t)(end - msg);
+
+    // Lines from syslogd -S lack the host name and facility.priority
+    const char *host_end = memchr(msg, ' ', (size_t)(end - msg));
+    const char *prio_end = host_end ? memchr(host_end + 1, ' ', (size_t)(end - host_end - 1)) : NULL;
+    if (prio_end) {
+        int level = priority_level(host_end + 1, (size_t)(prio_end - host_end - 1));
+        if (level >= 0) {
+            p->level = (enum log_level)level;
+            p->message = prio_end + 1;
+            p->message_len = (size_t)(end - p->message);
+        }
+    }
+}
+
+static void format_time(time_t t, char *buf, size_t len) {
+    struct tm tm;
+
+    if (t == 0 || localtime_r(&t, &tm) == NULL) {
+        buf[0] = '\0';
+        return;
+    }
+    strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+static void write_line(struct json_writer *w, uint64_t id, const struct parsed_line *p) {
+    char timestamp[32];
+
+    format_time(p->time, timestamp, sizeof(timestamp));
+    jw_begin_object(w);
+    jw_kv_uint(w, "id", id);
+    jw_kv_string(w, "timestamp", timestamp);
+    jw_kv_string(w, "level", level_names[p->level]);
+    jw_key(w, "message");
+    jw_string_len(w, p->message, p->message_len);
+    jw_end_object(w);
+}
+
+static void index_line(struct log_segment *seg, off_t offset, const char *line, size_t len, bool publish) {
+    struct parsed_line p;
+
+    if ((uint64_t)offset > LINE_OFFSET_MASK) return;
+
+    if (seg->count == seg->capacity) {
+        size_t capacity = seg->capacity ? seg->capacity * 2 : 256;
+        struct log_line *lines = realloc(seg->lines, capacity * sizeof(*lines));
+        if (lines == NULL) return;
+        seg->lines = lines;
+        seg->capacity = capacity;
+    }
+
+    parse_line(line, len, &p);
+    log_archive_add((uint32_t)p.time, p.level == LEVEL_ERROR, line, len);
+    seg->lines[seg->count++] = (struct log_line){
+        .time = (uint32_t)p.time,
+        .offset = (uint32_t)offset | ((uint32_t)p.level << LINE_LEVEL_SHIFT),
+    };
+    next_id = seg->first_id + seg->count;
+
+    // Only the part read_line() sees can be verified by a search
+    size_t skip = (size_t)(p.message - line);
+    if (skip < MAX_LINE_LEN) {
+        size_t n = p.message_len < MAX_LINE_LEN - skip ? p.message_len : MAX_LINE_LEN - skip;
+        trigram_add(next_id - 1, p.message, n);
+    }
+
+    if (publish) {
+        struct json_writer w;
+        jw_init(&w, len + 96);
+        write_line(&w, next_id - 1, &p);
+        char *json = jw_finish(&w, NULL);
+        if (json) {
+            events_publish("log", json, false);
+            free(json);
+        }
+    }
+}
+
+// Offset of the first newline at or after from, or -1 if there is none yet
+static off_t find_newline(int fd, off_t from, off_t size) {
+    char buf[SCAN_BUFFER];
+
+    while (from < size) {
+        size_t want = size - from < SCAN_BUFFER ? (size_t)(size - from) : SCAN_BUFFER;
+        ssize_t n = pread(fd, buf, want, from);
+        if (n <= 0) return -1;
+        char *nl = memchr(buf, '\n', (size_t)n);
+        if (nl) return from + (nl - buf);
+        from += n;
+    }
+    return -1;
+}
+
+// Index the complete lines between the last scan and size
+static void segment_scan(struct log_segment *seg, off_t size, bool publish) {
+    char buf[SCAN_BUFFER];
+    off_t pos = seg->indexed;
+
+    while (pos < size) {
+        size_t want = size - pos < SCAN_BUFFER ? (size_t)(size - pos) : SCAN_BUFFER;
+        ssize_t n = pread(seg->fd, buf, want, pos);
+        if (n <= 0) break;
+
+        char *start = buf;
+        char *end = buf + n;
+        char *nl;
+        while ((nl = memchr(start, '\n', (size_t)(end - start))) != NULL) {
+            if (nl > start) index_line(seg, pos + (start - buf), start, (size_t)(nl - start), publish);
+            start = nl + 1;
+        }
+
+        if (start == buf) {
+            // Overlong line: index its beginning and skip to its end, or
+            // wait for the rest if syslogd is still writing it
+            off_t eol = find_newline(seg->fd, pos + n, size);
+            if (eol < 0) break;
+            index_line(seg, pos, buf, (size_t)n, publish);
+            pos = eol + 1;
+            continue;
+        }
+        pos += start - buf;
+    }
+    seg->indexed = pos;
+}
+
+static struct log_segment *segment_open(const char *name) {
+    struct log_segment *seg = calloc(1, sizeof(*seg));
+    struct stat st;
+
+    if (seg == NULL) return NULL;
+    seg->fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (seg->fd == -1 || fstat(seg->fd, &st) == -1) {
+        if (seg->fd != -1) close(seg->fd);
+        free(seg);
+        return NULL;
+    }
+    seg->inode = st.st_ino;
+    seg->first_id = next_id;
+    return seg;
+}
+
+static void segment_free(struct log_segment *seg) {
+    if (seg == NULL) return;
+    close(seg->fd);
+    free(seg->lines);
+    free(seg);
+}
+
+static struct log_segment *take_segment(ino_t inode) {
+    for (size_t i = 0; i < segment_count; i++) {
+        struct log_segment *seg = segments[i];
+        if (seg && seg->inode == inode) {
+            segments[i] = NULL;
+            return seg;
+        }
+    }
+    return NULL;
+}
+
+// Bring the index up to date with the files on disk. Only bytes appended
+// since the last call are read; files are matched by inode so a rotation
+// costs a few stat() calls.
+static void logs_refresh(bool publish) {
+    struct log_segment *found[MAX_SEGMENTS];
+    size_t found_count = 0;
+    char name[PATH_MAX];
+
+    // Oldest first: messages.N ... messages.0, then messages
+    for (int i = MAX_SEGMENTS - 2; i >= -1; i--) {
+        struct stat st;
+
+        if (i >= 0) {
+            snprintf(name, sizeof(name), "%s.%d", log_path, i);
+        } else {
+            snprintf(name, sizeof(name), "%s", log_path);
+        }
+        if (stat(name, &st) == -1 || !S_ISREG(st.st_mode)) continue;
+
+        struct log_segment *seg = take_segment(st.st_ino);
+        if (seg && st.st_size < seg->indexed) {
+            // Truncated in place, start over
+            segment_free(seg);
+            seg = NULL;
+        }
+        if (seg == NULL && (seg = segment_open(name)) == NULL) continue;
+
+        if (seg->count == 0) seg->first_id = next_id;
+        // Ids stay contiguous per file: once a newer file got lines, an
+        // older one is final (syslogd only appends to the live file)
+        if (seg->first_id + seg->count == next_id) {
+            segment_scan(seg, st.st_size, publish);
+        }
+        found[found_count++] = seg;
+    }
+
+    // Whatever was not found again has been rotated out
+    for (size_t i = 0; i < segment_count; i++) {
+        segment_free(segments[i]);
+    }
+    memcpy(segments, found, found_count * sizeof(found[0]));
+    segment_count = found_count;
+
+    trigram_forget(segment_count ? segments[0]->first_id : next_id);
+}
+
+// Read line idx of seg into buf and parse it
+static bool read_line(const struct log_segment *seg, size_t idx, char *buf, size_t len,
+                      struct parsed_line *p) {
+    off_t start = seg->lines[idx].offset & LINE_OFFSET_MASK;
+    off_t end = idx + 1 < seg->count ? (off_t)(seg->lines[idx + 1].offset & LINE_OFFSET_MASK) : seg->indexed;
+    size_t want = (size_t)(end - start) < len ? (size_t)(end - start) : len;
+
+    ssize_t n = pread(seg->fd, buf, want, start);
+    if (n <= 0) return false;
+
+    char *nl = memchr(buf, '\n', (size_t)n);
+    parse_line(buf, nl ? (size_t)(nl - buf) : (size_t)n, p);
+    return true;
+}
+
+static bool query_u64(struct MHD_Connection *connection, const struct request *request,
+                      const char *name, uint64_t *out) {
+    const char *value = request_arg(connection, request, name);
+    char *end;
+
+    if (value == NULL) return true;
+    errno = 0;
+    unsigned long long v = strtoull(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0') return false;
+    *out = v;
+    return true;
+}
+
+struct log_match {
+    const struct log_segment *seg;
+    size_t idx;
+};
+
+// GET /api/logs?cursor=&limit=&level=&since=&until=
+//
+// Returns the newest matching lines with an id below cursor, oldest first,
+// and the cursor of the next (older) page. Filtering runs on the in-memory
+// index; only the lines actually returned are read from the files.
+enum MHD_Result handle_logs(struct MHD_Connection *connection, const struct request *request) {
+    uint64_t cursor = UINT64_MAX, limit = DEFAULT_PAGE_SIZE, since = 0, until = UINT32_MAX;
+    int level = -1;
+    const char *level_arg = request_arg(connection, request, "level");
+
+    if (level_arg && strcmp(level_arg, "all") != 0) {
+        for (int i = 0; i < (int)(sizeof(level_names) / sizeof(level_names[0])); i++) {
+            if (strcmp(level_arg, level_names[i]) == 0) level = i;
+        }
+        if (level < 0) {
+            return send_error_response(connection, "GET", "/api/logs",
+                "Invalid level", MHD_HTTP_BAD_REQUEST);
+        }
+    }
+    if (!query_u64(connection, request, "cursor", &cursor) || !query_u64(connection, request, "limit", &limit) ||
+        !query_u64(connection, request, "since", &since) || !query_u64(connection, request, "until", &until) ||
+        limit == 0) {
+        return send_error_response(connection, "GET", "/api/logs",
+            "Invalid query parameter", MHD_HTTP_BAD_REQUEST);
+    }
+    if (limit > MAX_PAGE_SIZE) limit = MAX_PAGE_SIZE;
+
+    struct log_match matches[MAX_PAGE_SIZE];
+    size_t match_count = 0;
+    struct json_writer w;
+    char line[MAX_LINE_LEN];
+
+    pthread_mutex_lock(&index_lock);
+    logs_refresh(true);
+
+    for (size_t s = segment_count; s-- > 0 && match_count < limit;) {
+        const struct log_segment *seg = segments[s];
+        size_t idx = seg->count;
+
+        // Jump straight to the cursor, ids are contiguous within a file
+        if (cursor < seg->first_id) continue;
+        if (cursor - seg->first_id < idx) idx = (size_t)(cursor - seg->first_id);
+
+        while (idx-- > 0 && match_count < limit) {
+            const struct log_line *l = &seg->lines[idx];
+            if (level >= 0 && (int)(l->offset >> LINE_LEVEL_SHIFT) != level) continue;
+            if (l->time < since || l->time > until) continue;
+            matches[match_count++] = (struct log_match){ seg, idx };
+        }
+    }
+
+    jw_init_pooled(&w, match_count * 160 + 64);
+    jw_begin_object(&w);
+    jw_key(&w, "logs");
+    jw_begin_array(&w);
+    for (size_t i = match_count; i-- > 0;) {
+        struct parsed_line p;
+        if (!read_line(matches[i].seg, matches[i].idx, line, sizeof(line), &p)) continue;
+        write_line(&w, matches[i].seg->first_id + matches[i].idx, &p);
+    }
+    jw_end_array(&w);
+
+    jw_key(&w, "next_cursor");
+    if (match_count == limit) {
+        // Page is full, older lines may follow
+        const struct log_match *oldest = &matches[match_count - 1];
+        jw_uint(&w, oldest->seg->first_id + oldest->idx);
+    } else {
+        jw_null(&w);
+    }
+    jw_end_object(&w);
+    pthread_mutex_unlock(&index_lock);
+
+    return send_json_writer(connection, "GET", "/api/logs", &w, MHD_HTTP_OK);
+}
+
+// Segment and index of line id, false if it is no longer indexed
+static bool find_line(uint64_t id, const struct log_segment **seg, size_t *idx) {
+    for (size_t s = segment_count; s-- > 0;) {
+        if (id >= segments[s]->first_id) {
+            if (id - segments[s]->first_id >= segments[s]->count) return false;
+            *seg = segments[s];
+            *idx = (size_t)(id - segments[s]->first_id);
+            return true;
+        }
+    }
+    return false;
+}
+
+// ASCII case-insensitive memmem(); needle is already lower case
+static bool contains_folded(const char *hay, size_t hay_len, const char *needle, size_t needle_len) {
+    for (size_t i = 0; i + needle_len <= hay_len; i++) {
+        size_t j = 0;
+        while (j < needle_len) {
+            char c = hay[i + j];
+            if (c >= 'A' && c <= 'Z') c = (char)(c + 'a' - 'A');
+            if (c != needle[j]) break;
+            j++;
+        }
+        if (j == needle_len) return true;
+    }
+    return false;
+}
+
+struct search {
+    const char *needle;
+    size_t needle_len;
+    int level;                  // -1: any
+    struct log_match *matches;
+    size_t count;
+    size_t limit;
+    char line[MAX_LINE_LEN];
+};
+
+// Read the candidate line and keep it if it really contains the needle
+static bool verify_candidate(uint64_t id, void *arg) {
+    struct search *s = arg;
+    const struct log_segment *seg;
+    struct parsed_line p;
+    size_t idx;
+
+    if (find_line(id, &seg, &idx) &&
+        (s->level < 0 || (int)(seg->lines[idx].offset >> LINE_LEVEL_SHIFT) == s->level) &&
+        read_line(seg, idx, s->line, sizeof(s->line), &p) &&
+        contains_folded(p.message, p.message_len, s->needle, s->needle_len)) {
+        s->matches[s->count++] = (struct log_match){ seg, idx };
+    }
+    return s->count < s->limit;
+}
+
+// GET /api/logs/search?q=&cursor=&limit=&level=
+//
+// Lines whose message contains q (case-insensitive), newest first below
+// cursor, returned oldest first with the cursor of the next page like
+// /api/logs. The trigram index narrows the lines down to a few candidates
+// that are read and checked; lines older than the index covers are scanned.
+enum MHD_Result handle_logs_search(struct MHD_Connection *connection, const struct request *request) {
+    static const char url[] = "/api/logs/search";
+    uint64_t cursor = UINT64_MAX, limit = DEFAULT_PAGE_SIZE;
+    const char *q = request_arg(connection, request, "q");
+    const char *level_arg = request_arg(connection, request, "level");
+    char needle[MAX_LINE_LEN];
+    struct trigram_query query;
+    int level = -1;
+
+    if (level_arg && strcmp(level_arg, "all") != 0) {
+        for (int i = 0; i < (int)(sizeof(level_names) / sizeof(level_names[0])); i++) {
+            if (strcmp(level_arg, level_names[i]) == 0) level = i;
+        }
+        if (level < 0) {
+            return send_error_response(connection, "GET", url, "Invalid level", MHD_HTTP_BAD_REQUEST);
+        }
+    }
+    if (!query_u64(connection, request, "cursor", &cursor) || !query_u64(connection, request, "limit", &limit) ||
+        limit == 0) {
+        return send_error_response(connection, "GET", url, "Invalid query parameter", MHD_HTTP_BAD_REQUEST);
+    }
+    if (q == NULL || strlen(q) >= sizeof(needle) || !trigram_query_init(&query, q, strlen(q))) {
+        return send_error_response(connection, "GET", url,
+            "q must be 3 to 1023 characters", MHD_HTTP_BAD_REQUEST);
+    }
+    if (limit > MAX_PAGE_SIZE) limit = MAX_PAGE_SIZE;
+
+    size_t needle_len = strlen(q);
+    for (size_t i = 0; i < needle_len; i++) {
+        needle[i] = q[i] >= 'A' && q[i] <= 'Z' ? (char)(q[i] + 'a' - 'A') : q[i];
+    }
+
+    struct log_match matches[MAX_PAGE_SIZE];
+    struct search search = {
+        .needle = needle,
+        .needle_len = needle_len,
+        .level = level,
+        .matches = matches,
+        .limit = limit,
+    };
+    struct json_writer w;
+
+    pthread_mutex_lock(&index_lock);
+    logs_refresh(true);
+
+    trigram_search(&query, cursor, verify_candidate, &search);
+
+    // Lines that fell out of the index budget are checked one by one
+    uint64_t id = trigram_first_id();
+    if (id > cursor) id = cursor;
+    if (id > next_id) id = next_id;
+    uint64_t first = segment_count ? segments[0]->first_id : next_id;
+    while (search.count < limit && id-- > first) {
+        verify_candidate(id, &search);
+    }
+
+    jw_init_pooled(&w, search.count * 160 + 64);
+    jw_begin_object(&w);
+    jw_key(&w, "logs");
+    jw_begin_array(&w);
+    for (size_t i = search.count; i-- > 0;) {
+        struct parsed_line p;
+        if (!read_line(matches[i].seg, matches[i].idx, search.line, sizeof(search.line), &p)) continue;
+        write_line(&w, matches[i].seg->first_id + matches[i].idx, &p);
+    }
+    jw_end_array(&w);
+
+    jw_key(&w, "next_cursor");
+    if (search.count == limit) {
+        const struct log_match *oldest = &matches[search.count - 1];
+        jw_uint(&w, oldest->seg->first_id + oldest->idx);
+    } else {
+        jw_null(&w);
+    }
+    jw_end_object(&w);
+    pthread_mutex_unlock(&index_lock);
+
+    return send_json_writer(connection, "GET", url, &w, MHD_HTTP_OK);
+}
+
+// GET /api/logs/file?rotated=N
+//
+// The raw syslogd file, or its rotated copy N, for download. Range requests
+// let an interrupted download resume and the viewer fetch just the tail
+// ("Range: bytes=-65536"); the range is sent from the file without copying.
+enum MHD_Result handle_logs_file(struct MHD_Connection *connection, const struct request *request) {
+    uint64_t rotated = UINT64_MAX;
+    char name[PATH_MAX];
+    char etag[64];
+    char last_modified[32];
+    char disposition[96];
+    struct stat st;
+
+    if (!query_u64(connection, request, "rotated", &rotated) ||
+        (rotated != UINT64_MAX && rotated > MAX_SEGMENTS - 2)) {
+        return send_error_response(connection, "GET", "/api/logs/file",
+            "Invalid rotated", MHD_HTTP_BAD_REQUEST);
+    }
+    if (rotated != UINT64_MAX) {
+        snprintf(name, sizeof(name), "%s.%llu", log_path, (unsigned long long)rotated);
+    } else {
+        snprintf(name, sizeof(name), "%s", log_path);
+    }
+
+    int fd = open(name, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        if (fd != -1) close(fd);
+        return send_error_response(connection, "GET", "/api/logs/file",
+            "Log file not found", MHD_HTTP_NOT_FOUND);
+    }
+
+    // The live file grows, so its ETag changes with every line and a
+    // stale If-Range gets the whole file again
+    snprintf(etag, sizeof(etag), "\"%lx-%lx-%llx\"", (unsigned long)st.st_ino,
+             (unsigned long)st.st_mtime, (unsigned long long)st.st_size);
+    format_http_date(st.st_mtime, last_modified, sizeof(last_modified));
+
+    struct byte_range range;
+    enum range_result result = request_range(connection, "GET", (uint64_t)st.st_size, etag,
+                                             st.st_mtime, &range);
+    if (result == RANGE_UNSATISFIABLE) {
+        close(fd);
+        return send_range_not_satisfiable(connection, "GET", "/api/logs/file", (uint64_t)st.st_size);
+    }
+
+    struct MHD_Response *response = MHD_create_response_from_fd_at_offset64(range.length, fd, range.offset);
+    if (response == NULL) {
+        close(fd);
+        return send_error_response(connection, "GET", "/api/logs/file",
+            "Internal server error", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+
+    const char *base = strrchr(name, '/');
+    snprintf(disposition, sizeof(disposition), "attachment; filename=\"%s\"", base ? base + 1 : name);
+    MHD_add_response_header(response, "Content-Type", "text/plain; charset=utf-8");
+    MHD_add_response_header(response, "Content-Disposition", disposition);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ETAG, etag);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_LAST_MODIFIED, last_modified);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-cache");
+    unsigned int status_code = add_range_headers(response, result, &range, (uint64_t)st.st_size);
+    enum MHD_Result ret = queue_response(connection, status_code, response, range.length);
+    MHD_destroy_response(response);
+
+    log_request(connection, "GET", "/api/logs/file", status_code);
     return ret;
 }
+
+// Pick up new lines and rotations, publishing new lines as events
+static void *index_thread(void *arg) {
+    (void)arg;
+
+    while (1) {
+        sleep(1);
+        pthread_mutex_lock(&index_lock);
+        logs_refresh(true);
+        pthread_mutex_unlock(&index_lock);
+    }
+    return NULL;
+}
+
+int logs_start(const char *path, size_t search_budget) {
+    pthread_t thread;
+
+    log_path = path;
+    trigram_init(search_budget);
+
+    // Index the existing history up front; it is served by /api/logs, not
+    // replayed as events
+    pthread_mutex_lock(&index_lock);
+    logs_refresh(false);
+    pthread_mutex_unlock(&index_lock);
+
+    if (pthread_create(&thread, NULL, index_thread, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
@@ -1,31 +1,143 @@
+#define _GNU_SOURCE
 #include <microhttpd.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sched.h>
+#include <sys/resource.h>
 #include <json-c/json.h>
 #include "handlers.h"
+#include "events.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "compress.h"
+#include "log_archive.h"
+#include "routes.h"
+#include "assets.h"
+#include "mime.h"
+#include "respool.h"
+#include "ratelimit.h"
 
-#define STATIC_DIR "/tmp/tuya/www"
 #define MAX_PATH_LEN 1024
 
-static const char* get_file_extension(const char* filename) {
-    const char* dot = strrchr(filename, '.');
-    if (!dot || dot == filename) return "";
-    return dot + 1;
-}
+// Memory settings left to the defaults below, or to the tighter ones -L
+// picks for 64 MB devices where httpd shares RAM with zigbeed and cpcd
+#define UNSET UINT32_MAX
+#define RESPONSE_BUFFER_SIZE (16 * 1024)
 
-static const char* get_content_type(const char* ext) {
-    if (strcmp(ext, "html") == 0) return "text/html";
-    if (strcmp(ext, "js") == 0) return "application/javascript";
-    if (strcmp(ext, "css") == 0) return "text/css";
-    if (strcmp(ext, "png") == 0) return "image/png";
-    if (strcmp(ext, "jpg") == 0 || strcmp(ext, "jpeg") == 0) return "image/jpeg";
-    if (strcmp(ext, "gif") == 0) return "image/gif";
-    return "application/octet-stream";
-}
+struct memory_defaults {
+    unsigned int connection_limit;
+    unsigned int per_ip_limit;          // 0: no limit
+    unsigned int connection_memory;     // KiB of MHD memory pool per connection
+    unsigned int response_buffers;      // preallocated RESPONSE_BUFFER_SIZE buffers
+    unsigned int search_index;          // KiB for the log search index
+};
+
+static const struct memory_defaults normal_defaults = { 64, 0, 32, 0, 1024 };
+static const struct memory_defaults low_memory_defaults = { 16, 4, 16, 8, 256 };
+
+// Directory to serve the web UI from instead of the embedded copy (-w)
+static const char *static_dir = NULL;
+
+// libmicrohttpd threading models selectable with -m
+enum thread_model {
+    MODEL_EPOLL,        // one internal thread multiplexing all connections
+    MODEL_POOL,         // fixed pool of epoll threads
+    MODEL_THREAD,       // one thread per connection
+};
+
+static const char *const thread_models[] = {
+    [MODEL_EPOLL] = "epoll",
+    [MODEL_POOL] = "pool",
+    [MODEL_THREAD] = "thread",
+};
+
+struct httpd_config {
+    uint16_t port;
+    enum thread_model model;
+    unsigned int pool_size;
+    bool low_memory;
+    unsigned int connection_limit;
+    unsigned int per_ip_limit;
+    unsigned int connection_memory;
+    unsigned int response_buffers;
+    unsigned int search_index;
+    unsigned int compress_min;      // bytes, 0 disables compression
+    unsigned int compress_level;
+    unsigned int connection_timeout;
+    unsigned int status_interval;
+    unsigned int service_interval;  // seconds, 0 disables /api/system/services
+    const char *log_file;
+    const char *access_log;
+    unsigned int access_log_size;   // KiB before the file is rotated
+    const char *archive;            // flash log archive, NULL disables it
+    unsigned int archive_rate;      // KiB per hour written to the archive
+    const char *nvram;              // NULL: the "factory" MTD partition
+    unsigned int max_body;          // KiB accepted in a PATCH/POST body
+    const char *firmware;           // NULL: the "USER0" MTD partition
+    const char *credentials;        // user:password file, NULL disables uploads
+    bool profiler;                  // -x: allow /api/debug/profile
+    struct rate_limit rate_ip[RATE_CLASS_COUNT];
+    struct rate_limit rate_global[RATE_CLASS_COUNT];
+    int sched_policy;               // -S
+    int nice;                       // -N
+};
+
+static struct httpd_config config = {
+    .port = 80,
+    .model = MODEL_EPOLL,
+    .pool_size = 4,
+    .low_memory = false,
+    .connection_limit = UNSET,
+    .per_ip_limit = UNSET,
+    .connection_memory = UNSET,
+    .response_buffers = UNSET,
+    .search_index = UNSET,
+    .compress_min = 1024,
+    .compress_level = 1,
+    .connection_timeout = 30,
+    .status_interval = 2,
+    .service_interval = 5,
+    .log_file = "/tmp/syslog/messages",
+    .access_log = "-",
+    .access_log_size = 256,
+    .archive = "/tuya/data/messages.arc",
+    .archive_rate = 64,
+    .nvram = NULL,
+    .max_body = 64,
+    .firmware = NULL,
+    .credentials = NULL,
+    .profiler = false,
+    // A UI load fetches a dozen files, the dashboard polls a few reads
+    // every couple of seconds; anything far beyond is a runaway client
+    .rate_ip = {
+        [RATE_STATIC] = { 20, 60 },
+        [RATE_READ] = { 10, 30 },
+        [RATE_WRITE] = { 2, 10 },
+    },
+    .rate_global = {
+        [RATE_STATIC] = { 50, 150 },
+        [RATE_READ] = { 30, 90 },
+        [RATE_WRITE] = { 5, 20 },
+    },
+    .sched_policy = SCHED_OTHER,
+    .nice = 0,
+};
+
+// Scheduling classes selectable with -S
+static const struct {
+    const char *name;
+    int policy;
+} sched_policies[] = {
+    { "other", SCHED_OTHER },
+    { "batch", SCHED_BATCH },   // no wakeup preemption of zigbeed
+    { "idle", SCHED_IDLE },     // only runs when nothing else wants the CPU
+};
 
 static enum MHD_Result serve_file(struct MHD_Connection *connection, const char *url, const char *method) {
     char filepath[MAX_PATH_LEN];
@@ -39,107 +151,518 @@ static enum MHD_Result serve_file(struct MHD_Connection *connection, const char
     if (clean_url[0] == '\0') {
         clean_url = "index.html";
     }
-    snprintf(filepath, sizeof(filepath), "%s/%s", STATIC_DIR, clean_url);
+    snprintf(filepath, sizeof(filepath), "%s/%s", static_dir, clean_url);
     
-    // Check if file exists and is regular file
-    if (stat(filepath, &st) == -1 || !S_ISREG(st.st_mode)) {
+    // Open before fstat(), so the size, range and ETag are those of the
+    // file that is sent even if it is replaced meanwhile
+    fd = open(filepath, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        if (fd != -1) close(fd);
         return send_error_response(connection, method, url, "File not found", MHD_HTTP_NOT_FOUND);
     }
-    
-    // Open file
-    fd = open(filepath, O_RDONLY);
-    if (fd == -1) {
-        return send_error_response(connection, method, url, "Failed to open file", MHD_HTTP_INTERNAL_SERVER_ERROR);
+
+    // Validators from the inode, so an edited file gets a new ETag
+    char etag[48];
+    char last_modified[32];
+    const char *cache_control = get_cache_control(url);
+    snprintf(etag, sizeof(etag), "\"%lx-%llx\"", (unsigned long)st.st_mtime, (unsigned long long)st.st_size);
+    format_http_date(st.st_mtime, last_modified, sizeof(last_modified));
+
+    if (request_is_fresh(connection, etag, st.st_mtime)) {
+        close(fd);
+        return send_not_modified(connection, method, url, etag, cache_control, last_modified);
     }
     
-    response = MHD_create_response_from_fd(st.st_size, fd);
+    struct byte_range range;
+    enum range_result result = request_range(connection, method, (uint64_t)st.st_size, etag, st.st_mtime, &range);
+    if (result == RANGE_UNSATISFIABLE) {
+        close(fd);
+        return send_range_not_satisfiable(connection, method, url, (uint64_t)st.st_size);
+    }
+
+    // MHD sends the range straight from the file with sendfile()
+    response = MHD_create_response_from_fd_at_offset64(range.length, fd, range.offset);
     if (response == NULL) {
         close(fd);
         return send_error_response(connection, method, url, "Failed to create response", MHD_HTTP_INTERNAL_SERVER_ERROR);
     }
     
-    const char *ext = get_file_extension(filepath);
-    MHD_add_response_header(response, "Content-Type", get_content_type(ext));
-    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_add_response_header(response, "Content-Type", get_content_type(filepath));
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ETAG, etag);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_LAST_MODIFIED, last_modified);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, cache_control);
+    unsigned int status_code = add_range_headers(response, result, &range, (uint64_t)st.st_size);
+    ret = queue_response(connection, status_code, response, range.length);
     MHD_destroy_response(response);
     
     // Log successful file serving
-    log_request(connection, method, url, MHD_HTTP_OK);
+    log_request(connection, method, url, status_code);
     return ret;
 }
 
-static enum MHD_Result request_handler(void *cls, struct MHD_Connection *connection,
-                                     const char *url, const char *method,
-                                     const char *version, const char *upload_data,
-                                     size_t *upload_data_size, void **con_cls) {
-    // Handle API endpoints
-    if (strncmp(url, "/api/", 5) == 0) {
-        if (strcmp(url, "/api/gateway/status") == 0 && strcmp(method, "GET") == 0) {
-            return handle_gateway_status(connection);
-        }
-        
-        if (strcmp(url, "/api/logs") == 0 && strcmp(method, "GET") == 0) {
-            enum MHD_Result ret = handle_logs(connection);
-            if (ret == MHD_NO) {
-                return send_error_response(connection, method, url, 
-                                        "Internal server error", MHD_HTTP_INTERNAL_SERVER_ERROR);
-            }
-            return ret;
+static enum MHD_Result serve_asset(struct MHD_Connection *connection, const struct asset *asset,
+                                   const char *url, const char *method) {
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+
+    if (request_is_fresh(connection, asset->etag, asset->mtime)) {
+        return send_not_modified(connection, method, url, asset->etag,
+                                 asset->cache_control, asset->last_modified);
+    }
+
+    struct byte_range range;
+    enum range_result result = request_range(connection, method, asset->size, asset->etag,
+                                              asset->mtime, &range);
+    if (result == RANGE_UNSATISFIABLE) {
+        return send_range_not_satisfiable(connection, method, url, asset->size);
+    }
+
+    // Served straight from .rodata, MHD never copies or frees it
+    response = MHD_create_response_from_buffer(range.length, (void *)(asset->data + range.offset),
+                                               MHD_RESPMEM_PERSISTENT);
+    if (response == NULL) {
+        return send_error_response(connection, method, url, "Failed to create response", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+
+    MHD_add_response_header(response, "Content-Type", asset->content_type);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ETAG, asset->etag);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_LAST_MODIFIED, asset->last_modified);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, asset->cache_control);
+    unsigned int status_code = add_range_headers(response, result, &range, asset->size);
+    ret = queue_response(connection, status_code, response, range.length);
+    MHD_destroy_response(response);
+
+    log_request(connection, method, url, status_code);
+    return ret;
+}
+
+static enum MHD_Result serve_static(struct MHD_Connection *connection, const char *url, const char *method) {
+    const struct asset *asset;
+
+    if (static_dir == NULL) {
+        asset = asset_lookup(strcmp(url, "/") == 0 ? "/index.html" : url);
+        if (asset == NULL) {
+            // Client-side routes of the web UI all resolve to index.html
+            asset = asset_lookup("/index.html");
         }
-        
-        if (strcmp(url, "/api/settings") == 0) {
-            if (strcmp(method, "GET") == 0) {
-                enum MHD_Result ret = handle_settings_get(connection);
-                if (ret == MHD_NO) {
-                    return send_error_response(connection, method, url, 
-                                            "Internal server error", MHD_HTTP_INTERNAL_SERVER_ERROR);
-                }
-                return ret;
-            }
-            if (strcmp(method, "PATCH") == 0) {
-                enum MHD_Result ret = handle_settings_patch(connection, upload_data, upload_data_size, con_cls);
-                if (ret == MHD_NO) {
-                    return send_error_response(connection, method, url, 
-                                            "Internal server error", MHD_HTTP_INTERNAL_SERVER_ERROR);
-                }
-                return ret;
-            }
-            // Method not allowed
-            return send_error_response(connection, method, url, "Method not allowed", MHD_HTTP_METHOD_NOT_ALLOWED);
+        if (asset == NULL) {
+            return send_error_response(connection, method, url, "File not found", MHD_HTTP_NOT_FOUND);
         }
-        
-        // API endpoint not found
-        return send_error_response(connection, method, url, "API endpoint not found", MHD_HTTP_NOT_FOUND);
+        return serve_asset(connection, asset, url, method);
     }
-    
+
     // Check if file exists at the requested path
     char filepath[MAX_PATH_LEN];
     struct stat st;
-    snprintf(filepath, sizeof(filepath), "%s/%s", STATIC_DIR, (*url == '/') ? url + 1 : url);
+    snprintf(filepath, sizeof(filepath), "%s/%s", static_dir, (*url == '/') ? url + 1 : url);
     
     if (stat(filepath, &st) != -1 && S_ISREG(st.st_mode)) {
         // File exists, serve it
         return serve_file(connection, url, method);
     }
     
-    // For non-API paths that don't exist, try serving index.html
-    if (strncmp(url, "/api/", 5) != 0) {
-        snprintf(filepath, sizeof(filepath), "%s/index.html", STATIC_DIR);
-        if (stat(filepath, &st) != -1 && S_ISREG(st.st_mode)) {
-            return serve_file(connection, "/index.html", method);
-        }
+    // For paths that don't exist, try serving index.html
+    snprintf(filepath, sizeof(filepath), "%s/index.html", static_dir);
+    if (stat(filepath, &st) != -1 && S_ISREG(st.st_mode)) {
+        return serve_file(connection, "/index.html", method);
     }
     
     // If we get here, neither the file nor index.html exists
     return send_error_response(connection, method, url, "File not found", MHD_HTTP_NOT_FOUND);
 }
 
-int main(void) {
+static enum MHD_Result handle_static(struct MHD_Connection *connection, const struct request *request) {
+    return serve_static(connection, request->url, request->method);
+}
+
+// API endpoints; everything else outside /api/ is the web UI. Log pages are
+// large and fetched on demand, so they are worth a higher compression level.
+// The .batch routes are listed in BATCHABLE_PATHS of www/src/api/client.ts.
+static const struct route routes[] = {
+    { .method = HTTP_GET, .path = "/api/gateway/status", .handler = handle_gateway_status, .batch = true },
+    { .method = HTTP_GET, .path = "/api/system/history", .handler = handle_system_history, .batch = true },
+    { .method = HTTP_GET, .path = "/api/system/services", .handler = handle_system_services, .batch = true },
+    { .method = HTTP_GET, .path = "/api/events", .handler = handle_events },
+    { .method = HTTP_GET, .path = "/api/logs", .handler = handle_logs, .batch = true, .compress = 6 },
+    { .method = HTTP_GET, .path = "/api/logs/file", .handler = handle_logs_file },
+    { .method = HTTP_GET, .path = "/api/logs/search", .handler = handle_logs_search, .batch = true, .compress = 6 },
+    { .method = HTTP_GET, .path = "/api/logs/archive", .handler = handle_logs_archive },
+    { .method = HTTP_GET, .path = "/api/metrics", .handler = handle_metrics },
+    { .method = HTTP_GET, .path = "/api/nvram", .handler = handle_nvram },
+    { .method = HTTP_GET, .path = "/api/settings", .handler = handle_settings_get, .batch = true },
+    { .method = HTTP_PATCH, .path = "/api/settings", .handler = handle_settings_patch },
+    { .method = HTTP_POST, .path = "/api/batch", .handler = handle_batch, .read_only = true },
+    { .method = HTTP_PUT, .path = "/api/firmware", .handler = handle_firmware_upload },
+    { .method = HTTP_GET, .path = "/api/debug/profile", .handler = handle_debug_profile },
+};
+
+static bool parse_uint(const char *str, unsigned int max, unsigned int *out) {
+    char *end;
+    unsigned long val;
+
+    errno = 0;
+    val = strtoul(str, &end, 10);
+    if (errno != 0 || end == str || *end != '\0' || val > max) return false;
+    *out = (unsigned int)val;
+    return true;
+}
+
+static bool parse_sched_policy(const char *name, int *policy) {
+    for (size_t i = 0; i < sizeof(sched_policies) / sizeof(sched_policies[0]); i++) {
+        if (strcmp(name, sched_policies[i].name) == 0) {
+            *policy = sched_policies[i].policy;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void apply_memory_defaults(void) {
+    const struct memory_defaults *d = config.low_memory ? &low_memory_defaults : &normal_defaults;
+
+    if (config.connection_limit == UNSET) config.connection_limit = d->connection_limit;
+    if (config.per_ip_limit == UNSET) config.per_ip_limit = d->per_ip_limit;
+    if (config.connection_memory == UNSET) config.connection_memory = d->connection_memory;
+    if (config.response_buffers == UNSET) config.response_buffers = d->response_buffers;
+    if (config.search_index == UNSET) config.search_index = d->search_index;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-w www_dir] [-p port] [-m model] [-T threads] [-L] [-c limit] [-P limit] [-k KiB] [-R count] [-s KiB] [-z bytes] [-Z level] [-q limits] [-Q limits] [-S class] [-N nice] [-t seconds] [-i seconds] [-I seconds] [-l file] [-o file] [-O KiB] [-a target] [-A KiB] [-n nvram] [-b KiB] [-f firmware] [-u file] [-x]\n", prog);
+    fprintf(stderr, "  -w DIR  serve the web UI from DIR instead of the embedded copy\n");
+    fprintf(stderr, "  -p N    listen port (default %u)\n", config.port);
+    fprintf(stderr, "  -m M    threading model: epoll, pool or thread (default %s)\n",
+            thread_models[config.model]);
+    fprintf(stderr, "  -T N    worker threads for the pool model (default %u)\n", config.pool_size);
+    fprintf(stderr, "  -L      low-memory mode: tighter defaults for -c, -P, -k, -R and -s\n");
+    fprintf(stderr, "  -c N    maximum concurrent connections (default %u, -L %u)\n",
+            normal_defaults.connection_limit, low_memory_defaults.connection_limit);
+    fprintf(stderr, "  -P N    maximum concurrent connections per client IP, 0 = no limit (default %u, -L %u)\n",
+            normal_defaults.per_ip_limit, low_memory_defaults.per_ip_limit);
+    fprintf(stderr, "  -k N    memory pool per connection in KiB (default %u, -L %u)\n",
+            normal_defaults.connection_memory, low_memory_defaults.connection_memory);
+    fprintf(stderr, "  -R N    preallocated %u KiB response buffers (default %u, -L %u)\n",
+            RESPONSE_BUFFER_SIZE / 1024, normal_defaults.response_buffers, low_memory_defaults.response_buffers);
+    fprintf(stderr, "  -s N    log search index size in KiB (default %u, -L %u)\n",
+            normal_defaults.search_index, low_memory_defaults.search_index);
+    fprintf(stderr, "  -z N    gzip/deflate API responses of at least N bytes, 0 = never (default %u)\n",
+            config.compress_min);
+    fprintf(stderr, "  -Z N    compression level 1-9 for routes without their own (default %u)\n",
+            config.compress_level);
+    fprintf(stderr, "  -q L    per-client rate limits, e.g. static=20/60,read=10/30,write=2/10 (requests/s / burst), or off\n");
+    fprintf(stderr, "  -Q L    global rate limits, same format (default static=50/150,read=30/90,write=5/20)\n");
+    fprintf(stderr, "  -S C    scheduling class: other, batch or idle (default other)\n");
+    fprintf(stderr, "  -N N    nice value, 0 to 19 (default 0)\n");
+    fprintf(stderr, "  -t N    idle connection timeout in seconds, 0 = never (default %u)\n",
+            config.connection_timeout);
+    fprintf(stderr, "  -i N    gateway status sampling interval in seconds (default %u)\n",
+            config.status_interval);
+    fprintf(stderr, "  -I N    service resource sampling interval in seconds, 0 = off (default %u)\n",
+            config.service_interval);
+    fprintf(stderr, "  -l FILE syslogd output to follow (default %s)\n", config.log_file);
+    fprintf(stderr, "  -o FILE flash archive of the logs, or off (default %s)\n", config.archive);
+    fprintf(stderr, "  -O N    most KiB written to the log archive per hour (default %u)\n", config.archive_rate);
+    fprintf(stderr, "  -a T    access log: - for stdout, syslog, or a file (default %s)\n", config.access_log);
+    fprintf(stderr, "  -A N    rotate the access log file at N KiB (default %u)\n", config.access_log_size);
+    fprintf(stderr, "  -n PATH NVRAM partition or image file for settings (default: \"factory\" MTD)\n");
+    fprintf(stderr, "  -b N    largest request body accepted in KiB (default %u)\n", config.max_body);
+    fprintf(stderr, "  -f PATH firmware partition or image file for uploads (default: \"USER0\" MTD)\n");
+    fprintf(stderr, "  -u FILE user:password allowed to upload firmware, read NVRAM and profile (default: firmware and NVRAM disabled)\n");
+    fprintf(stderr, "  -x      enable the sampling profiler at /api/debug/profile (with the -u user:password if set)\n");
+}
+
+static bool parse_model(const char *name, enum thread_model *model) {
+    for (size_t i = 0; i < sizeof(thread_models) / sizeof(thread_models[0]); i++) {
+        if (strcmp(name, thread_models[i]) == 0) {
+            *model = (enum thread_model)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static struct MHD_Daemon *start_daemon(void) {
+    struct MHD_OptionItem options[12];
+    unsigned int flags;
+    size_t n = 0;
+
+    switch (config.model) {
+    case MODEL_POOL:
+        // Every pool thread runs its own epoll loop over a share of the connections
+        flags = MHD_USE_EPOLL_INTERNAL_THREAD;
+        options[n++] = (struct MHD_OptionItem){ MHD_OPTION_THREAD_POOL_SIZE, config.pool_size, NULL };
+        break;
+    case MODEL_THREAD:
+        // epoll cannot be combined with thread-per-connection
+        flags = MHD_USE_THREAD_PER_CONNECTION | MHD_USE_POLL_INTERNAL_THREAD;
+        break;
+    case MODEL_EPOLL:
+    default:
+        flags = MHD_USE_EPOLL_INTERNAL_THREAD;
+        break;
+    }
+
+    options[n++] = (struct MHD_OptionItem){ MHD_OPTION_CONNECTION_LIMIT, config.connection_limit, NULL };
+    options[n++] = (struct MHD_OptionItem){ MHD_OPTION_CONNECTION_MEMORY_LIMIT,
+                                            (intptr_t)config.connection_memory * 1024, NULL };
+    if (config.per_ip_limit > 0) {
+        options[n++] = (struct MHD_OptionItem){ MHD_OPTION_PER_IP_CONNECTION_LIMIT, config.per_ip_limit, NULL };
+    }
+    options[n++] = (struct MHD_OptionItem){ MHD_OPTION_CONNECTION_TIMEOUT, config.connection_timeout, NULL };
+    options[n++] = (struct MHD_OptionItem){ MHD_OPTION_NOTIFY_COMPLETED, (intptr_t)&routes_completed, NULL };
+    options[n++] = (struct MHD_OptionItem){ MHD_OPTION_NOTIFY_CONNECTION, (intptr_t)&metrics_connection_notify, NULL };
+    options[n++] = (struct MHD_OptionItem){ MHD_OPTION_END, 0, NULL };
+
+    // Suspend/resume parks idle /api/events streams
+    return MHD_start_daemon(flags | MHD_USE_ERROR_LOG | MHD_ALLOW_SUSPEND_RESUME, config.port, NULL, NULL,
+                            &routes_dispatch, NULL,
+                            MHD_OPTION_ARRAY, options,
+                            MHD_OPTION_END);
+}
+
+int main(int argc, char **argv) {
     struct MHD_Daemon *daemon;
+    unsigned int port;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:p:m:T:Lc:P:k:R:s:z:Z:q:Q:S:N:t:i:I:l:o:O:a:A:n:b:f:u:xh")) != -1) {
+        switch (opt) {
+        case 'w':
+            static_dir = optarg;
+            break;
+        case 'p':
+            if (!parse_uint(optarg, 65535, &port) || port == 0) {
+                fprintf(stderr, "Invalid port: %s\n", optarg);
+                return 1;
+            }
+            config.port = (uint16_t)port;
+            break;
+        case 'm':
+            if (!parse_model(optarg, &config.model)) {
+                fprintf(stderr, "Unknown threading model: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'T':
+            if (!parse_uint(optarg, 64, &config.pool_size) || config.pool_size == 0) {
+                fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'L':
+            config.low_memory = true;
+            break;
+        case 'c':
+            if (!parse_uint(optarg, 4096, &config.connection_limit) || config.connection_limit == 0) {
+                fprintf(stderr, "Invalid connection limit: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'P':
+            if (!parse_uint(optarg, 4096, &config.per_ip_limit)) {
+                fprintf(stderr, "Invalid per-IP connection limit: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'k':
+            // MHD needs room for the request headers and its write buffer
+            if (!parse_uint(optarg, 1024, &config.connection_memory) || config.connection_memory < 4) {
+                fprintf(stderr, "Invalid connection memory: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'R':
+            if (!parse_uint(optarg, 256, &config.response_buffers)) {
+                fprintf(stderr, "Invalid response buffer count: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            if (!parse_uint(optarg, 65536, &config.search_index)) {
+                fprintf(stderr, "Invalid search index size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'z':
+            if (!parse_uint(optarg, 1024 * 1024, &config.compress_min)) {
+                fprintf(stderr, "Invalid compression threshold: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'Z':
+            if (!parse_uint(optarg, COMPRESS_MAX_LEVEL, &config.compress_level) || config.compress_level == 0) {
+                fprintf(stderr, "Invalid compression level: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'q':
+        case 'Q':
+            if (!ratelimit_parse(optarg, opt == 'q' ? config.rate_ip : config.rate_global)) {
+                fprintf(stderr, "Invalid rate limits: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'S':
+            if (!parse_sched_policy(optarg, &config.sched_policy)) {
+                fprintf(stderr, "Unknown scheduling class: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'N': {
+            unsigned int value;
+            if (!parse_uint(optarg, 19, &value)) {
+                fprintf(stderr, "Invalid nice value: %s\n", optarg);
+                return 1;
+            }
+            config.nice = (int)value;
+            break;
+        }
+        case 't':
+            if (!parse_uint(optarg, 3600, &config.connection_timeout)) {
+                fprintf(stderr, "Invalid timeout: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'i':
+            if (!parse_uint(optarg, 3600, &config.status_interval) || config.status_interval == 0) {
+                fprintf(stderr, "Invalid sampling interval: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'I':
+            if (!parse_uint(optarg, 3600, &config.service_interval)) {
+                fprintf(stderr, "Invalid service sampling interval: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'l':
+            config.log_file = optarg;
+            break;
+        case 'o':
+            config.archive = strcmp(optarg, "off") == 0 ? NULL : optarg;
+            break;
+        case 'O':
+            if (!parse_uint(optarg, 65536, &config.archive_rate) || config.archive_rate == 0) {
+                fprintf(stderr, "Invalid log archive rate: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'a':
+            config.access_log = optarg;
+            break;
+        case 'A':
+            if (!parse_uint(optarg, 65536, &config.access_log_size) || config.access_log_size == 0) {
+                fprintf(stderr, "Invalid access log size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n':
+            config.nvram = optarg;
+            break;
+        case 'f':
+            config.firmware = optarg;
+            break;
+        case 'u':
+            config.credentials = optarg;
+            break;
+        case 'x':
+            config.profiler = true;
+            break;
+        case 'b':
+            if (!parse_uint(optarg, 16384, &config.max_body) || config.max_body == 0) {
+                fprintf(stderr, "Invalid body size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    apply_memory_defaults();
+
+    // Before any thread starts, so all of them inherit it
+    struct sched_param param = { .sched_priority = 0 };
+    if (config.sched_policy != SCHED_OTHER && sched_setscheduler(0, config.sched_policy, &param) != 0) {
+        fprintf(stderr, "Failed to set scheduling class: %s\n", strerror(errno));
+        return 1;
+    }
+    if (config.nice != 0 && setpriority(PRIO_PROCESS, 0, config.nice) != 0) {
+        fprintf(stderr, "Failed to set nice value: %s\n", strerror(errno));
+        return 1;
+    }
+
+    ratelimit_init(config.rate_ip, config.rate_global);
+
+    if (access_log_start(config.access_log, (size_t)config.access_log_size * 1024) != 0) {
+        fprintf(stderr, "Failed to open access log %s\n", config.access_log);
+        return 1;
+    }
+
+    if (respool_init(config.response_buffers, RESPONSE_BUFFER_SIZE) != 0) {
+        fprintf(stderr, "Failed to allocate response buffers\n");
+        return 1;
+    }
+    compress_init(config.compress_min, (int)config.compress_level);
+    metrics_set_memory_budget((uint64_t)config.connection_limit * config.connection_memory * 1024 +
+                              (uint64_t)config.response_buffers * RESPONSE_BUFFER_SIZE);
+
+    if (metrics_init() != 0 ||
+        routes_init(routes, sizeof(routes) / sizeof(routes[0]), (size_t)config.max_body * 1024,
+                    &handle_static) != 0) {
+        fprintf(stderr, "Failed to set up routes\n");
+        return 1;
+    }
+
+    if (settings_start(config.nvram) != 0) {
+        fprintf(stderr, "Failed to start settings\n");
+        return 1;
+    }
+
+    profile_init(config.profiler);
+
+    if (firmware_init(config.firmware, config.credentials) != 0) {
+        fprintf(stderr, "Failed to set up firmware upload\n");
+        return 1;
+    }
+
+    // Before the log index queues the lines already in tmpfs
+    if (log_archive_start(config.archive, config.archive_rate) != 0) {
+        fprintf(stderr, "Failed to start log archive\n");
+        return 1;
+    }
+
+    if (events_init(15) != 0 || logs_start(config.log_file, (size_t)config.search_index * 1024) != 0) {
+        fprintf(stderr, "Failed to start event stream\n");
+        return 1;
+    }
+
+    if (gateway_status_start(config.status_interval) != 0) {
+        fprintf(stderr, "Failed to start gateway status sampler\n");
+        return 1;
+    }
+
+    if (sysstats_start() != 0) {
+        fprintf(stderr, "Failed to start system history sampler\n");
+        return 1;
+    }
+
+    if (services_start(config.service_interval) != 0) {
+        fprintf(stderr, "Failed to start service sampler\n");
+        return 1;
+    }
     
-    daemon = MHD_start_daemon(MHD_USE_INTERNAL_POLLING_THREAD, 80, NULL, NULL,
-                            &request_handler, NULL, MHD_OPTION_END);
-    if (NULL == daemon) return 1;
+    daemon = start_daemon();
+    if (NULL == daemon) {
+        fprintf(stderr, "Failed to start HTTP daemon on port %u\n", config.port);
+        return 1;
+    }
+
+    printf("httpd %s listening on port %u, %s model, %u connections of %u KiB%s\n", VERSION, config.port,
+           thread_models[config.model], config.connection_limit, config.connection_memory,
+           config.low_memory ? " (low memory)" : "");
+    fflush(stdout);
     
     // Keep the main thread running
     while (1) {
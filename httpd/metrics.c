@@ -0,0 +1,401 @@
+#include "metrics.h"
+#include "handlers.h"
+#include "respool.h"
+#include "compress.h"
+#include "log_archive.h"
+#include "ratelimit.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+static const char *route_names[METRICS_MAX_ROUTES];
+static unsigned int route_count = 0;
+
+// Status codes counted individually, anything else is "other"
+static const unsigned int status_codes[] = {
+    200, 204, 206, 304, 400, 401, 403, 404, 405, 413, 416, 429, 500, 503,
+};
+#define STATUS_SLOTS (sizeof(status_codes) / sizeof(status_codes[0]) + 1)
+
+// Upper bounds of the latency buckets in microseconds, plus +Inf
+static const uint32_t bucket_bounds[] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000,
+};
+#define BUCKET_COUNT (sizeof(bucket_bounds) / sizeof(bucket_bounds[0]) + 1)
+
+// Counters of one thread. Only the owner writes them; relaxed atomic stores
+// and loads keep the 64-bit values from tearing on 32-bit ARM.
+struct thread_metrics {
+    uint64_t requests[METRICS_MAX_ROUTES][STATUS_SLOTS];
+    uint64_t latency[METRICS_MAX_ROUTES][BUCKET_COUNT];   // not cumulative
+    uint64_t latency_sum[METRICS_MAX_ROUTES];             // microseconds
+    uint64_t bytes[METRICS_MAX_ROUTES];
+    struct thread_metrics *next;
+};
+
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_metrics *threads = NULL;   // under metrics_lock
+static struct thread_metrics retired;           // under metrics_lock
+static pthread_key_t metrics_key;
+
+static __thread struct thread_metrics *thread_block = NULL;
+static __thread unsigned int current_route = 0;
+static __thread unsigned int pending_status = 0;
+static __thread uint64_t pending_bytes = 0;
+
+static unsigned int active_connections = 0;
+static uint64_t memory_budget = 0;
+
+static void bump(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static void merge(struct thread_metrics *dst, const struct thread_metrics *src) {
+    for (int r = 0; r < METRICS_MAX_ROUTES; r++) {
+        for (size_t i = 0; i < STATUS_SLOTS; i++) {
+            dst->requests[r][i] += __atomic_load_n(&src->requests[r][i], __ATOMIC_RELAXED);
+        }
+        for (size_t i = 0; i < BUCKET_COUNT; i++) {
+            dst->latency[r][i] += __atomic_load_n(&src->latency[r][i], __ATOMIC_RELAXED);
+        }
+        dst->latency_sum[r] += __atomic_load_n(&src->latency_sum[r], __ATOMIC_RELAXED);
+        dst->bytes[r] += __atomic_load_n(&src->bytes[r], __ATOMIC_RELAXED);
+    }
+}
+
+// Thread exit: keep the counts, drop the block
+static void thread_retire(void *arg) {
+    struct thread_metrics *m = arg;
+
+    pthread_mutex_lock(&metrics_lock);
+    merge(&retired, m);
+    for (struct thread_metrics **p = &threads; *p; p = &(*p)->next) {
+        if (*p == m) {
+            *p = m->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&metrics_lock);
+    free(m);
+}
+
+static struct thread_metrics *thread_metrics(void) {
+    struct thread_metrics *m = thread_block;
+    if (m) return m;
+
+    m = calloc(1, sizeof(*m));
+    if (m == NULL) return NULL;
+
+    pthread_mutex_lock(&metrics_lock);
+    m->next = threads;
+    threads = m;
+    pthread_mutex_unlock(&metrics_lock);
+
+    pthread_setspecific(metrics_key, m);
+    thread_block = m;
+    return m;
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+int metrics_init(void) {
+    return pthread_key_create(&metrics_key, thread_retire) == 0 ? 0 : -1;
+}
+
+void metrics_set_memory_budget(uint64_t bytes) {
+    memory_budget = bytes;
+}
+
+unsigned int metrics_add_route(const char *name) {
+    if (route_count == METRICS_MAX_ROUTES) return METRICS_MAX_ROUTES - 1;
+    route_names[route_count] = name;
+    return route_count++;
+}
+
+void metrics_set_route(unsigned int route) {
+    current_route = route;
+}
+
+unsigned int metrics_current_route(void) {
+    return current_route;
+}
+
+uint64_t metrics_begin(void) {
+    pending_status = 0;
+    pending_bytes = 0;
+    return now_us();
+}
+
+void metrics_response(unsigned int status, uint64_t body_size) {
+    pending_status = status;
+    pending_bytes += body_size;
+}
+
+void metrics_end(uint64_t start) {
+    if (pending_status == 0) return;    // still reading the request body
+
+    struct thread_metrics *m = thread_metrics();
+    if (m == NULL) return;
+
+    uint64_t elapsed = now_us() - start;
+    size_t slot = 0;
+    while (slot < STATUS_SLOTS - 1 && status_codes[slot] != pending_status) slot++;
+    size_t bucket = 0;
+    while (bucket < BUCKET_COUNT - 1 && elapsed > bucket_bounds[bucket]) bucket++;
+
+    bump(&m->requests[current_route][slot], 1);
+    bump(&m->latency[current_route][bucket], 1);
+    bump(&m->latency_sum[current_route], elapsed);
+    bump(&m->bytes[current_route], pending_bytes);
+}
+
+void metrics_add_bytes(unsigned int route, uint64_t bytes) {
+    struct thread_metrics *m = thread_metrics();
+    if (m) bump(&m->bytes[route], bytes);
+}
+
+void metrics_connection_notify(void *cls, struct MHD_Connection *connection,
+                               void **socket_context, enum MHD_ConnectionNotificationCode toe) {
+    (void)cls;
+    (void)connection;
+    (void)socket_context;
+
+    if (toe == MHD_CONNECTION_NOTIFY_STARTED) {
+        __atomic_add_fetch(&active_connections, 1, __ATOMIC_RELAXED);
+    } else if (toe == MHD_CONNECTION_NOTIFY_CLOSED) {
+        __atomic_sub_fetch(&active_connections, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Resident set size and CPU time of the process
+static void write_process(FILE *out) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    long ticks = sysconf(_SC_CLK_TCK);
+    unsigned long vsize_pages, rss_pages;
+    char buf[512];
+    FILE *fp;
+
+    fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%lu %lu", &vsize_pages, &rss_pages) == 2) {
+            fprintf(out, "# HELP process_resident_memory_bytes Resident memory size in bytes.\n"
+                         "# TYPE process_resident_memory_bytes gauge\n"
+                         "process_resident_memory_bytes %llu\n"
+                         "# HELP process_virtual_memory_bytes Virtual memory size in bytes.\n"
+                         "# TYPE process_virtual_memory_bytes gauge\n"
+                         "process_virtual_memory_bytes %llu\n",
+                    (unsigned long long)rss_pages * page_size,
+                    (unsigned long long)vsize_pages * page_size);
+        }
+        fclose(fp);
+    }
+
+    // High water mark of the resident set, in kB
+    fp = fopen("/proc/self/status", "r");
+    if (fp) {
+        unsigned long long hwm;
+        while (fgets(buf, sizeof(buf), fp)) {
+            if (sscanf(buf, "VmHWM: %llu kB", &hwm) == 1) {
+                fprintf(out, "# HELP process_resident_memory_peak_bytes Largest resident memory size in bytes.\n"
+                             "# TYPE process_resident_memory_peak_bytes gauge\n"
+                             "process_resident_memory_peak_bytes %llu\n",
+                        hwm * 1024);
+                break;
+            }
+        }
+        fclose(fp);
+    }
+
+    fp = fopen("/proc/self/stat", "r");
+    if (fp) {
+        size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+        buf[n] = '\0';
+        fclose(fp);
+
+        // utime and stime are fields 14 and 15; the command name before
+        // them may contain spaces, so count from its closing parenthesis
+        unsigned long utime, stime;
+        char *p = strrchr(buf, ')');
+        if (p && ticks > 0 &&
+            sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+            fprintf(out, "# HELP process_cpu_seconds_total Total user and system CPU time in seconds.\n"
+                         "# TYPE process_cpu_seconds_total counter\n"
+                         "process_cpu_seconds_total %.2f\n",
+                    (double)(utime + stime) / ticks);
+        }
+    }
+}
+
+static void write_metrics(FILE *out, const struct thread_metrics *total) {
+    fprintf(out, "# HELP httpd_requests_total Requests answered, by route and status.\n"
+                 "# TYPE httpd_requests_total counter\n");
+    for (unsigned int r = 0; r < route_count; r++) {
+        for (size_t i = 0; i < STATUS_SLOTS; i++) {
+            if (total->requests[r][i] == 0) continue;
+            if (i < STATUS_SLOTS - 1) {
+                fprintf(out, "httpd_requests_total{route=\"%s\",status=\"%u\"} %llu\n",
+                        route_names[r], status_codes[i], (unsigned long long)total->requests[r][i]);
+            } else {
+                fprintf(out, "httpd_requests_total{route=\"%s\",status=\"other\"} %llu\n",
+                        route_names[r], (unsigned long long)total->requests[r][i]);
+            }
+        }
+    }
+
+    fprintf(out, "# HELP httpd_request_duration_seconds Time spent in the request handler.\n"
+                 "# TYPE httpd_request_duration_seconds histogram\n");
+    for (unsigned int r = 0; r < route_count; r++) {
+        uint64_t count = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; i++) count += total->latency[r][i];
+        if (count == 0) continue;
+
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < BUCKET_COUNT - 1; i++) {
+            cumulative += total->latency[r][i];
+            fprintf(out, "httpd_request_duration_seconds_bucket{route=\"%s\",le=\"%g\"} %llu\n",
+                    route_names[r], bucket_bounds[i] / 1e6, (unsigned long long)cumulative);
+        }
+        fprintf(out, "httpd_request_duration_seconds_bucket{route=\"%s\",le=\"+Inf\"} %llu\n"
+                     "httpd_request_duration_seconds_sum{route=\"%s\"} %.6f\n"
+                     "httpd_request_duration_seconds_count{route=\"%s\"} %llu\n",
+                route_names[r], (unsigned long long)count,
+                route_names[r], total->latency_sum[r] / 1e6,
+                route_names[r], (unsigned long long)count);
+    }
+
+    fprintf(out, "# HELP httpd_response_bytes_total Response body bytes queued.\n"
+                 "# TYPE httpd_response_bytes_total counter\n");
+    for (unsigned int r = 0; r < route_count; r++) {
+        if (total->bytes[r] == 0) continue;
+        fprintf(out, "httpd_response_bytes_total{route=\"%s\"} %llu\n",
+                route_names[r], (unsigned long long)total->bytes[r]);
+    }
+
+    fprintf(out, "# HELP httpd_connections_active Open client connections.\n"
+                 "# TYPE httpd_connections_active gauge\n"
+                 "httpd_connections_active %u\n",
+            __atomic_load_n(&active_connections, __ATOMIC_RELAXED));
+
+    struct respool_stats pool;
+    respool_stats(&pool);
+    fprintf(out, "# HELP httpd_memory_budget_bytes Memory configured for connections and response buffers.\n"
+                 "# TYPE httpd_memory_budget_bytes gauge\n"
+                 "httpd_memory_budget_bytes %llu\n"
+                 "# HELP httpd_response_buffers Preallocated response buffers.\n"
+                 "# TYPE httpd_response_buffers gauge\n"
+                 "httpd_response_buffers{state=\"in_use\"} %u\n"
+                 "httpd_response_buffers{state=\"free\"} %u\n"
+                 "# HELP httpd_response_buffer_misses_total Responses built on the heap because no buffer was free.\n"
+                 "# TYPE httpd_response_buffer_misses_total counter\n"
+                 "httpd_response_buffer_misses_total %llu\n",
+            (unsigned long long)memory_budget, pool.in_use, pool.count - pool.in_use,
+            (unsigned long long)pool.misses);
+
+    uint64_t rejected[RATE_SCOPE_COUNT][RATE_CLASS_COUNT];
+    ratelimit_rejected(rejected);
+    fprintf(out, "# HELP httpd_rate_limited_total Requests answered 429 by admission control, by class and limit.\n"
+                 "# TYPE httpd_rate_limited_total counter\n");
+    for (int cls = 0; cls < RATE_CLASS_COUNT; cls++) {
+        fprintf(out, "httpd_rate_limited_total{class=\"%s\",limit=\"ip\"} %llu\n"
+                     "httpd_rate_limited_total{class=\"%s\",limit=\"global\"} %llu\n",
+                ratelimit_class_name((enum rate_class)cls),
+                (unsigned long long)rejected[RATE_SCOPE_IP][cls],
+                ratelimit_class_name((enum rate_class)cls),
+                (unsigned long long)rejected[RATE_SCOPE_GLOBAL][cls]);
+    }
+
+    struct compress_stats compressed;
+    compress_stats(&compressed);
+    fprintf(out, "# HELP httpd_compressed_responses_total Responses sent compressed, by encoding.\n"
+                 "# TYPE httpd_compressed_responses_total counter\n"
+                 "httpd_compressed_responses_total{encoding=\"gzip\"} %llu\n"
+                 "httpd_compressed_responses_total{encoding=\"deflate\"} %llu\n"
+                 "# HELP httpd_compression_bytes_total Body bytes of compressed responses before and after compression.\n"
+                 "# TYPE httpd_compression_bytes_total counter\n"
+                 "httpd_compression_bytes_total{stage=\"in\"} %llu\n"
+                 "httpd_compression_bytes_total{stage=\"out\"} %llu\n",
+            (unsigned long long)compressed.gzip, (unsigned long long)compressed.deflate,
+            (unsigned long long)compressed.bytes_in, (unsigned long long)compressed.bytes_out);
+
+    struct log_archive_stats archive;
+    log_archive_stats(&archive);
+    fprintf(out, "# HELP httpd_log_archive_lines_total Log lines written to the flash archive, or dropped waiting for it.\n"
+                 "# TYPE httpd_log_archive_lines_total counter\n"
+                 "httpd_log_archive_lines_total{result=\"written\"} %llu\n"
+                 "httpd_log_archive_lines_total{result=\"dropped\"} %llu\n"
+                 "# HELP httpd_log_archive_blocks_total Compressed blocks appended to the log archive.\n"
+                 "# TYPE httpd_log_archive_blocks_total counter\n"
+                 "httpd_log_archive_blocks_total %llu\n"
+                 "# HELP httpd_log_archive_bytes_total Log archive bytes before compression and written to flash.\n"
+                 "# TYPE httpd_log_archive_bytes_total counter\n"
+                 "httpd_log_archive_bytes_total{stage=\"in\"} %llu\n"
+                 "httpd_log_archive_bytes_total{stage=\"out\"} %llu\n"
+                 "# HELP httpd_log_archive_backlog_bytes Log lines waiting in memory for the archive.\n"
+                 "# TYPE httpd_log_archive_backlog_bytes gauge\n"
+                 "httpd_log_archive_backlog_bytes %llu\n",
+            (unsigned long long)archive.lines, (unsigned long long)archive.dropped,
+            (unsigned long long)archive.blocks, (unsigned long long)archive.bytes_in,
+            (unsigned long long)archive.bytes_out, (unsigned long long)archive.backlog);
+
+    write_process(out);
+}
+
+enum MHD_Result handle_metrics(struct MHD_Connection *connection, const struct request *request) {
+    static struct thread_metrics total;
+    static pthread_mutex_t scrape_lock = PTHREAD_MUTEX_INITIALIZER;
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+    char *text = NULL;
+    size_t len = 0;
+
+    FILE *out = open_memstream(&text, &len);
+    if (out == NULL) {
+        return send_error_response(connection, "GET", "/api/metrics",
+            "Internal server error", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+
+    // total is too big for small thread stacks, so scrapes take turns
+    pthread_mutex_lock(&scrape_lock);
+    memset(&total, 0, sizeof(total));
+    pthread_mutex_lock(&metrics_lock);
+    merge(&total, &retired);
+    for (struct thread_metrics *m = threads; m; m = m->next) {
+        merge(&total, m);
+    }
+    pthread_mutex_unlock(&metrics_lock);
+    write_metrics(out, &total);
+    pthread_mutex_unlock(&scrape_lock);
+
+    if (fclose(out) != 0 || text == NULL) {
+        free(text);
+        return send_error_response(connection, "GET", "/api/metrics",
+            "Internal server error", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+
+    response = compress_response(connection, text, len, &len);
+    if (response) {
+        free(text);
+    } else {
+        response = MHD_create_response_from_buffer(len, text, MHD_RESPMEM_MUST_FREE);
+        if (response == NULL) {
+            free(text);
+            return MHD_NO;
+        }
+    }
+    MHD_add_response_header(response, "Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-store");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_VARY, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+    ret = queue_response(connection, MHD_HTTP_OK, response, len);
+    MHD_destroy_response(response);
+
+    log_request(connection, "GET", "/api/metrics", MHD_HTTP_OK);
+    return ret;
+}
@@ -0,0 +1,51 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <microhttpd.h>
+#include "routes.h"
+
+// Request metrics behind /api/metrics (Prometheus text format).
+//
+// Every thread that serves requests records into its own block of counters,
+// written by that thread only, so recording takes no lock and shares no
+// cache line with other threads. A scrape walks all blocks and adds them up;
+// blocks of exited threads are folded into a retired total first.
+
+#define METRICS_MAX_ROUTES 32
+
+int metrics_init(void);
+
+// Register a route label at startup. Returns its id; routes beyond
+// METRICS_MAX_ROUTES share the last one.
+unsigned int metrics_add_route(const char *name);
+
+// Start timing a call to the access handler
+uint64_t metrics_begin(void);
+
+// Route the current handler call is accounted to
+void metrics_set_route(unsigned int route);
+unsigned int metrics_current_route(void);
+
+// Record the handler call started at start, if it queued a response
+void metrics_end(uint64_t start);
+
+// A response was queued by the current handler call, body_size bytes long
+// (0 if not known up front)
+void metrics_response(unsigned int status, uint64_t body_size);
+
+// Body bytes produced later by a streaming response
+void metrics_add_bytes(unsigned int route, uint64_t bytes);
+
+// MHD_OPTION_NOTIFY_CONNECTION callback, counts open connections
+void metrics_connection_notify(void *cls, struct MHD_Connection *connection,
+                               void **socket_context, enum MHD_ConnectionNotificationCode toe);
+
+// Memory httpd is configured to commit at most to connections and response
+// buffers, reported next to its resident set size
+void metrics_set_memory_budget(uint64_t bytes);
+
+// GET /api/metrics
+enum MHD_Result handle_metrics(struct MHD_Connection *connection, const struct request *request);
+
+#endif // METRICS_H
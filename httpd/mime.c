@@ -0,0 +1,30 @@
+#include "mime.h"
+#include <string.h>
+
+static const char* get_file_extension(const char* filename) {
+    const char* dot = strrchr(filename, '.');
+    if (!dot || dot == filename) return "";
+    return dot + 1;
+}
+
+const char *get_content_type(const char *filename) {
+    const char *ext = get_file_extension(filename);
+
+    if (strcmp(ext, "html") == 0) return "text/html";
+    if (strcmp(ext, "js") == 0) return "application/javascript";
+    if (strcmp(ext, "css") == 0) return "text/css";
+    if (strcmp(ext, "json") == 0) return "application/json";
+    if (strcmp(ext, "svg") == 0) return "image/svg+xml";
+    if (strcmp(ext, "png") == 0) return "image/png";
+    if (strcmp(ext, "jpg") == 0 || strcmp(ext, "jpeg") == 0) return "image/jpeg";
+    if (strcmp(ext, "gif") == 0) return "image/gif";
+    if (strcmp(ext, "ico") == 0) return "image/x-icon";
+    if (strcmp(ext, "woff2") == 0) return "font/woff2";
+    if (strcmp(ext, "txt") == 0) return "text/plain";
+    return "application/octet-stream";
+}
+
+const char *get_cache_control(const char *path) {
+    if (strncmp(path, "/assets/", 8) == 0) return "public, max-age=31536000, immutable";
+    return "public, max-age=60";
+}
@@ -0,0 +1,12 @@
+#ifndef MIME_H
+#define MIME_H
+
+// Content-Type for a file name, based on its extension
+const char *get_content_type(const char *filename);
+
+// Cache-Control for a web UI path. Vite puts a content hash into every file
+// name under /assets/, so those never change; everything else (index.html)
+// must be revalidated quickly to pick up new builds.
+const char *get_cache_control(const char *path);
+
+#endif // MIME_H
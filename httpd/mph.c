@@ -0,0 +1,99 @@
+#include "mph.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MPH_MAX_SEED (1u << 20)
+
+// FNV-1a with a seeded basis and a murmur3 finalizer
+uint32_t mph_hash(const char *key, size_t len, uint32_t seed) {
+    const unsigned char *p = (const unsigned char *)key;
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+
+    while (len--) {
+        h ^= *p++;
+        h *= 16777619u;
+    }
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+uint32_t mph_lookup(const uint32_t *seeds, size_t n, const char *key, size_t len) {
+    if (n == 0) return 0;
+
+    uint32_t bucket = mph_hash(key, len, 0) % mph_bucket_count(n);
+    return mph_hash(key, len, seeds[bucket]) % n;
+}
+
+struct mph_bucket {
+    uint32_t index;
+    uint32_t count;
+};
+
+static int bucket_cmp(const void *a, const void *b) {
+    const struct mph_bucket *x = a, *y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return x->index < y->index ? -1 : (x->index > y->index);
+}
+
+int mph_build(const char *const *keys, size_t n, uint32_t *seeds, uint32_t *slots) {
+    size_t nbuckets = mph_bucket_count(n);
+    struct mph_bucket *buckets = calloc(nbuckets, sizeof(*buckets));
+    uint32_t *key_bucket = malloc((n ? n : 1) * sizeof(*key_bucket));
+    unsigned char *taken = calloc(n ? n : 1, 1);
+    uint32_t *pending = malloc((n ? n : 1) * sizeof(*pending));
+    int ret = -1;
+
+    if (!buckets || !key_bucket || !taken || !pending) goto out;
+
+    for (size_t b = 0; b < nbuckets; b++) {
+        buckets[b].index = b;
+        seeds[b] = 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        key_bucket[i] = mph_hash(keys[i], strlen(keys[i]), 0) % nbuckets;
+        buckets[key_bucket[i]].count++;
+    }
+
+    // Place the most crowded buckets first while the table is still empty
+    qsort(buckets, nbuckets, sizeof(*buckets), bucket_cmp);
+
+    for (size_t b = 0; b < nbuckets && buckets[b].count > 0; b++) {
+        uint32_t index = buckets[b].index;
+        uint32_t seed;
+
+        for (seed = 1; seed < MPH_MAX_SEED; seed++) {
+            size_t placed = 0;
+
+            for (size_t i = 0; i < n; i++) {
+                if (key_bucket[i] != index) continue;
+
+                uint32_t slot = mph_hash(keys[i], strlen(keys[i]), seed) % n;
+                if (taken[slot]) break;
+                taken[slot] = 1;
+                slots[i] = slot;
+                pending[placed++] = slot;
+            }
+
+            if (placed == buckets[b].count) break;
+
+            // Collision (or duplicate key); undo this attempt and retry
+            while (placed) taken[pending[--placed]] = 0;
+        }
+
+        if (seed == MPH_MAX_SEED) goto out;
+        seeds[index] = seed;
+    }
+    ret = 0;
+
+out:
+    free(buckets);
+    free(key_bucket);
+    free(taken);
+    free(pending);
+    return ret;
+}
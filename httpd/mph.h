@@ -0,0 +1,28 @@
+#ifndef MPH_H
+#define MPH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Minimal perfect hash (hash-and-displace). Keys are first spread over
+// mph_bucket_count(n) buckets; every bucket then gets a seed that places all
+// of its keys into distinct, still free slots in [0, n).
+//
+// Shared between the host-side asset generator and httpd itself, so the hash
+// must produce identical results on every architecture.
+
+static inline size_t mph_bucket_count(size_t n) {
+    return n / 4 + 1;
+}
+
+uint32_t mph_hash(const char *key, size_t len, uint32_t seed);
+
+// Compute bucket seeds for n distinct keys. On success slots[i] receives the
+// final position of keys[i]. Returns 0 on success, -1 on failure.
+int mph_build(const char *const *keys, size_t n, uint32_t *seeds, uint32_t *slots);
+
+// Slot for key in a table built by mph_build(). Callers must still compare
+// the key stored in that slot, as unknown keys map to arbitrary slots.
+uint32_t mph_lookup(const uint32_t *seeds, size_t n, const char *key, size_t len);
+
+#endif // MPH_H
@@ -0,0 +1,124 @@
+#include "mtd.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <mtd/mtd-user.h>
+
+// mtdN: size erasesize "name"
+int mtd_find(const char *name, char *path, size_t len) {
+    FILE *fp = fopen("/proc/mtd", "r");
+    char line[128];
+    char quoted[64];
+    int ret = -1;
+
+    if (fp == NULL) return -1;
+    snprintf(quoted, sizeof(quoted), "\"%s\"", name);
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned int index;
+        if (strstr(line, quoted) && sscanf(line, "mtd%u:", &index) == 1) {
+            snprintf(path, len, "/dev/mtd%u", index);
+            ret = 0;
+            break;
+        }
+    }
+    fclose(fp);
+    return ret;
+}
+
+static int fill_erased(int fd, uint64_t offset, uint64_t len) {
+    char block[4096];
+
+    memset(block, 0xFF, sizeof(block));
+    while (len > 0) {
+        size_t n = len < sizeof(block) ? (size_t)len : sizeof(block);
+        if (pwrite(fd, block, n, (off_t)offset) != (ssize_t)n) return -1;
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int mtd_open(struct mtd *mtd, const char *path, uint64_t file_size, uint32_t file_erase_size) {
+    struct mtd_info_user info;
+    struct stat st;
+
+    memset(mtd, 0, sizeof(*mtd));
+    mtd->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (mtd->fd == -1) return -1;
+    if (fstat(mtd->fd, &st) != 0) goto fail;
+
+    if (S_ISCHR(st.st_mode)) {
+        if (ioctl(mtd->fd, MEMGETINFO, &info) != 0 || info.erasesize == 0) goto fail;
+        mtd->is_device = true;
+        mtd->is_nand = info.type == MTD_NANDFLASH || info.type == MTD_MLCNANDFLASH;
+        mtd->size = info.size;
+        mtd->erase_size = info.erasesize;
+        return 0;
+    }
+
+    if (st.st_size == 0) {
+        if (fill_erased(mtd->fd, 0, file_size) != 0) goto fail;
+        st.st_size = (off_t)file_size;
+    }
+    mtd->size = (uint64_t)st.st_size;
+    mtd->erase_size = file_erase_size;
+    return 0;
+
+fail:
+    close(mtd->fd);
+    mtd->fd = -1;
+    return -1;
+}
+
+void mtd_close(struct mtd *mtd) {
+    if (mtd->fd != -1) close(mtd->fd);
+    mtd->fd = -1;
+}
+
+bool mtd_block_bad(const struct mtd *mtd, uint64_t offset) {
+    loff_t pos = (loff_t)offset;
+
+    if (!mtd->is_nand) return false;
+    return ioctl(mtd->fd, MEMGETBADBLOCK, &pos) > 0;
+}
+
+int mtd_erase(const struct mtd *mtd, uint64_t offset, uint64_t len) {
+    if (!mtd->is_device) return fill_erased(mtd->fd, offset, len);
+
+    struct erase_info_user erase = {
+        .start = (uint32_t)offset,
+        .length = (uint32_t)len,
+    };
+    if (ioctl(mtd->fd, MEMERASE, &erase) != 0) {
+        fprintf(stderr, "mtd: erase at 0x%llx failed: %s\n", (unsigned long long)offset, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int mtd_write(const struct mtd *mtd, uint64_t offset, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = pwrite(mtd->fd, p, len, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "mtd: write at 0x%llx failed: %s\n", (unsigned long long)offset, strerror(errno));
+            return -1;
+        }
+        p += n;
+        offset += (uint64_t)n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int mtd_sync(const struct mtd *mtd) {
+    if (mtd->is_device) return 0;
+    return fsync(mtd->fd);
+}
@@ -0,0 +1,41 @@
+#ifndef MTD_H
+#define MTD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Flash partition access shared by the NVRAM store and firmware upload.
+//
+// A partition is either an MTD character device or a regular file standing
+// in for one, so both can be exercised on a development machine. On a file,
+// erasing writes 0xFF and no block is ever bad.
+
+struct mtd {
+    int fd;
+    bool is_device;             // MTD character device
+    bool is_nand;               // may have bad blocks
+    uint64_t size;
+    uint32_t erase_size;
+};
+
+// Find a partition by name in /proc/mtd, e.g. "USER0" -> "/dev/mtd4"
+int mtd_find(const char *name, char *path, size_t len);
+
+// Open path. A missing or empty file is created with file_size bytes of
+// 0xFF; files use file_erase_size as their erase block size.
+int mtd_open(struct mtd *mtd, const char *path, uint64_t file_size, uint32_t file_erase_size);
+void mtd_close(struct mtd *mtd);
+
+// Whether the erase block at offset is marked bad
+bool mtd_block_bad(const struct mtd *mtd, uint64_t offset);
+
+// Erase len bytes at offset, both multiples of the erase size
+int mtd_erase(const struct mtd *mtd, uint64_t offset, uint64_t len);
+
+int mtd_write(const struct mtd *mtd, uint64_t offset, const void *buf, size_t len);
+
+// Make writes durable; MTD devices write through, files are fsync'ed
+int mtd_sync(const struct mtd *mtd);
+
+#endif // MTD_H
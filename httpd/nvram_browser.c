@@ -0,0 +1,280 @@
+#include "handlers.h"
+#include "metrics.h"
+#include "nvram_store.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <regex.h>
+
+#include "nvram/bcmnvram.h"
+
+#define DEFAULT_PAGE_SIZE 100
+#define MAX_PAGE_SIZE 500
+#define MAX_PATTERN_LEN 256
+#define STREAM_BLOCK_SIZE 4096
+
+struct nvram_entry {
+    char name[NVRAM_MAX_PARAM_LEN + 1];
+    unsigned int flags;
+};
+
+// One page of variable names, sorted, selected while holding the store lock
+struct nvram_page {
+    const char *prefix;
+    size_t prefix_len;
+    const regex_t *regex;
+    const char *after;              // cursor: only names sorting after it
+    struct nvram_entry *entries;
+    size_t count;
+    size_t cap;                     // limit + 1, to tell whether more follow
+};
+
+// Response state. Names are fixed when the request arrives, values are
+// looked up and decoded one at a time as MHD asks for more output, so a page
+// costs one value buffer rather than a copy of all of NVRAM.
+struct nvram_stream {
+    struct nvram_page page;
+    size_t limit;
+    size_t next;                    // entry written next
+    bool started;
+    bool done;
+    struct json_writer w;           // pending output of the current entry
+    size_t offset;                  // bytes of w already copied out
+    unsigned int metrics_route;     // streamed bytes are counted here
+    char value[NVRAM_MAX_VALUE_LEN + 1];
+};
+
+// Keep the cap smallest matching names, in order
+static int select_name(const char *name, unsigned int flags, void *arg) {
+    struct nvram_page *page = arg;
+
+    if (page->after && strcmp(name, page->after) <= 0) return 0;
+    if (page->prefix_len && strncmp(name, page->prefix, page->prefix_len) != 0) return 0;
+    if (strlen(name) > NVRAM_MAX_PARAM_LEN) return 0;
+    if (page->count == page->cap && strcmp(name, page->entries[page->count - 1].name) >= 0) return 0;
+    if (page->regex && regexec(page->regex, name, 0, NULL, 0) != 0) return 0;
+
+    size_t lo = 0, hi = page->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (strcmp(page->entries[mid].name, name) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    size_t move = page->count - lo - (page->count == page->cap);
+    memmove(&page->entries[lo + 1], &page->entries[lo], move * sizeof(page->entries[0]));
+    snprintf(page->entries[lo].name, sizeof(page->entries[lo].name), "%s", name);
+    page->entries[lo].flags = flags;
+    if (page->count < page->cap) page->count++;
+    return 0;
+}
+
+// Names copied out under the store lock, as flags byte + name + NUL, so a
+// match expression runs without holding the lock
+struct name_list {
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+static int collect_name(const char *name, unsigned int flags, void *arg) {
+    struct name_list *list = arg;
+    size_t len = strlen(name);
+
+    if (len > NVRAM_MAX_PARAM_LEN) return 0;
+    if (list->len + len + 2 > list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 4096;
+        char *buf = realloc(list->buf, cap);
+        if (buf == NULL) return -1;
+        list->buf = buf;
+        list->cap = cap;
+    }
+    list->buf[list->len++] = (char)flags;
+    memcpy(list->buf + list->len, name, len + 1);
+    list->len += len + 1;
+    return 0;
+}
+
+// Select the page. With a match expression the names are copied first and
+// the expression only runs once the store is unlocked again.
+static int select_page(struct nvram_page *page) {
+    struct name_list list = { 0 };
+
+    if (page->regex == NULL) return nvram_store_foreach(select_name, page);
+
+    int ret = nvram_store_foreach(collect_name, &list);
+    for (size_t pos = 0; ret == 0 && pos < list.len;) {
+        unsigned int flags = (unsigned char)list.buf[pos++];
+        const char *name = list.buf + pos;
+        select_name(name, flags, page);
+        pos += strlen(name) + 1;
+    }
+    free(list.buf);
+    return ret;
+}
+
+static void stream_free(void *cls) {
+    struct nvram_stream *s = cls;
+
+    jw_free(&s->w);
+    free(s->page.entries);
+    free(s);
+}
+
+// Write the next piece of the document into s->w
+static void stream_fill(struct nvram_stream *s) {
+    jw_reset(&s->w);
+    s->offset = 0;
+
+    if (!s->started) {
+        jw_begin_object(&s->w);
+        jw_key(&s->w, "variables");
+        jw_begin_array(&s->w);
+        s->started = true;
+        return;
+    }
+
+    while (s->next < s->page.count && s->next < s->limit) {
+        const struct nvram_entry *e = &s->page.entries[s->next++];
+
+        // Skip variables unset since the page was selected
+        if (nvram_store_get(e->name, s->value, sizeof(s->value)) != 1) continue;
+
+        jw_begin_object(&s->w);
+        jw_kv_string(&s->w, "name", e->name);
+        jw_kv_string(&s->w, "value", s->value);
+        jw_kv_bool(&s->w, "locked", (e->flags & NVRAM_STORE_LOCKED) != 0);
+        jw_kv_bool(&s->w, "temp", (e->flags & NVRAM_STORE_TEMP) != 0);
+        jw_end_object(&s->w);
+        return;
+    }
+
+    jw_end_array(&s->w);
+    jw_key(&s->w, "next_cursor");
+    if (s->page.count > s->limit) {
+        jw_string(&s->w, s->page.entries[s->limit - 1].name);
+    } else {
+        jw_null(&s->w);
+    }
+    jw_end_object(&s->w);
+    s->done = true;
+}
+
+static ssize_t stream_reader(void *cls, uint64_t pos, char *buf, size_t max) {
+    struct nvram_stream *s = cls;
+    size_t n = 0;
+    (void)pos;
+
+    while (n < max) {
+        if (s->offset < s->w.len) {
+            size_t chunk = s->w.len - s->offset;
+            if (chunk > max - n) chunk = max - n;
+            memcpy(buf + n, s->w.buf + s->offset, chunk);
+            s->offset += chunk;
+            n += chunk;
+            continue;
+        }
+        if (s->done) break;
+        stream_fill(s);
+        if (s->w.failed) return MHD_CONTENT_READER_END_WITH_ERROR;
+    }
+
+    if (n == 0) return MHD_CONTENT_READER_END_OF_STREAM;
+    metrics_add_bytes(s->metrics_route, n);
+    return (ssize_t)n;
+}
+
+// GET /api/nvram?prefix=&match=&cursor=&limit=
+//
+// Lists variables sorted by name, limit per page. prefix and match (a POSIX
+// extended regex) filter on the name; cursor is the next_cursor of the
+// previous page. Needs the -u credentials, like firmware uploads.
+enum MHD_Result handle_nvram(struct MHD_Connection *connection, const struct request *request) {
+    const char *prefix = request_arg(connection, request, "prefix");
+    const char *match = request_arg(connection, request, "match");
+    const char *cursor = request_arg(connection, request, "cursor");
+    const char *limit_arg = request_arg(connection, request, "limit");
+    unsigned long limit = DEFAULT_PAGE_SIZE;
+    regex_t regex;
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+
+    // The values are decrypted secrets: same credentials as firmware uploads
+    if (!credentials_configured()) {
+        return send_error_response(connection, request->method, request->url,
+            "NVRAM browsing is disabled", MHD_HTTP_FORBIDDEN);
+    }
+    if (!credentials_check(connection)) {
+        return send_unauthorized(connection, request);
+    }
+
+    if (limit_arg) {
+        char *end;
+        errno = 0;
+        limit = strtoul(limit_arg, &end, 10);
+        if (errno != 0 || end == limit_arg || *end != '\0' || limit == 0) {
+            return send_error_response(connection, request->method, request->url,
+                "Invalid limit", MHD_HTTP_BAD_REQUEST);
+        }
+        if (limit > MAX_PAGE_SIZE) limit = MAX_PAGE_SIZE;
+    }
+    if ((cursor && strlen(cursor) > NVRAM_MAX_PARAM_LEN) ||
+        (match && strlen(match) > MAX_PATTERN_LEN)) {
+        return send_error_response(connection, request->method, request->url,
+            "Invalid query parameter", MHD_HTTP_BAD_REQUEST);
+    }
+    if (match && regcomp(&regex, match, REG_EXTENDED | REG_NOSUB) != 0) {
+        return send_error_response(connection, request->method, request->url,
+            "Invalid match expression", MHD_HTTP_BAD_REQUEST);
+    }
+
+    struct nvram_stream *s = calloc(1, sizeof(*s));
+    if (s) s->page.entries = malloc((limit + 1) * sizeof(s->page.entries[0]));
+    if (s == NULL || s->page.entries == NULL) {
+        if (match) regfree(&regex);
+        if (s) free(s);
+        return send_error_response(connection, request->method, request->url,
+            "Out of memory", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+    s->limit = limit;
+    s->page.cap = limit + 1;
+    s->page.prefix = prefix;
+    s->page.prefix_len = prefix ? strlen(prefix) : 0;
+    s->page.regex = match ? &regex : NULL;
+    s->page.after = cursor;
+    s->metrics_route = metrics_current_route();
+
+    int found = select_page(&s->page);
+    if (match) regfree(&regex);
+    s->page.prefix = s->page.after = NULL;
+    s->page.regex = NULL;
+
+    if (found != 0) {
+        stream_free(s);
+        return send_error_response(connection, request->method, request->url,
+            "NVRAM is not available", MHD_HTTP_SERVICE_UNAVAILABLE);
+    }
+
+    jw_init(&s->w, 512);
+    response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, STREAM_BLOCK_SIZE,
+                                                 &stream_reader, s, &stream_free);
+    if (response == NULL) {
+        stream_free(s);
+        return send_error_response(connection, request->method, request->url,
+            "Failed to create response", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+
+    // Secrets: no CORS headers, so other origins cannot read them, and no caching
+    MHD_add_response_header(response, "Content-Type", "application/json");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-store");
+    ret = queue_response(connection, MHD_HTTP_OK, response, 0);
+    MHD_destroy_response(response);
+
+    log_request(connection, request->method, request->url, MHD_HTTP_OK);
+    return ret;
+}
@@ -0,0 +1,307 @@
+#include "nvram_store.h"
+#include "mtd.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "nvram/bcmnvram.h"
+#include "nvram/nvram_core.h"
+#include "aes.h"
+#include "uni_base64.h"
+
+// Device key, see the NVRAM_AES_KEY make variable
+#ifndef NVRAM_AES_KEY
+#define NVRAM_AES_KEY "xxxxxxxxxxxxxxxx"
+#endif
+
+#define DEFAULT_BANK_SIZE 0x20000   // image files created for testing
+#define FILE_ERASE_SIZE 4096        // so any bank size of an image file works
+
+extern unsigned short verify_zbuf_chksum(char *zbuf_with_header);
+
+// Bank size, read by nvram_core.c through NVRAM_SPACE
+unsigned int NVRAM_MTD_SIZE = DEFAULT_BANK_SIZE;
+
+static pthread_mutex_t nvram_lock = PTHREAD_MUTEX_INITIALIZER;
+static const unsigned char *aes_key = (const unsigned char *)NVRAM_AES_KEY;
+
+// Value storage for the tuples: a bump allocator, compacted by
+// _nvram_generate(header, 1) when it runs full (as in file_nvram.c)
+static char *nvram_values = NULL;
+static size_t nvram_offset = 0;
+
+static struct mtd flash = { .fd = -1 };
+static unsigned int current_bank = 0;
+static uint64_t write_counter = 0;
+
+struct nvram_tuple *_nvram_realloc(struct nvram_tuple *t, const char *name,
+                                   const char *value, int is_temp) {
+    struct nvram_tuple *rt = t;
+    size_t val_len = strlen(value);
+
+    if (rt == NULL) {
+        rt = malloc(sizeof(struct nvram_tuple) + strlen(name) + 1);
+        if (rt == NULL) return NULL;
+        rt->name = (char *)&rt[1];
+        strcpy(rt->name, name);
+        rt->value = NULL;
+        rt->val_len = 0;
+        rt->flag = 0;
+        rt->next = NULL;
+    }
+
+    rt->val_tmp = is_temp ? 1 : 0;
+
+    if (rt->value == NULL || strcmp(rt->value, value) != 0) {
+        if (rt->value == NULL || val_len > rt->val_len) {
+            if (nvram_offset + val_len + 1 >= NVRAM_VALUES_SPACE) {
+                if (rt != t) free(rt);
+                return NULL;
+            }
+            rt->value = &nvram_values[nvram_offset];
+            rt->val_len = val_len;
+            nvram_offset += val_len + 1;
+        }
+        strcpy(rt->value, value);
+    }
+    return rt;
+}
+
+void _nvram_free(struct nvram_tuple *t) {
+    free(t);
+}
+
+void _nvram_reset(void) {
+    nvram_offset = 0;
+    if (nvram_values) memset(nvram_values, 0, NVRAM_VALUES_SPACE);
+}
+
+// Decode a stored value into out (at most len bytes including the NUL).
+// Empty values are stored as is, AES cannot encrypt them.
+static int decode_value(const char *in, char *out, size_t len) {
+    size_t in_len = strlen(in);
+    unsigned char *raw;
+    unsigned char *plain = NULL;
+    unsigned int plain_len = 0;
+
+    if (in_len == 0) {
+        out[0] = '\0';
+        return 0;
+    }
+
+    raw = malloc(in_len);
+    if (raw == NULL) return -1;
+
+    int raw_len = tuya_base64_decode(in, raw);
+    if (raw_len <= 0 || raw_len % 16 != 0 ||
+        aes128_data_decode(raw, (unsigned int)raw_len, &plain, &plain_len, aes_key) != 0 ||
+        plain_len > (unsigned int)raw_len) {
+        free(raw);
+        free(plain);
+        return -1;
+    }
+    free(raw);
+
+    if (plain_len >= len) plain_len = (unsigned int)len - 1;
+    memcpy(out, plain, plain_len);
+    out[plain_len] = '\0';
+    free(plain);
+    return 0;
+}
+
+// Used by _nvram_getall(); out holds NVRAM_MAX_VALUE_LEN bytes
+int kernel_nvram_decode(const char *in, char *out) {
+    return decode_value(in, out, NVRAM_MAX_VALUE_LEN);
+}
+
+static char *encode_value(const char *in) {
+    unsigned char *enc = NULL;
+    unsigned int enc_len = 0;
+
+    if (in[0] == '\0') return strdup("");
+    if (aes128_data_encode((const unsigned char *)in, (unsigned int)strlen(in), &enc, &enc_len, aes_key) != 0) {
+        return NULL;
+    }
+
+    char *out = malloc(enc_len / 3 * 4 + 4 + 1);
+    if (out) tuya_base64_encode(enc, out, (int)enc_len);
+    free(enc);
+    return out;
+}
+
+static bool bank_valid(const struct nvram_header *header) {
+    return header->magic == NVRAM_MAGIC &&
+           header->len >= sizeof(struct nvram_header) &&
+           header->len <= NVRAM_SPACE &&
+           verify_zbuf_chksum((char *)header) == 0;
+}
+
+// Load the valid bank with the highest write counter
+static int load_banks(void) {
+    struct nvram_header *header = malloc(NVRAM_SPACE);
+    bool found = false;
+
+    if (header == NULL) return -1;
+
+    for (unsigned int bank = 0; bank < 2; bank++) {
+        if (pread(flash.fd, header, NVRAM_SPACE, (off_t)bank * NVRAM_SPACE) != (ssize_t)NVRAM_SPACE) continue;
+        if (!bank_valid(header)) continue;
+        if (!found || header->write_counter > write_counter) {
+            write_counter = header->write_counter;
+            current_bank = bank;
+            found = true;
+        }
+    }
+
+    int ret = 0;
+    if (found) {
+        if (pread(flash.fd, header, NVRAM_SPACE, (off_t)current_bank * NVRAM_SPACE) != (ssize_t)NVRAM_SPACE ||
+            _nvram_init(header) != 0) {
+            ret = -1;
+        }
+    } else {
+        // Empty partition: the first commit goes to bank 0
+        current_bank = 1;
+    }
+    free(header);
+    return ret;
+}
+
+static int write_bank(struct nvram_header *header) {
+    unsigned int bank = current_bank ^ 1;
+    off_t offset = (off_t)bank * NVRAM_SPACE;
+
+    header->write_counter = write_counter + 1;
+
+    uint64_t erase_len = (NVRAM_SPACE + flash.erase_size - 1) / flash.erase_size * flash.erase_size;
+    if (mtd_erase(&flash, (uint64_t)offset, erase_len) != 0 ||
+        mtd_write(&flash, (uint64_t)offset, header, NVRAM_SPACE) != 0 ||
+        mtd_sync(&flash) != 0) {
+        fprintf(stderr, "nvram: commit failed\n");
+        return -1;
+    }
+
+    write_counter++;
+    current_bank = bank;
+    return 0;
+}
+
+int nvram_store_init(const char *path) {
+    char mtd_path[32];
+    int ret = -1;
+
+    if (path == NULL) {
+        if (mtd_find(MTD_NVRAM_NAME, mtd_path, sizeof(mtd_path)) != 0) {
+            fprintf(stderr, "nvram: no %s partition\n", MTD_NVRAM_NAME);
+            return -1;
+        }
+        path = mtd_path;
+    }
+
+    pthread_mutex_lock(&nvram_lock);
+    if (mtd_open(&flash, path, 2 * DEFAULT_BANK_SIZE, FILE_ERASE_SIZE) != 0) {
+        fprintf(stderr, "nvram: cannot open %s: %s\n", path, strerror(errno));
+        goto out;
+    }
+    NVRAM_MTD_SIZE = (unsigned int)(flash.size / 2);
+
+    nvram_values = malloc(NVRAM_VALUES_SPACE);
+    if (nvram_values == NULL) goto out;
+    _nvram_reset();
+
+    if (load_banks() != 0) {
+        fprintf(stderr, "nvram: %s is corrupted\n", path);
+        goto out;
+    }
+    ret = 0;
+
+out:
+    if (ret != 0) mtd_close(&flash);
+    pthread_mutex_unlock(&nvram_lock);
+    return ret;
+}
+
+int nvram_store_get(const char *name, char *value, size_t len) {
+    int ret = -1;
+
+    pthread_mutex_lock(&nvram_lock);
+    if (flash.fd != -1) {
+        const char *enc = _nvram_get(name);
+        if (enc == NULL) {
+            ret = 0;
+        } else if (decode_value(enc, value, len) == 0) {
+            ret = 1;
+        }
+    }
+    pthread_mutex_unlock(&nvram_lock);
+    return ret;
+}
+
+int nvram_store_set(const char *name, const char *value) {
+    char *enc = encode_value(value);
+    int ret = -1;
+
+    if (enc == NULL) return -1;
+
+    pthread_mutex_lock(&nvram_lock);
+    if (flash.fd != -1) {
+        ret = _nvram_set(name, enc, 0);
+        if (ret == -1) {
+            // Value space exhausted: compact it and retry
+            struct nvram_header *header = calloc(1, NVRAM_SPACE);
+            if (header && _nvram_generate(header, 1) == 0) {
+                ret = _nvram_set(name, enc, 0);
+            }
+            free(header);
+        }
+    }
+    pthread_mutex_unlock(&nvram_lock);
+
+    free(enc);
+    return ret;
+}
+
+struct foreach_ctx {
+    int (*fn)(const char *name, unsigned int flags, void *arg);
+    void *arg;
+};
+
+static int foreach_tuple(struct nvram_tuple *t, void *arg) {
+    struct foreach_ctx *ctx = arg;
+    unsigned int flags = 0;
+
+    if (t->flag & ATTR_LOCK) flags |= NVRAM_STORE_LOCKED;
+    if (t->val_tmp) flags |= NVRAM_STORE_TEMP;
+    return ctx->fn(t->name, flags, ctx->arg);
+}
+
+int nvram_store_foreach(int (*fn)(const char *name, unsigned int flags, void *arg), void *arg) {
+    struct foreach_ctx ctx = { fn, arg };
+    int ret = -1;
+
+    pthread_mutex_lock(&nvram_lock);
+    if (flash.fd != -1) ret = _nvram_foreach(foreach_tuple, &ctx);
+    pthread_mutex_unlock(&nvram_lock);
+    return ret;
+}
+
+int nvram_store_commit(void) {
+    struct nvram_header *header = calloc(1, NVRAM_SPACE);
+    int ret = -1;
+
+    if (header == NULL) return -1;
+
+    pthread_mutex_lock(&nvram_lock);
+    if (flash.fd != -1 && _nvram_generate(header, 0) == 0) {
+        ret = write_bank(header);
+    }
+    pthread_mutex_unlock(&nvram_lock);
+
+    free(header);
+    return ret;
+}
@@ -0,0 +1,43 @@
+#ifndef NVRAM_STORE_H
+#define NVRAM_STORE_H
+
+#include <stddef.h>
+
+// Longest value that fits NVRAM_MAX_VALUE_LEN once padded, encrypted and
+// base64 encoded (192 bytes of ciphertext encode to 256)
+#define NVRAM_STORE_VALUE_MAX 191
+
+// NVRAM access for httpd on top of common/nvram_core.c.
+//
+// The partition holds two banks of NVRAM_MTD_SIZE bytes; a commit always
+// writes the bank not currently in use with the next write counter, so an
+// interrupted write leaves the previous bank intact (same layout as
+// gen_nvram_zone/file_flash.c). Values are stored AES-128 encrypted and
+// base64 encoded.
+//
+// nvram_core.c is not thread-safe; every function here takes the store lock.
+
+// Open the NVRAM partition. path is an MTD character device or an image
+// file (created if missing); NULL looks up the "factory" partition in
+// /proc/mtd. Returns 0 on success.
+int nvram_store_init(const char *path);
+
+// Decoded value of name. Returns 1 if found, 0 if not set, -1 on error.
+int nvram_store_get(const char *name, char *value, size_t len);
+
+// Set name in memory; nothing is written until nvram_store_commit()
+int nvram_store_set(const char *name, const char *value);
+
+// Flags passed to nvram_store_foreach()
+#define NVRAM_STORE_LOCKED 0x1      // ATTR_LOCK: cannot be changed
+#define NVRAM_STORE_TEMP 0x2        // kept in memory, never committed
+
+// Call fn for every variable, in hash order, until it returns non-zero;
+// returns that value, or -1 if the store is not open. The store lock is
+// held, fn must not call back into the store.
+int nvram_store_foreach(int (*fn)(const char *name, unsigned int flags, void *arg), void *arg);
+
+// Write all values to the next bank. Returns 0 on success.
+int nvram_store_commit(void);
+
+#endif // NVRAM_STORE_H
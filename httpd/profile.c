@@ -0,0 +1,215 @@
+#include "handlers.h"
+#include "compress.h"
+#include "profiler.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#define DEFAULT_SECONDS 10
+#define MAX_SECONDS 60
+#define DEFAULT_HZ 99           // off the 100 Hz of periodic work
+#define MAX_HZ 1000
+#define SAMPLES_PER_TICK 2      // room for two busy threads per tick
+
+// One profile request. Its connection is suspended while the profile
+// thread sleeps through the sampling period; once the folded stacks are
+// written the thread resumes it and the handler runs again to send them.
+struct profile {
+    struct request_state state;
+    struct MHD_Connection *connection;
+    unsigned int seconds;
+    char *text;                     // folded stacks
+    size_t len;
+    struct profiler_stats stats;
+    bool failed;
+    bool done;                      // under profile_lock
+    bool released;                  // request gone before done, under profile_lock
+};
+
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool enabled = false;
+static bool busy = false;           // one profile at a time
+
+void profile_init(bool enable) {
+    enabled = enable;
+}
+
+static void profile_free(struct profile *p) {
+    free(p->text);
+    free(p);
+}
+
+static void *profile_thread(void *arg) {
+    struct profile *p = arg;
+    struct timespec left = { (time_t)p->seconds, 0 };
+
+    // SIGPROF lands in busy threads, but this one may catch it too
+    while (nanosleep(&left, &left) != 0 && errno == EINTR) {
+    }
+    profiler_stop();
+
+    FILE *out = open_memstream(&p->text, &p->len);
+    if (out == NULL) {
+        p->failed = true;
+    } else {
+        if (profiler_write_folded(out, &p->stats) != 0) p->failed = true;
+        if (fclose(out) != 0 || p->text == NULL) p->failed = true;
+    }
+
+    pthread_mutex_lock(&profile_lock);
+    busy = false;
+    p->done = true;
+    if (p->released) {
+        pthread_mutex_unlock(&profile_lock);
+        profile_free(p);
+        return NULL;
+    }
+    MHD_resume_connection(p->connection);
+    pthread_mutex_unlock(&profile_lock);
+    return NULL;
+}
+
+static void profile_release(struct request_state *state, bool completed) {
+    struct profile *p = (struct profile *)state;
+    (void)completed;
+
+    pthread_mutex_lock(&profile_lock);
+    if (!p->done) {
+        // The profile thread frees it when it is finished
+        p->released = true;
+        pthread_mutex_unlock(&profile_lock);
+        return;
+    }
+    pthread_mutex_unlock(&profile_lock);
+    profile_free(p);
+}
+
+static bool parse_arg(struct MHD_Connection *connection, const struct request *request,
+                      const char *name, unsigned int def, unsigned int max, unsigned int *out) {
+    const char *value = request_arg(connection, request, name);
+    char *end;
+
+    if (value == NULL) {
+        *out = def;
+        return true;
+    }
+    unsigned long n = strtoul(value, &end, 10);
+    if (end == value || *end != '\0' || n == 0 || n > max) return false;
+    *out = (unsigned int)n;
+    return true;
+}
+
+// First call: start the profiler and park the connection
+static enum MHD_Result profile_start(struct MHD_Connection *connection, const struct request *request) {
+    unsigned int seconds, hz;
+    pthread_t thread;
+
+    if (!enabled) {
+        return send_error_response(connection, request->method, request->url,
+            "Profiler is disabled", MHD_HTTP_FORBIDDEN);
+    }
+    // It costs CPU and shows httpd's internals: behind -u when that is set
+    if (credentials_configured() && !credentials_check(connection)) {
+        return send_unauthorized(connection, request);
+    }
+    if (!parse_arg(connection, request, "seconds", DEFAULT_SECONDS, MAX_SECONDS, &seconds) ||
+        !parse_arg(connection, request, "hz", DEFAULT_HZ, MAX_HZ, &hz)) {
+        return send_error_response(connection, request->method, request->url,
+            "Expected seconds=1-60 and hz=1-1000", MHD_HTTP_BAD_REQUEST);
+    }
+
+    struct profile *p = calloc(1, sizeof(*p));
+    if (p == NULL) {
+        return send_error_response(connection, request->method, request->url,
+            "Out of memory", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+    p->state.release = profile_release;
+    p->connection = connection;
+    p->seconds = seconds;
+
+    pthread_mutex_lock(&profile_lock);
+    if (busy) {
+        pthread_mutex_unlock(&profile_lock);
+        free(p);
+        return send_error_response(connection, request->method, request->url,
+            "A profile is already running", MHD_HTTP_CONFLICT);
+    }
+    busy = true;
+    pthread_mutex_unlock(&profile_lock);
+
+    if (profiler_start(hz, (size_t)seconds * hz * SAMPLES_PER_TICK) != 0) {
+        pthread_mutex_lock(&profile_lock);
+        busy = false;
+        pthread_mutex_unlock(&profile_lock);
+        free(p);
+        return send_error_response(connection, request->method, request->url,
+            "Failed to start the profiler", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+
+    // Suspend before the thread can resume
+    *request->con_cls = p;
+    MHD_suspend_connection(connection);
+    if (pthread_create(&thread, NULL, profile_thread, p) != 0) {
+        profiler_stop();
+        profiler_write_folded(NULL, NULL);
+        pthread_mutex_lock(&profile_lock);
+        busy = false;
+        p->failed = true;
+        p->done = true;
+        pthread_mutex_unlock(&profile_lock);
+        MHD_resume_connection(connection);
+        return MHD_YES;
+    }
+    pthread_detach(thread);
+    return MHD_YES;
+}
+
+// GET /api/debug/profile?seconds=10&hz=99
+//
+// Samples the CPU time of every httpd thread for seconds and answers with
+// folded stacks ("thread;outer;...;leaf count" lines) for flamegraph.pl.
+// Only one profile runs at a time, and only with -x.
+enum MHD_Result handle_debug_profile(struct MHD_Connection *connection, const struct request *request) {
+    struct profile *p = *request->con_cls;
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+    char value[24];
+    size_t len;
+
+    if (p == NULL) return profile_start(connection, request);
+
+    pthread_mutex_lock(&profile_lock);
+    bool done = p->done;
+    pthread_mutex_unlock(&profile_lock);
+    if (!done) return MHD_YES;
+
+    if (p->failed) {
+        return send_error_response(connection, request->method, request->url,
+            "Profile failed", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+
+    len = p->len;
+    response = compress_response(connection, p->text, len, &len);
+    if (response == NULL) {
+        response = MHD_create_response_from_buffer(len, p->text, MHD_RESPMEM_MUST_COPY);
+    }
+    if (response == NULL) return MHD_NO;
+
+    MHD_add_response_header(response, "Content-Type", "text/plain; charset=utf-8");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-store");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_VARY, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+    snprintf(value, sizeof(value), "%zu", p->stats.samples);
+    MHD_add_response_header(response, "X-Profile-Samples", value);
+    snprintf(value, sizeof(value), "%zu", p->stats.dropped);
+    MHD_add_response_header(response, "X-Profile-Dropped", value);
+
+    ret = queue_response(connection, MHD_HTTP_OK, response, len);
+    MHD_destroy_response(response);
+
+    log_request(connection, request->method, request->url, MHD_HTTP_OK);
+    return ret;
+}
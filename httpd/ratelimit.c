@@ -0,0 +1,213 @@
+#include "ratelimit.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+// Clients tracked at once. A client pushed out by newer ones starts again
+// with full buckets, which only matters when more than this many hammer
+// httpd at the same time, and then the global buckets still hold.
+#define CLIENT_SLOTS 128
+#define CLIENT_PROBES 8
+
+// Tokens are kept in thousandths so slow rates refill smoothly
+#define TOKEN 1000
+
+struct bucket {
+    uint32_t tokens;
+    uint32_t updated;       // ms
+};
+
+struct client {
+    uint8_t addr[16];       // IPv4 as a v4-mapped IPv6 address
+    bool used;
+    uint32_t seen;          // ms
+    struct bucket buckets[RATE_CLASS_COUNT];
+};
+
+static const char *const class_names[RATE_CLASS_COUNT] = {
+    [RATE_STATIC] = "static",
+    [RATE_READ] = "read",
+    [RATE_WRITE] = "write",
+};
+
+static pthread_mutex_t limiter_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rate_limit limits[RATE_SCOPE_COUNT][RATE_CLASS_COUNT];
+static struct bucket global[RATE_CLASS_COUNT];                  // under limiter_lock
+static struct client clients[CLIENT_SLOTS];                     // under limiter_lock
+static uint64_t rejected_count[RATE_SCOPE_COUNT][RATE_CLASS_COUNT];  // under limiter_lock
+
+// Wraps after 49 days; only differences are used
+static uint32_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000);
+}
+
+const char *ratelimit_class_name(enum rate_class cls) {
+    return class_names[cls];
+}
+
+bool ratelimit_parse(const char *spec, struct rate_limit out[RATE_CLASS_COUNT]) {
+    if (strcmp(spec, "off") == 0) {
+        memset(out, 0, RATE_CLASS_COUNT * sizeof(out[0]));
+        return true;
+    }
+
+    const char *p = spec;
+    while (*p) {
+        size_t name_len = strcspn(p, "=");
+        int cls;
+
+        for (cls = 0; cls < RATE_CLASS_COUNT; cls++) {
+            if (strlen(class_names[cls]) == name_len && strncmp(p, class_names[cls], name_len) == 0) break;
+        }
+        if (cls == RATE_CLASS_COUNT || p[name_len] != '=') return false;
+        p += name_len + 1;
+
+        char *end;
+        errno = 0;
+        unsigned long rate = strtoul(p, &end, 10);
+        if (errno != 0 || end == p || *end != '/' || rate > 100000) return false;
+        p = end + 1;
+        unsigned long burst = strtoul(p, &end, 10);
+        if (errno != 0 || end == p || burst > 100000 || (rate > 0 && burst == 0)) return false;
+        p = end;
+
+        out[cls].rate = (unsigned int)rate;
+        out[cls].burst = (unsigned int)burst;
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ratelimit_init(const struct rate_limit per_ip[RATE_CLASS_COUNT],
+                    const struct rate_limit global_limits[RATE_CLASS_COUNT]) {
+    uint32_t now = now_ms();
+
+    memcpy(limits[RATE_SCOPE_IP], per_ip, sizeof(limits[RATE_SCOPE_IP]));
+    memcpy(limits[RATE_SCOPE_GLOBAL], global_limits, sizeof(limits[RATE_SCOPE_GLOBAL]));
+    for (int cls = 0; cls < RATE_CLASS_COUNT; cls++) {
+        global[cls].tokens = limits[RATE_SCOPE_GLOBAL][cls].burst * TOKEN;
+        global[cls].updated = now;
+    }
+}
+
+// Refill b and report whether it holds a whole token
+static bool refill(struct bucket *b, const struct rate_limit *limit, uint32_t now) {
+    if (limit->rate == 0) return true;
+
+    uint64_t tokens = b->tokens + (uint64_t)(now - b->updated) * limit->rate;
+    uint64_t full = (uint64_t)limit->burst * TOKEN;
+    b->tokens = (uint32_t)(tokens < full ? tokens : full);
+    b->updated = now;
+    return b->tokens >= TOKEN;
+}
+
+static void take(struct bucket *b, const struct rate_limit *limit) {
+    if (limit->rate > 0) b->tokens -= TOKEN;
+}
+
+// Whole seconds until b holds a token again, at least 1
+static unsigned int wait_seconds(const struct bucket *b, const struct rate_limit *limit) {
+    uint32_t missing = TOKEN - b->tokens;
+    uint32_t ms = (missing + limit->rate - 1) / limit->rate;
+    return ms > 1000 ? (ms + 999) / 1000 : 1;
+}
+
+static bool client_address(struct MHD_Connection *connection, uint8_t addr[16]) {
+    const union MHD_ConnectionInfo *info =
+        MHD_get_connection_info(connection, MHD_CONNECTION_INFO_CLIENT_ADDRESS);
+
+    if (info == NULL || info->client_addr == NULL) return false;
+
+    const struct sockaddr *sa = (const struct sockaddr *)info->client_addr;
+    if (sa->sa_family == AF_INET) {
+        memset(addr, 0, 10);
+        addr[10] = addr[11] = 0xff;
+        memcpy(addr + 12, &((const struct sockaddr_in *)sa)->sin_addr, 4);
+        return true;
+    }
+    if (sa->sa_family == AF_INET6) {
+        memcpy(addr, &((const struct sockaddr_in6 *)sa)->sin6_addr, 16);
+        return true;
+    }
+    return false;
+}
+
+static uint32_t hash_address(const uint8_t addr[16]) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 16; i++) h = (h ^ addr[i]) * 16777619u;
+    return h;
+}
+
+// Slot of addr, taking over a free or the least recently seen one of its
+// probe sequence if it is not tracked yet
+static struct client *find_client(const uint8_t addr[16], uint32_t now) {
+    uint32_t h = hash_address(addr);
+    struct client *victim = NULL;
+
+    for (int i = 0; i < CLIENT_PROBES; i++) {
+        struct client *c = &clients[(h + (uint32_t)i) % CLIENT_SLOTS];
+        if (c->used && memcmp(c->addr, addr, 16) == 0) return c;
+        if (!c->used) {
+            if (victim == NULL || victim->used) victim = c;
+        } else if (victim == NULL || (victim->used && now - c->seen > now - victim->seen)) {
+            victim = c;
+        }
+    }
+
+    memcpy(victim->addr, addr, 16);
+    victim->used = true;
+    for (int cls = 0; cls < RATE_CLASS_COUNT; cls++) {
+        victim->buckets[cls].tokens = limits[RATE_SCOPE_IP][cls].burst * TOKEN;
+        victim->buckets[cls].updated = now;
+    }
+    return victim;
+}
+
+bool ratelimit_admit(struct MHD_Connection *connection, enum rate_class cls,
+                     unsigned int *retry_after) {
+    const struct rate_limit *ip_limit = &limits[RATE_SCOPE_IP][cls];
+    const struct rate_limit *global_limit = &limits[RATE_SCOPE_GLOBAL][cls];
+    struct client *c = NULL;
+    uint8_t addr[16];
+    bool admitted = false;
+
+    if (ip_limit->rate == 0 && global_limit->rate == 0) return true;
+
+    bool have_addr = ip_limit->rate > 0 && client_address(connection, addr);
+    uint32_t now = now_ms();
+
+    pthread_mutex_lock(&limiter_lock);
+    if (have_addr) {
+        c = find_client(addr, now);
+        c->seen = now;
+    }
+
+    if (c && !refill(&c->buckets[cls], ip_limit, now)) {
+        rejected_count[RATE_SCOPE_IP][cls]++;
+        *retry_after = wait_seconds(&c->buckets[cls], ip_limit);
+    } else if (!refill(&global[cls], global_limit, now)) {
+        rejected_count[RATE_SCOPE_GLOBAL][cls]++;
+        *retry_after = wait_seconds(&global[cls], global_limit);
+    } else {
+        if (c) take(&c->buckets[cls], ip_limit);
+        take(&global[cls], global_limit);
+        admitted = true;
+    }
+    pthread_mutex_unlock(&limiter_lock);
+    return admitted;
+}
+
+void ratelimit_rejected(uint64_t rejected[RATE_SCOPE_COUNT][RATE_CLASS_COUNT]) {
+    pthread_mutex_lock(&limiter_lock);
+    memcpy(rejected, rejected_count, sizeof(rejected_count));
+    pthread_mutex_unlock(&limiter_lock);
+}
@@ -0,0 +1,49 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <microhttpd.h>
+
+// Admission control. Every request takes a token from the bucket of its
+// class for the client IP and from the global bucket of that class before
+// any handler runs; a request that finds either empty is answered 429 right
+// away. Buckets refill continuously at rate tokens per second up to burst.
+
+enum rate_class {
+    RATE_STATIC,        // web UI files
+    RATE_READ,          // API GET/HEAD
+    RATE_WRITE,         // API POST/PUT/PATCH/DELETE
+    RATE_CLASS_COUNT,
+};
+
+enum rate_scope {
+    RATE_SCOPE_IP,
+    RATE_SCOPE_GLOBAL,
+    RATE_SCOPE_COUNT,
+};
+
+struct rate_limit {
+    unsigned int rate;      // requests per second, 0: unlimited
+    unsigned int burst;
+};
+
+// Parse "static=20/60,read=10/30,write=2/10" into limits, changing only the
+// classes named; "off" makes every class unlimited
+bool ratelimit_parse(const char *spec, struct rate_limit limits[RATE_CLASS_COUNT]);
+
+void ratelimit_init(const struct rate_limit per_ip[RATE_CLASS_COUNT],
+                    const struct rate_limit global[RATE_CLASS_COUNT]);
+
+// Take a token for a request of class cls. Returns false if the client or
+// the server is over the limit, with the seconds until a token is available
+// in *retry_after.
+bool ratelimit_admit(struct MHD_Connection *connection, enum rate_class cls,
+                     unsigned int *retry_after);
+
+const char *ratelimit_class_name(enum rate_class cls);
+
+// Requests rejected so far, by scope and class
+void ratelimit_rejected(uint64_t rejected[RATE_SCOPE_COUNT][RATE_CLASS_COUNT]);
+
+#endif // RATELIMIT_H
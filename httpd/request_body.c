@@ -0,0 +1,121 @@
+#include "request_body.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#define MAX_DEPTH 16
+
+struct request_body {
+    struct request_state state;
+    struct json_tokener *tok;
+    struct json_object *root;
+    size_t size;
+    size_t limit;
+    enum body_status status;
+};
+
+static void body_release(struct request_state *state, bool completed) {
+    struct request_body *body = (struct request_body *)state;
+
+    json_object_put(body->root);
+    if (body->tok) json_tokener_free(body->tok);
+    free(body);
+}
+
+static bool only_whitespace(const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] != ' ' && data[i] != '\t' && data[i] != '\r' && data[i] != '\n') return false;
+    }
+    return true;
+}
+
+static void body_fail(struct request_body *body, enum body_status status) {
+    body->status = status;
+    json_object_put(body->root);
+    body->root = NULL;
+    json_tokener_free(body->tok);
+    body->tok = NULL;
+}
+
+static void body_feed(struct request_body *body, const char *data, size_t len) {
+    body->size += len;
+    if (body->size > body->limit) {
+        body_fail(body, BODY_TOO_LARGE);
+        return;
+    }
+
+    // Only trailing whitespace may follow the document
+    if (body->root) {
+        if (!only_whitespace(data, len)) body_fail(body, BODY_INVALID);
+        return;
+    }
+
+    body->root = json_tokener_parse_ex(body->tok, data, (int)len);
+    enum json_tokener_error err = json_tokener_get_error(body->tok);
+    if (err == json_tokener_success) {
+        size_t end = json_tokener_get_parse_end(body->tok);
+        if (!only_whitespace(data + end, len - end)) body_fail(body, BODY_INVALID);
+    } else if (err != json_tokener_continue) {
+        body_fail(body, BODY_INVALID);
+    }
+}
+
+static enum body_status body_finish(struct request_body *body, struct json_object **root) {
+    if (body->status != BODY_PENDING) return body->status;
+    if (body->size == 0) return BODY_EMPTY;
+
+    if (body->root == NULL) {
+        // A top-level number is only complete once the input ends
+        body->root = json_tokener_parse_ex(body->tok, "", 1);
+        if (body->root == NULL) return BODY_INVALID;
+    }
+
+    *root = body->root;
+    body->root = NULL;
+    return BODY_READY;
+}
+
+enum body_status request_body_read(struct MHD_Connection *connection,
+                                   const struct request *request,
+                                   struct json_object **root) {
+    struct request_body *body = *request->con_cls;
+
+    *root = NULL;
+
+    if (body == NULL) {
+        // First call, only the headers are known
+        const char *length = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+                                                         MHD_HTTP_HEADER_CONTENT_LENGTH);
+        if (length && strtoull(length, NULL, 10) > request->max_body) return BODY_TOO_LARGE;
+
+        body = calloc(1, sizeof(*body));
+        if (body == NULL) return BODY_INVALID;
+        body->tok = json_tokener_new_ex(MAX_DEPTH);
+        if (body->tok == NULL) {
+            free(body);
+            return BODY_INVALID;
+        }
+        body->state.release = body_release;
+        body->limit = request->max_body;
+        body->status = BODY_PENDING;
+        *request->con_cls = body;
+        return BODY_PENDING;
+    }
+
+    if (*request->upload_data_size > 0) {
+        // After an error the rest of the body is read and dropped
+        const char *upload_data = request->upload_data;
+        size_t len = *request->upload_data_size;
+        while (body->status == BODY_PENDING && len > 0) {
+            size_t n = len > INT_MAX ? INT_MAX : len;
+            body_feed(body, upload_data, n);
+            upload_data += n;
+            len -= n;
+        }
+        *request->upload_data_size = 0;
+        return BODY_PENDING;
+    }
+
+    return body_finish(body, root);
+}
@@ -0,0 +1,33 @@
+#ifndef REQUEST_BODY_H
+#define REQUEST_BODY_H
+
+#include <stddef.h>
+#include <microhttpd.h>
+#include <json-c/json.h>
+#include "routes.h"
+
+// JSON request bodies for PATCH/POST handlers.
+//
+// Each upload chunk MHD hands to the access handler is fed straight into an
+// incremental json_tokener, so a body split across several callbacks is
+// parsed in one pass and never buffered as a whole. The parser is kept as
+// the request state and freed by routes_completed().
+
+enum body_status {
+    BODY_PENDING,       // more data to come, return MHD_YES
+    BODY_READY,         // *root holds the parsed document
+    BODY_EMPTY,         // the request had no body
+    BODY_TOO_LARGE,     // over the limit, reply 413
+    BODY_INVALID,       // not JSON, reply 400
+};
+
+// Process one access handler call. Once a final status is returned, the
+// caller owns *root (BODY_READY only) and queues its response.
+// The limit is request->max_body: a Content-Length over it is rejected on
+// the first call, before any data is read; a chunked body is rejected as
+// soon as it crosses the limit and the rest of it is discarded.
+enum body_status request_body_read(struct MHD_Connection *connection,
+                                   const struct request *request,
+                                   struct json_object **root);
+
+#endif // REQUEST_BODY_H
@@ -0,0 +1,81 @@
+#include "respool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+static char *pool = NULL;
+static size_t buffer_size = 0;
+static unsigned int buffer_count = 0;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int *free_list = NULL;      // indexes of free buffers, under pool_lock
+static unsigned int free_count = 0;         // under pool_lock
+static uint64_t misses = 0;                 // under pool_lock
+
+int respool_init(unsigned int count, size_t size) {
+    if (count == 0 || size == 0) return 0;
+
+    pool = malloc((size_t)count * size);
+    free_list = malloc(count * sizeof(*free_list));
+    if (pool == NULL || free_list == NULL) {
+        free(pool);
+        free(free_list);
+        pool = NULL;
+        free_list = NULL;
+        return -1;
+    }
+
+    // Touch every page now so the pool is part of RSS from the start
+    memset(pool, 0, (size_t)count * size);
+
+    for (unsigned int i = 0; i < count; i++) {
+        free_list[i] = count - 1 - i;
+    }
+    free_count = count;
+    buffer_count = count;
+    buffer_size = size;
+    return 0;
+}
+
+size_t respool_size(void) {
+    return buffer_size;
+}
+
+void *respool_get(void) {
+    void *buf = NULL;
+
+    if (buffer_count == 0) return NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    if (free_count > 0) {
+        buf = pool + (size_t)free_list[--free_count] * buffer_size;
+    } else {
+        misses++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return buf;
+}
+
+bool respool_owns(const void *buf) {
+    const char *p = buf;
+    return p >= pool && p < pool + (size_t)buffer_count * buffer_size;
+}
+
+void respool_free(void *buf) {
+    if (!respool_owns(buf)) {
+        free(buf);
+        return;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    free_list[free_count++] = (unsigned int)(((char *)buf - pool) / buffer_size);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void respool_stats(struct respool_stats *stats) {
+    pthread_mutex_lock(&pool_lock);
+    stats->count = buffer_count;
+    stats->in_use = buffer_count - free_count;
+    stats->misses = misses;
+    pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,35 @@
+#ifndef RESPOOL_H
+#define RESPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed set of response buffers allocated and faulted in at startup, so
+// building JSON responses reuses the same resident pages instead of growing
+// the heap with every burst of requests. JSON writers started with
+// jw_init_pooled() take one when the hint fits; MHD hands it back once the
+// response has been sent.
+
+int respool_init(unsigned int count, size_t size);
+
+// Size of every buffer, 0 if the pool is disabled
+size_t respool_size(void);
+
+// A free buffer, or NULL when all are in use or the pool is disabled
+void *respool_get(void);
+
+bool respool_owns(const void *buf);
+
+// Return buf to the pool, or free() it if it did not come from there
+void respool_free(void *buf);
+
+struct respool_stats {
+    unsigned int count;
+    unsigned int in_use;
+    uint64_t misses;        // respool_get() calls that found no free buffer
+};
+
+void respool_stats(struct respool_stats *stats);
+
+#endif // RESPOOL_H
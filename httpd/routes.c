@@ -0,0 +1,291 @@
+#include "routes.h"
+#include "handlers.h"
+#include "compress.h"
+#include "metrics.h"
+#include "mph.h"
+#include "ratelimit.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// A path of the table with its handler per method
+struct route_path {
+    const char *path;
+    const struct route *methods[HTTP_METHOD_COUNT];
+    char allow[64];                 // value of the Allow header
+    unsigned int metrics_id;
+};
+
+static const char *const method_names[HTTP_METHOD_COUNT] = {
+    [HTTP_GET] = "GET",
+    [HTTP_HEAD] = "HEAD",
+    [HTTP_POST] = "POST",
+    [HTTP_PUT] = "PUT",
+    [HTTP_PATCH] = "PATCH",
+    [HTTP_DELETE] = "DELETE",
+    [HTTP_OPTIONS] = "OPTIONS",
+};
+
+static struct route_path *paths = NULL;     // indexed by mph_lookup()
+static size_t path_count = 0;
+static uint32_t *seeds = NULL;
+static size_t default_max_body = 0;
+static route_handler static_handler = NULL;
+static unsigned int static_metrics_id = 0;
+static unsigned int unknown_metrics_id = 0;
+
+static enum http_method parse_method(const char *method) {
+    switch (method[0]) {
+    case 'G':
+        if (strcmp(method, "GET") == 0) return HTTP_GET;
+        break;
+    case 'H':
+        if (strcmp(method, "HEAD") == 0) return HTTP_HEAD;
+        break;
+    case 'P':
+        if (strcmp(method, "POST") == 0) return HTTP_POST;
+        if (strcmp(method, "PUT") == 0) return HTTP_PUT;
+        if (strcmp(method, "PATCH") == 0) return HTTP_PATCH;
+        break;
+    case 'D':
+        if (strcmp(method, "DELETE") == 0) return HTTP_DELETE;
+        break;
+    case 'O':
+        if (strcmp(method, "OPTIONS") == 0) return HTTP_OPTIONS;
+        break;
+    }
+    return HTTP_OTHER;
+}
+
+// Handler of method on path; HEAD falls back to GET, MHD drops the body
+static const struct route *path_method(const struct route_path *p, enum http_method method) {
+    if (method == HTTP_OTHER) return NULL;
+    if (method == HTTP_HEAD && p->methods[HTTP_HEAD] == NULL) return p->methods[HTTP_GET];
+    return p->methods[method];
+}
+
+static void build_allow(struct route_path *p) {
+    size_t len = 0;
+
+    for (int m = 0; m < HTTP_METHOD_COUNT; m++) {
+        // OPTIONS is always answered, see route()
+        if (m != HTTP_OPTIONS && path_method(p, (enum http_method)m) == NULL) continue;
+        len += (size_t)snprintf(p->allow + len, sizeof(p->allow) - len, "%s%s",
+                                len ? ", " : "", method_names[m]);
+        if (len >= sizeof(p->allow)) break;
+    }
+}
+
+int routes_init(const struct route *table, size_t count, size_t max_body,
+                route_handler fallback) {
+    const char **keys = malloc((count ? count : 1) * sizeof(*keys));
+    uint32_t *slots = malloc((count ? count : 1) * sizeof(*slots));
+    struct route_path *unique = calloc(count ? count : 1, sizeof(*unique));
+    int ret = -1;
+
+    if (!keys || !slots || !unique) goto out;
+
+    default_max_body = max_body;
+    static_handler = fallback;
+
+    // Group the table by path
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        const struct route *r = &table[i];
+        size_t j;
+
+        if (r->method >= HTTP_METHOD_COUNT) {
+            fprintf(stderr, "routes: bad method for %s\n", r->path);
+            goto out;
+        }
+        for (j = 0; j < n && strcmp(unique[j].path, r->path) != 0; j++) {
+        }
+        if (j == n) {
+            unique[n].path = r->path;
+            keys[n] = r->path;
+            n++;
+        }
+        if (unique[j].methods[r->method]) {
+            fprintf(stderr, "routes: %s %s registered twice\n", method_names[r->method], r->path);
+            goto out;
+        }
+        unique[j].methods[r->method] = r;
+    }
+
+    seeds = calloc(mph_bucket_count(n), sizeof(*seeds));
+    paths = calloc(n ? n : 1, sizeof(*paths));
+    if (!seeds || !paths || mph_build(keys, n, seeds, slots) != 0) goto out;
+
+    for (size_t i = 0; i < n; i++) {
+        struct route_path *p = &paths[slots[i]];
+        *p = unique[i];
+        build_allow(p);
+        p->metrics_id = metrics_add_route(p->path);
+    }
+    path_count = n;
+
+    unknown_metrics_id = metrics_add_route("other_api");
+    static_metrics_id = metrics_add_route("static");
+    ret = 0;
+
+out:
+    free(keys);
+    free(slots);
+    free(unique);
+    return ret;
+}
+
+static const struct route_path *lookup(const char *url) {
+    if (path_count == 0) return NULL;
+
+    const struct route_path *p = &paths[mph_lookup(seeds, path_count, url, strlen(url))];
+    return strcmp(p->path, url) == 0 ? p : NULL;
+}
+
+const struct route *routes_find(enum http_method method, const char *path) {
+    const struct route_path *p = lookup(path);
+    return p ? path_method(p, method) : NULL;
+}
+
+const char *request_arg(struct MHD_Connection *connection, const struct request *request,
+                        const char *name) {
+    if (request->args == NULL) {
+        return MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, name);
+    }
+    for (size_t i = 0; i < request->args->count; i++) {
+        if (strcmp(request->args->names[i], name) == 0) return request->args->values[i];
+    }
+    return NULL;
+}
+
+static enum MHD_Result send_with_allow(struct MHD_Connection *connection, const char *method,
+                                       const char *url, const char *allow, unsigned int status_code) {
+    static const char message[] = "Method not allowed";
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+    size_t len = status_code == MHD_HTTP_METHOD_NOT_ALLOWED ? sizeof(message) - 1 : 0;
+
+    response = MHD_create_response_from_buffer(len, (void *)message, MHD_RESPMEM_PERSISTENT);
+    if (response == NULL) return MHD_NO;
+
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ALLOW, allow);
+    if (status_code != MHD_HTTP_METHOD_NOT_ALLOWED) {
+        // CORS preflight
+        MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+        MHD_add_response_header(response, "Access-Control-Allow-Methods", allow);
+        MHD_add_response_header(response, "Access-Control-Allow-Headers", "Content-Type");
+    }
+    ret = queue_response(connection, status_code, response, len);
+    MHD_destroy_response(response);
+
+    log_request(connection, method, url, status_code);
+    return ret;
+}
+
+static enum MHD_Result send_rate_limited(struct MHD_Connection *connection, const struct request *request,
+                                         unsigned int retry_after) {
+    static const char message[] = "Too many requests";
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+    char seconds[16];
+
+    response = MHD_create_response_from_buffer(sizeof(message) - 1, (void *)message, MHD_RESPMEM_PERSISTENT);
+    if (response == NULL) return MHD_NO;
+
+    snprintf(seconds, sizeof(seconds), "%u", retry_after);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_RETRY_AFTER, seconds);
+    ret = queue_response(connection, MHD_HTTP_TOO_MANY_REQUESTS, response, sizeof(message) - 1);
+    MHD_destroy_response(response);
+
+    log_request(connection, request->method, request->url, MHD_HTTP_TOO_MANY_REQUESTS);
+    return ret;
+}
+
+// Admission control on the first call of a request, before any handler
+// work; later calls only carry its body
+static bool admit(struct MHD_Connection *connection, const struct request *request,
+                  enum rate_class cls, unsigned int *retry_after) {
+    if (*request->con_cls != NULL || *request->upload_data_size != 0) return true;
+    return ratelimit_admit(connection, cls, retry_after);
+}
+
+static enum MHD_Result route(struct MHD_Connection *connection, struct request *request) {
+    unsigned int retry_after;
+    enum http_method method = parse_method(request->method);
+    const struct route_path *p = lookup(request->url);
+
+    compress_set_route_level(COMPRESS_NEVER);
+    if (p == NULL) {
+        if (strncmp(request->url, "/api/", 5) == 0) {
+            metrics_set_route(unknown_metrics_id);
+            return send_error_response(connection, request->method, request->url,
+                                       "API endpoint not found", MHD_HTTP_NOT_FOUND);
+        }
+
+        // The web UI, client-side routes included
+        metrics_set_route(static_metrics_id);
+        if (method != HTTP_GET && method != HTTP_HEAD) {
+            return send_with_allow(connection, request->method, request->url,
+                                   "GET, HEAD", MHD_HTTP_METHOD_NOT_ALLOWED);
+        }
+        if (!admit(connection, request, RATE_STATIC, &retry_after)) {
+            return send_rate_limited(connection, request, retry_after);
+        }
+        return static_handler(connection, request);
+    }
+
+    metrics_set_route(p->metrics_id);
+
+    const struct route *r = path_method(p, method);
+    if (r == NULL) {
+        if (method == HTTP_OPTIONS) {
+            return send_with_allow(connection, request->method, request->url, p->allow, MHD_HTTP_NO_CONTENT);
+        }
+        return send_with_allow(connection, request->method, request->url, p->allow,
+                               MHD_HTTP_METHOD_NOT_ALLOWED);
+    }
+
+    enum rate_class cls = method == HTTP_GET || method == HTTP_HEAD || r->read_only ? RATE_READ : RATE_WRITE;
+    if (!admit(connection, request, cls, &retry_after)) {
+        return send_rate_limited(connection, request, retry_after);
+    }
+
+    if (r->max_body) request->max_body = r->max_body;
+    compress_set_route_level(r->compress);
+
+    enum MHD_Result ret = r->handler(connection, request);
+    if (ret == MHD_NO) {
+        return send_error_response(connection, request->method, request->url,
+                                   "Internal server error", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+    return ret;
+}
+
+enum MHD_Result routes_dispatch(void *cls, struct MHD_Connection *connection,
+                                const char *url, const char *method,
+                                const char *version, const char *upload_data,
+                                size_t *upload_data_size, void **con_cls) {
+    struct request request = {
+        .url = url,
+        .method = method,
+        .upload_data = upload_data,
+        .upload_data_size = upload_data_size,
+        .con_cls = con_cls,
+        .max_body = default_max_body,
+    };
+    uint64_t start = metrics_begin();
+
+    enum MHD_Result ret = route(connection, &request);
+    metrics_end(start);
+    return ret;
+}
+
+void routes_completed(void *cls, struct MHD_Connection *connection,
+                      void **con_cls, enum MHD_RequestTerminationCode toe) {
+    struct request_state *state = *con_cls;
+
+    if (state == NULL) return;
+    *con_cls = NULL;
+    state->release(state, toe == MHD_REQUEST_TERMINATED_COMPLETED_OK);
+}
@@ -0,0 +1,91 @@
+#ifndef ROUTES_H
+#define ROUTES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <microhttpd.h>
+
+// Route registry for the access handler.
+//
+// The route table is declared once and indexed at startup with a minimal
+// perfect hash over the paths (mph.h), so dispatch is one hash, one string
+// compare and a method lookup however many endpoints there are. Methods a
+// path has no handler for get 405 with an Allow header, OPTIONS is answered
+// from the same information.
+
+enum http_method {
+    HTTP_GET,
+    HTTP_HEAD,
+    HTTP_POST,
+    HTTP_PUT,
+    HTTP_PATCH,
+    HTTP_DELETE,
+    HTTP_OPTIONS,
+    HTTP_METHOD_COUNT,
+    HTTP_OTHER = HTTP_METHOD_COUNT,
+};
+
+#define REQUEST_MAX_ARGS 16
+
+// Decoded query arguments of a sub-request run by /api/batch
+struct request_args {
+    size_t count;
+    const char *names[REQUEST_MAX_ARGS];
+    const char *values[REQUEST_MAX_ARGS];
+};
+
+// Arguments of one access handler call
+struct request {
+    const char *url;
+    const char *method;
+    const char *upload_data;
+    size_t *upload_data_size;
+    void **con_cls;
+    size_t max_body;                // body limit of the route in bytes
+    const struct request_args *args;    // NULL: the connection's query
+};
+
+// State a handler keeps in *request->con_cls between the calls of one
+// request starts with this header. release() runs once MHD is done with the
+// request; completed is false if it was aborted.
+struct request_state {
+    void (*release)(struct request_state *state, bool completed);
+};
+
+typedef enum MHD_Result (*route_handler)(struct MHD_Connection *connection,
+                                         const struct request *request);
+
+struct route {
+    enum http_method method;
+    const char *path;
+    route_handler handler;
+    size_t max_body;                // bytes, 0 for the -b default
+    bool batch;                     // GET may run inside /api/batch
+    bool read_only;                 // a POST that only reads, rate limited as a GET
+    int compress;                   // gzip/deflate level 1-9, -1 never, 0 for the -Z default
+};
+
+// Index the table; it must stay valid for the life of the process.
+// max_body is the limit of routes that do not set their own.
+// fallback serves GET/HEAD for paths outside /api/.
+int routes_init(const struct route *table, size_t count, size_t max_body,
+                route_handler fallback);
+
+// Route registered for method on path, NULL if none
+const struct route *routes_find(enum http_method method, const char *path);
+
+// Query argument name of the request, NULL if absent
+const char *request_arg(struct MHD_Connection *connection, const struct request *request,
+                        const char *name);
+
+// Access handler (MHD_AccessHandlerCallback)
+enum MHD_Result routes_dispatch(void *cls, struct MHD_Connection *connection,
+                                const char *url, const char *method,
+                                const char *version, const char *upload_data,
+                                size_t *upload_data_size, void **con_cls);
+
+// MHD_OPTION_NOTIFY_COMPLETED callback, releases the request state
+void routes_completed(void *cls, struct MHD_Connection *connection,
+                      void **con_cls, enum MHD_RequestTerminationCode toe);
+
+#endif // ROUTES_H
@@ -0,0 +1,440 @@
+#define _GNU_SOURCE
+#include "handlers.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+// Per-service monitor: CPU, memory, context switches and I/O of every
+// daemon with a pid file in /var/run (zigbeed, cpcd, socketbridge, httpd,
+// mdnsd, syslogd), sampled every few seconds into a short history.
+//
+// Like sysstats.c, the /proc files of each service stay open and are
+// re-read from offset 0; they are bound to the process, so once it exits
+// the reads fail and the service shows as stopped until its pid file names
+// a live process again. The pid files are rescanned every RESCAN_SAMPLES
+// samples. PSS comes from smaps_rollup (Linux 4.14+); older kernels only
+// get RSS from statm, since walking the full smaps every few seconds is
+// what this monitor must not cost.
+
+#define PID_DIR "/var/run"
+#define MAX_SERVICES 12
+#define HISTORY_SLOTS 120
+#define RESCAN_SAMPLES 6
+#define PROC_BUF_SIZE 1024
+#define NO_VALUE UINT32_MAX     // not running, or no previous sample for a rate
+
+enum service_series {
+    SVC_CPU,            // per mille of one CPU
+    SVC_RSS,            // KiB
+    SVC_PSS,            // KiB, shared pages split between their users
+    SVC_THREADS,
+    SVC_VCSW,           // voluntary context switches/s, all threads
+    SVC_IVCSW,          // involuntary (preempted) context switches/s
+    SVC_READ,           // bytes/s read through syscalls (rchar)
+    SVC_WRITE,          // bytes/s written (wchar)
+    SVC_SERIES_COUNT,
+};
+
+static const char *const series_names[SVC_SERIES_COUNT] = {
+    [SVC_CPU] = "cpu",
+    [SVC_RSS] = "rss",
+    [SVC_PSS] = "pss",
+    [SVC_THREADS] = "threads",
+    [SVC_VCSW] = "vcsw",
+    [SVC_IVCSW] = "ivcsw",
+    [SVC_READ] = "read",
+    [SVC_WRITE] = "write",
+};
+
+static const char *const series_units[SVC_SERIES_COUNT] = {
+    [SVC_CPU] = "permille",
+    [SVC_RSS] = "KiB",
+    [SVC_PSS] = "KiB",
+    [SVC_THREADS] = "count",
+    [SVC_VCSW] = "1/s",
+    [SVC_IVCSW] = "1/s",
+    [SVC_READ] = "B/s",
+    [SVC_WRITE] = "B/s",
+};
+
+struct counters {
+    unsigned long long cpu_ticks;
+    unsigned long long vcsw;
+    unsigned long long ivcsw;
+    unsigned long long rchar;
+    unsigned long long wchar;
+};
+
+struct service {
+    char name[32];                  // pid file name without .pid
+    pid_t pid;                      // 0 while not running
+    int stat_fd;
+    int io_fd;                      // -1 without I/O accounting
+    int mem_fd;                     // smaps_rollup, or statm if !rollup
+    bool rollup;
+    bool have_prev;
+    struct counters prev;
+};
+
+// Names and pids are written under history_lock, the rest is the sampler's
+static struct service services[MAX_SERVICES];
+static size_t service_count = 0;
+
+static pthread_mutex_t history_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t history_time[HISTORY_SLOTS];
+static uint32_t history[HISTORY_SLOTS][MAX_SERVICES][SVC_SERIES_COUNT];
+static unsigned int head = 0;       // slot written next
+static unsigned int count = 0;
+
+static unsigned int interval = 0;   // seconds, 0 while disabled
+static long clock_ticks = 100;
+static long page_kib = 4;
+
+static ssize_t read_proc(int fd, char *buf, size_t len) {
+    ssize_t n = pread(fd, buf, len - 1, 0);
+    if (n < 0) return -1;
+    buf[n] = '\0';
+    return n;
+}
+
+// Number after key ("Pss:", "rchar:") in a key/value /proc file
+static unsigned long long proc_value(const char *buf, const char *key) {
+    const char *p = strstr(buf, key);
+    if (p == NULL) return 0;
+    return strtoull(p + strlen(key), NULL, 10);
+}
+
+static void close_service(struct service *s) {
+    if (s->stat_fd != -1) close(s->stat_fd);
+    if (s->io_fd != -1) close(s->io_fd);
+    if (s->mem_fd != -1) close(s->mem_fd);
+    s->stat_fd = s->io_fd = s->mem_fd = -1;
+    s->have_prev = false;
+
+    pthread_mutex_lock(&history_lock);
+    s->pid = 0;
+    pthread_mutex_unlock(&history_lock);
+}
+
+static void open_service(struct service *s, pid_t pid) {
+    char path[64];
+
+    close_service(s);
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    s->stat_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (s->stat_fd == -1) return;       // stale pid file
+
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    s->io_fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", (int)pid);
+    s->mem_fd = open(path, O_RDONLY | O_CLOEXEC);
+    s->rollup = s->mem_fd != -1;
+    if (!s->rollup) {
+        snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+        s->mem_fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+
+    pthread_mutex_lock(&history_lock);
+    s->pid = pid;
+    pthread_mutex_unlock(&history_lock);
+}
+
+static struct service *find_service(const char *name) {
+    for (size_t i = 0; i < service_count; i++) {
+        if (strcmp(services[i].name, name) == 0) return &services[i];
+    }
+    if (service_count == MAX_SERVICES) return NULL;
+
+    struct service *s = &services[service_count];
+    s->stat_fd = s->io_fd = s->mem_fd = -1;
+    pthread_mutex_lock(&history_lock);
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    service_count++;
+    pthread_mutex_unlock(&history_lock);
+    return s;
+}
+
+// Pick up new services and restarted ones
+static void rescan(void) {
+    DIR *dir = opendir(PID_DIR);
+    struct dirent *entry;
+
+    if (dir == NULL) return;
+    while ((entry = readdir(dir)) != NULL) {
+        char name[32], path[320], buf[32];
+        size_t len = strlen(entry->d_name);
+
+        if (len <= 4 || len - 4 >= sizeof(name) || strcmp(entry->d_name + len - 4, ".pid") != 0) continue;
+        memcpy(name, entry->d_name, len - 4);
+        name[len - 4] = '\0';
+
+        snprintf(path, sizeof(path), PID_DIR "/%s", entry->d_name);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) continue;
+        ssize_t n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (n <= 0) continue;
+        buf[n] = '\0';
+
+        long pid = strtol(buf, NULL, 10);
+        if (pid <= 0) continue;
+
+        struct service *s = find_service(name);
+        if (s && s->pid != (pid_t)pid) open_service(s, (pid_t)pid);
+    }
+    closedir(dir);
+}
+
+// Context switches of all threads; /proc/<pid>/status only has the main one's
+static bool read_switches(pid_t pid, unsigned long long *vcsw, unsigned long long *ivcsw) {
+    char path[64], buf[PROC_BUF_SIZE * 4];
+    struct dirent *entry;
+
+    snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+    DIR *dir = opendir(path);
+    if (dir == NULL) return false;
+
+    *vcsw = *ivcsw = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "/proc/%d/task/%.16s/status", (int)pid, entry->d_name);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) continue;         // thread just exited
+        ssize_t n = read_proc(fd, buf, sizeof(buf));
+        close(fd);
+        if (n <= 0) continue;
+        *vcsw += proc_value(buf, "\nvoluntary_ctxt_switches:");
+        *ivcsw += proc_value(buf, "\nnonvoluntary_ctxt_switches:");
+    }
+    closedir(dir);
+    return true;
+}
+
+static uint32_t rate(unsigned long long now, unsigned long long prev, double elapsed) {
+    if (now < prev || elapsed <= 0) return NO_VALUE;
+    double r = (double)(now - prev) / elapsed;
+    return r >= NO_VALUE ? NO_VALUE - 1 : (uint32_t)(r + 0.5);
+}
+
+// Fill values for s, leaving NO_VALUE where there is nothing to report;
+// false once the process is gone
+static bool sample_service(struct service *s, double elapsed, uint32_t values[SVC_SERIES_COUNT]) {
+    char buf[PROC_BUF_SIZE];
+    struct counters now = { 0 };
+    unsigned long long rss_pages = 0, threads = 0;
+
+    // "pid (comm) state ppid ... utime stime ... num_threads ... rss"; comm
+    // may hold spaces and parentheses, so fields count from the last ')'
+    if (read_proc(s->stat_fd, buf, sizeof(buf)) <= 0) return false;
+    const char *p = strrchr(buf, ')');
+    if (p == NULL) return false;
+    p++;
+    for (int field = 3; field <= 24 && *p; field++) {
+        while (*p == ' ') p++;
+        char *end;
+        unsigned long long v = strtoull(p, &end, 10);
+        if (field == 14 || field == 15) now.cpu_ticks += v;
+        if (field == 20) threads = v;
+        if (field == 24) rss_pages = v;
+        p = strchr(p, ' ');
+        if (p == NULL) break;
+    }
+
+    values[SVC_THREADS] = (uint32_t)threads;
+    values[SVC_RSS] = (uint32_t)(rss_pages * (unsigned long long)page_kib);
+    if (s->mem_fd != -1 && read_proc(s->mem_fd, buf, sizeof(buf)) > 0) {
+        if (s->rollup) {
+            values[SVC_RSS] = (uint32_t)proc_value(buf, "\nRss:");
+            values[SVC_PSS] = (uint32_t)proc_value(buf, "\nPss:");
+        } else {
+            // "size resident shared ..." in pages
+            const char *q = strchr(buf, ' ');
+            if (q) values[SVC_RSS] = (uint32_t)(strtoull(q, NULL, 10) * (unsigned long long)page_kib);
+        }
+    }
+
+    bool have_switches = read_switches(s->pid, &now.vcsw, &now.ivcsw);
+    bool have_io = s->io_fd != -1 && read_proc(s->io_fd, buf, sizeof(buf)) > 0;
+    if (have_io) {
+        now.rchar = proc_value(buf, "rchar:");
+        now.wchar = proc_value(buf, "wchar:");
+    }
+
+    if (s->have_prev) {
+        uint32_t ticks = rate(now.cpu_ticks, s->prev.cpu_ticks, elapsed);
+        if (ticks != NO_VALUE) values[SVC_CPU] = (uint32_t)((uint64_t)ticks * 1000 / (uint64_t)clock_ticks);
+        if (have_switches) {
+            values[SVC_VCSW] = rate(now.vcsw, s->prev.vcsw, elapsed);
+            values[SVC_IVCSW] = rate(now.ivcsw, s->prev.ivcsw, elapsed);
+        }
+        if (have_io) {
+            values[SVC_READ] = rate(now.rchar, s->prev.rchar, elapsed);
+            values[SVC_WRITE] = rate(now.wchar, s->prev.wchar, elapsed);
+        }
+    }
+    s->prev = now;
+    s->have_prev = true;
+    return true;
+}
+
+static void take_sample(unsigned long long n, double elapsed) {
+    uint32_t row[MAX_SERVICES][SVC_SERIES_COUNT];
+
+    if (n % RESCAN_SAMPLES == 0) rescan();
+
+    memset(row, 0xff, sizeof(row));     // NO_VALUE
+    for (size_t i = 0; i < service_count; i++) {
+        struct service *s = &services[i];
+        if (s->pid != 0 && !sample_service(s, elapsed, row[i])) {
+            close_service(s);
+            memset(row[i], 0xff, sizeof(row[i]));
+        }
+    }
+
+    pthread_mutex_lock(&history_lock);
+    history_time[head] = (uint32_t)time(NULL);
+    memcpy(history[head], row, sizeof(row));
+    head = (head + 1) % HISTORY_SLOTS;
+    if (count < HISTORY_SLOTS) count++;
+    pthread_mutex_unlock(&history_lock);
+}
+
+static void *sampler_thread(void *arg) {
+    struct timespec next, prev;
+    unsigned long long n = 0;
+    (void)arg;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    prev = next;
+    while (1) {
+        next.tv_sec += interval;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double elapsed = (double)(now.tv_sec - prev.tv_sec) + (double)(now.tv_nsec - prev.tv_nsec) / 1e9;
+        prev = now;
+        take_sample(++n, elapsed);
+    }
+    return NULL;
+}
+
+int services_start(unsigned int seconds) {
+    pthread_t thread;
+
+    if (seconds == 0) return 0;
+    interval = seconds;
+    clock_ticks = sysconf(_SC_CLK_TCK);
+    if (clock_ticks <= 0) clock_ticks = 100;
+    page_kib = sysconf(_SC_PAGESIZE) / 1024;
+    if (page_kib <= 0) page_kib = 4;
+
+    // First counters, so the first stored sample has rates
+    take_sample(0, 0);
+    pthread_mutex_lock(&history_lock);
+    head = count = 0;
+    pthread_mutex_unlock(&history_lock);
+
+    if (pthread_create(&thread, NULL, sampler_thread, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+static void write_column(struct json_writer *w, unsigned int first, unsigned int n,
+                         size_t service, int series) {
+    jw_begin_array(w);
+    for (unsigned int i = 0; i < n; i++) {
+        uint32_t value = history[(first + i) % HISTORY_SLOTS][service][series];
+        if (value == NO_VALUE) {
+            jw_null(w);
+        } else {
+            jw_uint(w, value);
+        }
+    }
+    jw_end_array(w);
+}
+
+// GET /api/system/services?since=
+//
+// Columnar like /api/system/history: one "time" array, then per service
+// its current pid (null while stopped) and an array per series, null where
+// the service was not running. since returns only newer samples.
+enum MHD_Result handle_system_services(struct MHD_Connection *connection, const struct request *request) {
+    const char *since_arg = request_arg(connection, request, "since");
+    unsigned long long since = 0;
+    struct json_writer w;
+
+    if (interval == 0) {
+        return send_error_response(connection, request->method, request->url,
+            "Service monitor is disabled", MHD_HTTP_SERVICE_UNAVAILABLE);
+    }
+    if (since_arg) {
+        char *end;
+        errno = 0;
+        since = strtoull(since_arg, &end, 10);
+        if (errno != 0 || end == since_arg || *end != '\0') {
+            return send_error_response(connection, request->method, request->url,
+                "Invalid query parameter", MHD_HTTP_BAD_REQUEST);
+        }
+    }
+
+    pthread_mutex_lock(&history_lock);
+
+    unsigned int first = (head + HISTORY_SLOTS - count) % HISTORY_SLOTS;
+    unsigned int n = count;
+    while (n > 0 && history_time[first] <= since) {
+        first = (first + 1) % HISTORY_SLOTS;
+        n--;
+    }
+
+    jw_init_pooled(&w, 256 + (size_t)n * 12 + service_count * (128 + (size_t)n * SVC_SERIES_COUNT * 6));
+    jw_begin_object(&w);
+    jw_kv_uint(&w, "interval", interval);
+    jw_kv_uint(&w, "capacity", HISTORY_SLOTS);
+
+    jw_key(&w, "units");
+    jw_begin_object(&w);
+    for (int k = 0; k < SVC_SERIES_COUNT; k++) jw_kv_string(&w, series_names[k], series_units[k]);
+    jw_end_object(&w);
+
+    jw_key(&w, "time");
+    jw_begin_array(&w);
+    for (unsigned int i = 0; i < n; i++) jw_uint(&w, history_time[(first + i) % HISTORY_SLOTS]);
+    jw_end_array(&w);
+
+    jw_key(&w, "services");
+    jw_begin_object(&w);
+    for (size_t i = 0; i < service_count; i++) {
+        jw_key(&w, services[i].name);
+        jw_begin_object(&w);
+        jw_key(&w, "pid");
+        if (services[i].pid) {
+            jw_uint(&w, (uint64_t)services[i].pid);
+        } else {
+            jw_null(&w);
+        }
+        for (int k = 0; k < SVC_SERIES_COUNT; k++) {
+            jw_key(&w, series_names[k]);
+            write_column(&w, first, n, i, k);
+        }
+        jw_end_object(&w);
+    }
+    jw_end_object(&w);
+    jw_end_object(&w);
+
+    pthread_mutex_unlock(&history_lock);
+
+    return send_json_writer(connection, request->method, request->url, &w, MHD_HTTP_OK);
+}
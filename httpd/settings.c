@@ -1,118 +1,377 @@
 #include "handlers.h"
+#include "nvram_store.h"
+#include "request_body.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <sys/utsname.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 
-// Forward declarations of static functions
-static char* read_post_data(struct MHD_Connection *connection, 
-                          const char *upload_data,
-                          size_t *upload_data_size, 
-                          void **con_cls);
-
-enum MHD_Result handle_settings_get(struct MHD_Connection *connection) {
-    struct json_object *root = json_object_new_object();
-    
-    // Network settings
-    struct json_object *network = json_object_new_object();
-    json_object_object_add(network, "hostname", json_object_new_string("gateway-01"));
-    json_object_object_add(network, "dhcp", json_object_new_boolean(true));
-    json_object_object_add(network, "ip", json_object_new_string("192.168.1.100"));
-    json_object_object_add(network, "netmask", json_object_new_string("255.255.255.0"));
-    json_object_object_add(network, "gateway", json_object_new_string("192.168.1.1"));
-    json_object_object_add(network, "dns_primary", json_object_new_string("8.8.8.8"));
-    json_object_object_add(network, "dns_secondary", json_object_new_string("8.8.4.4"));
-    
-    // Zigbee settings
-    struct json_object *zigbee = json_object_new_object();
-    json_object_object_add(zigbee, "enabled", json_object_new_boolean(true));
-    json_object_object_add(zigbee, "channel", json_object_new_int(11));
-    json_object_object_add(zigbee, "pan_id", json_object_new_string("0x1A2B"));
-    json_object_object_add(zigbee, "permit_join", json_object_new_boolean(false));
-    
-    // Matter settings
-    struct json_object *matter = json_object_new_object();
-    json_object_object_add(matter, "enabled", json_object_new_boolean(true));
-    json_object_object_add(matter, "fabric_id", json_object_new_string("12345"));
-    json_object_object_add(matter, "commission_mode", json_object_new_boolean(false));
-    
-    // Hardware settings
-    struct json_object *hardware = json_object_new_object();
-    json_object_object_add(hardware, "status_led", json_object_new_boolean(true));
-    json_object_object_add(hardware, "network_led", json_object_new_boolean(true));
-    
-    // System settings
-    struct json_object *system = json_object_new_object();
-    json_object_object_add(system, "name", json_object_new_string("Smart Home Gateway"));
-    json_object_object_add(system, "timezone", json_object_new_string("Europe/London"));
-    json_object_object_add(system, "log_level", json_object_new_string("info"));
-    json_object_object_add(system, "ssh_enabled", json_object_new_boolean(true));
-    json_object_object_add(system, "ssh_port", json_object_new_int(22));
-    
-    json_object_object_add(root, "network", network);
-    json_object_object_add(root, "zigbee", zigbee);
-    json_object_object_add(root, "matter", matter);
-    json_object_object_add(root, "hardware", hardware);
-    json_object_object_add(root, "system", system);
-    
-    const char *json_str = json_object_to_json_string(root);
-    enum MHD_Result ret = send_json_response(connection, "GET", "/api/settings", json_str, MHD_HTTP_OK);
-    
-    json_object_put(root);
-    return ret;
+#include "nvram/bcmnvram.h"
+
+// A PATCH is committed to flash once no further PATCH arrived for
+// COMMIT_DELAY_MS, but never later than COMMIT_MAX_DELAY_MS after the first
+// uncommitted change, so a burst of edits costs a single flash write
+#define COMMIT_DELAY_MS 2000
+#define COMMIT_MAX_DELAY_MS 10000
+
+// A failed commit is retried by the commit thread itself, backing off from
+// COMMIT_DELAY_MS up to COMMIT_RETRY_MAX_MS so a dead flash does not spin
+#define COMMIT_RETRY_MAX_MS (5 * 60 * 1000)
+
+#define NVRAM_KEY_PREFIX "settings."
+
+enum field_type {
+    FIELD_STRING,
+    FIELD_BOOL,
+    FIELD_INT,
+};
+
+// Settings exposed by /api/settings, grouped by section in output order.
+// Each one is stored under NVRAM_KEY_PREFIX "section.name"; def is used
+// until the key has been written.
+struct setting_field {
+    const char *section;
+    const char *name;
+    enum field_type type;
+    const char *def;
+};
+
+static const struct setting_field fields[] = {
+    { "network", "hostname", FIELD_STRING, "gateway-01" },
+    { "network", "dhcp", FIELD_BOOL, "1" },
+    { "network", "ip", FIELD_STRING, "192.168.1.100" },
+    { "network", "netmask", FIELD_STRING, "255.255.255.0" },
+    { "network", "gateway", FIELD_STRING, "192.168.1.1" },
+    { "network", "dns_primary", FIELD_STRING, "8.8.8.8" },
+    { "network", "dns_secondary", FIELD_STRING, "8.8.4.4" },
+    { "zigbee", "enabled", FIELD_BOOL, "1" },
+    { "zigbee", "channel", FIELD_INT, "11" },
+    { "zigbee", "pan_id", FIELD_STRING, "0x1A2B" },
+    { "zigbee", "permit_join", FIELD_BOOL, "0" },
+    { "matter", "enabled", FIELD_BOOL, "1" },
+    { "matter", "fabric_id", FIELD_STRING, "12345" },
+    { "matter", "commission_mode", FIELD_BOOL, "0" },
+    { "hardware", "status_led", FIELD_BOOL, "1" },
+    { "hardware", "network_led", FIELD_BOOL, "1" },
+    { "system", "name", FIELD_STRING, "Smart Home Gateway" },
+    { "system", "timezone", FIELD_STRING, "Europe/London" },
+    { "system", "log_level", FIELD_STRING, "info" },
+    { "system", "ssh_enabled", FIELD_BOOL, "1" },
+    { "system", "ssh_port", FIELD_INT, "22" },
+};
+
+#define FIELD_COUNT (sizeof(fields) / sizeof(fields[0]))
+
+// Decoded view of the settings, the source of truth for GET and PATCH.
+// Flash is only touched by the commit thread.
+static pthread_mutex_t settings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t commit_cond;
+static char values[FIELD_COUNT][NVRAM_STORE_VALUE_MAX + 1];
+static bool dirty[FIELD_COUNT];
+static bool commit_pending = false;
+static bool nvram_available = false;
+static struct timespec first_change;
+static struct timespec last_change;
+static unsigned int commit_failures;
+
+static void field_key(const struct setting_field *f, char *buf, size_t len) {
+    snprintf(buf, len, NVRAM_KEY_PREFIX "%s.%s", f->section, f->name);
+}
+
+static const struct setting_field *find_field(const char *section, const char *name, size_t *index) {
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+        if (strcmp(fields[i].section, section) == 0 && strcmp(fields[i].name, name) == 0) {
+            *index = i;
+            return &fields[i];
+        }
+    }
+    return NULL;
 }
 
-enum MHD_Result handle_settings_patch(struct MHD_Connection *connection,
-                                    const char *upload_data,
-                                    size_t *upload_data_size,
-                                    void **con_cls) {
-    char *post_data = read_post_data(connection, upload_data, upload_data_size, con_cls);
-    if (post_data == NULL) {
-        return MHD_YES;  // Not ready to process yet
+static bool section_exists(const char *section) {
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+        if (strcmp(fields[i].section, section) == 0) return true;
     }
+    return false;
+}
+
+static void write_settings(struct json_writer *w) {
+    const char *section = NULL;
+
+    jw_begin_object(w);
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+        const struct setting_field *f = &fields[i];
 
-    // Parse JSON data
-    struct json_object *root = json_tokener_parse(post_data);
-    free(post_data);
+        if (section == NULL || strcmp(section, f->section) != 0) {
+            if (section) jw_end_object(w);
+            section = f->section;
+            jw_key(w, section);
+            jw_begin_object(w);
+        }
 
-    if (root == NULL) {
-        const char *error_msg = "Invalid JSON data";
-        return send_json_response(connection, "PATCH", "/api/settings", error_msg, MHD_HTTP_BAD_REQUEST);
+        jw_key(w, f->name);
+        switch (f->type) {
+        case FIELD_BOOL:
+            jw_bool(w, strcmp(values[i], "1") == 0);
+            break;
+        case FIELD_INT:
+            jw_int(w, strtoll(values[i], NULL, 10));
+            break;
+        case FIELD_STRING:
+        default:
+            jw_string(w, values[i]);
+            break;
+        }
     }
+    if (section) jw_end_object(w);
+    jw_end_object(w);
+}
 
-    // TODO: Apply settings changes here
-    // For now, just acknowledge receipt
-    json_object_put(root);
-    return send_json_response(connection, "PATCH", "/api/settings", "{\"status\":\"ok\"}", MHD_HTTP_OK);
+enum MHD_Result handle_settings_get(struct MHD_Connection *connection, const struct request *request) {
+    struct json_writer w;
+
+    jw_init_pooled(&w, 768);
+    pthread_mutex_lock(&settings_lock);
+    write_settings(&w);
+    pthread_mutex_unlock(&settings_lock);
+
+    return send_json_writer(connection, "GET", "/api/settings", &w, MHD_HTTP_OK);
 }
 
-static char* read_post_data(struct MHD_Connection *connection, 
-                          const char *upload_data,
-                          size_t *upload_data_size, 
-                          void **con_cls) {
-    if (*con_cls == NULL) {
-        // First call for this request
-        *con_cls = malloc(1);
-        if (*con_cls == NULL) return NULL;
-        return NULL;
+// Check a PATCH document ({"section": {"name": value, ...}, ...}) against
+// the field table. Returns NULL if it can be applied, else an error message.
+static const char *validate_patch(struct json_object *root, char *error, size_t len) {
+    if (!json_object_is_type(root, json_type_object)) return "Expected a JSON object";
+
+    json_object_object_foreach(root, section, members) {
+        if (!section_exists(section) || !json_object_is_type(members, json_type_object)) {
+            snprintf(error, len, "Unknown settings section: %s", section);
+            return error;
+        }
+        json_object_object_foreach(members, name, value) {
+            size_t index;
+            const struct setting_field *f = find_field(section, name, &index);
+            bool ok = false;
+
+            if (f == NULL) {
+                snprintf(error, len, "Unknown setting: %s.%s", section, name);
+                return error;
+            }
+            switch (f->type) {
+            case FIELD_BOOL:
+                ok = json_object_is_type(value, json_type_boolean);
+                break;
+            case FIELD_INT:
+                ok = json_object_is_type(value, json_type_int);
+                break;
+            case FIELD_STRING:
+                ok = json_object_is_type(value, json_type_string) &&
+                     json_object_get_string_len(value) <= NVRAM_STORE_VALUE_MAX;
+                break;
+            }
+            if (!ok) {
+                snprintf(error, len, "Invalid value for %s.%s", section, name);
+                return error;
+            }
+        }
     }
+    return NULL;
+}
 
-    if (*upload_data_size == 0) {
-        // All data has been read
-        free(*con_cls);
-        *con_cls = NULL;
-        return strdup("{}");  // Return empty JSON object if no data
+// Apply a validated PATCH to the view. Caller holds settings_lock.
+static bool apply_patch(struct json_object *root) {
+    bool changed = false;
+
+    json_object_object_foreach(root, section, members) {
+        json_object_object_foreach(members, name, value) {
+            char buf[NVRAM_STORE_VALUE_MAX + 1];
+            size_t index;
+            const struct setting_field *f = find_field(section, name, &index);
+
+            switch (f->type) {
+            case FIELD_BOOL:
+                snprintf(buf, sizeof(buf), "%d", json_object_get_boolean(value) ? 1 : 0);
+                break;
+            case FIELD_INT:
+                snprintf(buf, sizeof(buf), "%lld", (long long)json_object_get_int64(value));
+                break;
+            case FIELD_STRING:
+            default:
+                snprintf(buf, sizeof(buf), "%s", json_object_get_string(value));
+                break;
+            }
+
+            if (strcmp(values[index], buf) != 0) {
+                memcpy(values[index], buf, sizeof(buf));
+                dirty[index] = true;
+                changed = true;
+            }
+        }
     }
+    return changed;
+}
 
-    // Copy the upload data
-    char *post_data = malloc(*upload_data_size + 1);
-    if (post_data == NULL) return NULL;
-    
-    memcpy(post_data, upload_data, *upload_data_size);
-    post_data[*upload_data_size] = '\0';
-    *upload_data_size = 0;  // Mark that we've processed the data
-    
-    return post_data;
+static long elapsed_ms(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000 + (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+static struct timespec add_ms(struct timespec t, long ms) {
+    t.tv_sec += ms / 1000;
+    t.tv_nsec += (ms % 1000) * 1000000;
+    if (t.tv_nsec >= 1000000000) {
+        t.tv_sec++;
+        t.tv_nsec -= 1000000000;
+    }
+    return t;
+}
+
+// Write dirty settings to NVRAM once the debounce window has passed
+static void *commit_thread(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&settings_lock);
+    while (1) {
+        struct timespec now;
+
+        while (!commit_pending) {
+            pthread_cond_wait(&commit_cond, &settings_lock);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        struct timespec deadline = add_ms(last_change, COMMIT_DELAY_MS);
+        struct timespec limit = add_ms(first_change, COMMIT_MAX_DELAY_MS);
+        if (elapsed_ms(&limit, &deadline) > 0) deadline = limit;
+        if (elapsed_ms(&now, &deadline) > 0) {
+            pthread_cond_timedwait(&commit_cond, &settings_lock, &deadline);
+            continue;
+        }
+
+        // Take a copy so PATCHes can continue while flash is written
+        static char pending[FIELD_COUNT][NVRAM_STORE_VALUE_MAX + 1];
+        bool pending_dirty[FIELD_COUNT];
+        for (size_t i = 0; i < FIELD_COUNT; i++) {
+            pending_dirty[i] = dirty[i];
+            if (dirty[i]) memcpy(pending[i], values[i], sizeof(values[i]));
+            dirty[i] = false;
+        }
+        commit_pending = false;
+        pthread_mutex_unlock(&settings_lock);
+
+        int ret = 0;
+        for (size_t i = 0; i < FIELD_COUNT && ret == 0; i++) {
+            char key[NVRAM_MAX_PARAM_LEN + 1];
+            if (!pending_dirty[i]) continue;
+            field_key(&fields[i], key, sizeof(key));
+            ret = nvram_store_set(key, pending[i]);
+        }
+        if (ret == 0) ret = nvram_store_commit();
+
+        pthread_mutex_lock(&settings_lock);
+        if (ret != 0) {
+            // Keep the changes and schedule a retry, waiting twice as long
+            // after each failure in a row; log only the first few and then
+            // every power of two
+            long backoff = COMMIT_DELAY_MS;
+            for (unsigned int n = 0; n < commit_failures && backoff < COMMIT_RETRY_MAX_MS; n++) {
+                backoff *= 2;
+            }
+            if (backoff > COMMIT_RETRY_MAX_MS) backoff = COMMIT_RETRY_MAX_MS;
+            commit_failures++;
+            if (commit_failures <= 3 || (commit_failures & (commit_failures - 1)) == 0) {
+                fprintf(stderr, "settings: NVRAM commit failed (%u in a row), retrying in %ld s\n",
+                        commit_failures, backoff / 1000);
+            }
+
+            for (size_t i = 0; i < FIELD_COUNT; i++) {
+                dirty[i] |= pending_dirty[i];
+            }
+            // The deadline is last_change + COMMIT_DELAY_MS; a PATCH in the
+            // meantime moves it closer again
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            last_change = add_ms(now, backoff - COMMIT_DELAY_MS);
+            first_change = last_change;
+            commit_pending = true;
+        } else if (commit_failures > 0) {
+            fprintf(stderr, "settings: NVRAM commit succeeded after %u failures\n", commit_failures);
+            commit_failures = 0;
+        }
+    }
+    return NULL;
+}
+
+int settings_start(const char *nvram_path) {
+    pthread_condattr_t attr;
+    pthread_t thread;
+
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+        snprintf(values[i], sizeof(values[i]), "%s", fields[i].def);
+    }
+
+    // Without NVRAM the settings still work, but only until restart
+    if (nvram_store_init(nvram_path) != 0) {
+        fprintf(stderr, "settings: NVRAM not available, changes will not persist\n");
+        return 0;
+    }
+    nvram_available = true;
+
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+        char key[NVRAM_MAX_PARAM_LEN + 1];
+        field_key(&fields[i], key, sizeof(key));
+        if (nvram_store_get(key, values[i], sizeof(values[i])) != 1) {
+            snprintf(values[i], sizeof(values[i]), "%s", fields[i].def);
+        }
+    }
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&commit_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&thread, NULL, commit_thread, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+enum MHD_Result handle_settings_patch(struct MHD_Connection *connection, const struct request *request) {
+    char error[128];
+    struct json_object *root;
+
+    switch (request_body_read(connection, request, &root)) {
+    case BODY_PENDING:
+        return MHD_YES;
+    case BODY_TOO_LARGE:
+        return send_error_response(connection, "PATCH", "/api/settings",
+            "Request body too large", MHD_HTTP_CONTENT_TOO_LARGE);
+    case BODY_EMPTY:
+    case BODY_INVALID:
+        return send_error_response(connection, "PATCH", "/api/settings",
+            "Invalid JSON data", MHD_HTTP_BAD_REQUEST);
+    case BODY_READY:
+        break;
+    }
+
+    const char *invalid = validate_patch(root, error, sizeof(error));
+    if (invalid) {
+        json_object_put(root);
+        return send_error_response(connection, "PATCH", "/api/settings",
+            invalid, MHD_HTTP_BAD_REQUEST);
+    }
+
+    pthread_mutex_lock(&settings_lock);
+    if (apply_patch(root) && nvram_available) {
+        clock_gettime(CLOCK_MONOTONIC, &last_change);
+        if (!commit_pending) first_change = last_change;
+        commit_pending = true;
+        pthread_cond_signal(&commit_cond);
+    }
+    pthread_mutex_unlock(&settings_lock);
+
+    json_object_put(root);
+    return send_json_response(connection, "PATCH", "/api/settings", "{\"status\":\"ok\"}", MHD_HTTP_OK);
 }
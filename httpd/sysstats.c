@@ -0,0 +1,416 @@
+#include "handlers.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+// System history: CPU, memory, load and network throughput sampled every
+// second into fixed ring buffers at three resolutions. Each downsampled slot
+// keeps the min, max and average of the 1 s samples it covers.
+//
+// All storage is static, so the footprint is known at build time (about
+// 300 KiB with the tiers below). A sample is a pread() of four /proc files
+// that stay open, parsed in place.
+
+enum series {
+    SERIES_CPU,         // busy time, per mille of all CPUs
+    SERIES_MEM,         // used memory (MemTotal - MemAvailable), KiB
+    SERIES_LOAD,        // 1 minute load average x 100
+    SERIES_RX,          // bytes/s received on all interfaces but lo
+    SERIES_TX,          // bytes/s sent
+    SERIES_COUNT,
+};
+
+static const char *const series_names[SERIES_COUNT] = {
+    [SERIES_CPU] = "cpu",
+    [SERIES_MEM] = "mem_used",
+    [SERIES_LOAD] = "load",
+    [SERIES_RX] = "rx",
+    [SERIES_TX] = "tx",
+};
+
+static const char *const series_units[SERIES_COUNT] = {
+    [SERIES_CPU] = "permille",
+    [SERIES_MEM] = "KiB",
+    [SERIES_LOAD] = "x100",
+    [SERIES_RX] = "B/s",
+    [SERIES_TX] = "B/s",
+};
+
+#define RAW_SLOTS 600           // 1 s for 10 minutes
+#define MINUTE_SLOTS 1440       // 1 min for 24 hours
+#define QUARTER_SLOTS 2880      // 15 min for 30 days
+#define PROC_BUF_SIZE 4096
+
+struct slot {
+    uint32_t min;
+    uint32_t max;
+    uint32_t avg;
+};
+
+struct tier {
+    const char *name;
+    unsigned int interval;      // seconds per slot
+    unsigned int capacity;
+    uint32_t *time;             // start of each slot (Unix time)
+    struct slot (*slots)[SERIES_COUNT];
+    unsigned int head;          // slot written next
+    unsigned int count;
+
+    // Slot being accumulated
+    uint32_t acc_time;
+    uint32_t acc_samples;
+    struct slot acc[SERIES_COUNT];
+    uint64_t acc_sum[SERIES_COUNT];
+};
+
+static uint32_t raw_time[RAW_SLOTS];
+static struct slot raw_slots[RAW_SLOTS][SERIES_COUNT];
+static uint32_t minute_time[MINUTE_SLOTS];
+static struct slot minute_slots[MINUTE_SLOTS][SERIES_COUNT];
+static uint32_t quarter_time[QUARTER_SLOTS];
+static struct slot quarter_slots[QUARTER_SLOTS][SERIES_COUNT];
+
+static struct tier tiers[] = {
+    { .name = "1s", .interval = 1, .capacity = RAW_SLOTS, .time = raw_time, .slots = raw_slots },
+    { .name = "1m", .interval = 60, .capacity = MINUTE_SLOTS, .time = minute_time, .slots = minute_slots },
+    { .name = "15m", .interval = 900, .capacity = QUARTER_SLOTS, .time = quarter_time, .slots = quarter_slots },
+};
+
+#define TIER_COUNT (sizeof(tiers) / sizeof(tiers[0]))
+
+static pthread_mutex_t history_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// /proc files, kept open and re-read from offset 0
+static int stat_fd = -1, meminfo_fd = -1, loadavg_fd = -1, netdev_fd = -1;
+
+// Previous counters, for rates
+static struct {
+    bool valid;
+    unsigned long long cpu_total;
+    unsigned long long cpu_busy;
+    unsigned long rx;           // native width, so the kernel's counter
+    unsigned long tx;           // wrap-around cancels out in the delta
+    struct timespec at;
+} prev;
+
+static ssize_t read_proc(int fd, char *buf, size_t len) {
+    ssize_t n = pread(fd, buf, len - 1, 0);
+    if (n < 0) return -1;
+    buf[n] = '\0';
+    return n;
+}
+
+static const char *skip_field(const char *p) {
+    while (*p == ' ' || *p == '\t') p++;
+    while (*p && *p != ' ' && *p != '\t' && *p != '\n') p++;
+    return p;
+}
+
+static unsigned long long next_number(const char **p) {
+    char *end;
+    unsigned long long v = strtoull(*p, &end, 10);
+    *p = end;
+    return v;
+}
+
+// "cpu  user nice system idle iowait irq softirq steal ..."
+static bool read_cpu(unsigned long long *total, unsigned long long *busy) {
+    char buf[512];
+    const char *p = buf;
+    unsigned long long v[8] = {0};
+
+    if (read_proc(stat_fd, buf, sizeof(buf)) <= 0 || strncmp(buf, "cpu ", 4) != 0) return false;
+    p = skip_field(p);
+    for (int i = 0; i < 8; i++) v[i] = next_number(&p);
+
+    *total = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+    *busy = *total - v[3] - v[4];
+    return true;
+}
+
+static unsigned long meminfo_value(const char *buf, const char *key) {
+    const char *p = strstr(buf, key);
+    if (p == NULL) return 0;
+    p += strlen(key);
+    return (unsigned long)next_number(&p);
+}
+
+static bool read_mem(uint32_t *used) {
+    char buf[PROC_BUF_SIZE];
+
+    if (read_proc(meminfo_fd, buf, sizeof(buf)) <= 0) return false;
+
+    unsigned long total = meminfo_value(buf, "MemTotal:");
+    unsigned long available = meminfo_value(buf, "MemAvailable:");
+    if (available == 0) {
+        // Kernels before 3.14
+        available = meminfo_value(buf, "MemFree:") + meminfo_value(buf, "Buffers:") +
+                    meminfo_value(buf, "\nCached:");
+    }
+    *used = total > available ? (uint32_t)(total - available) : 0;
+    return true;
+}
+
+static bool read_load(uint32_t *load) {
+    char buf[128];
+    unsigned int whole = 0, frac = 0;
+
+    if (read_proc(loadavg_fd, buf, sizeof(buf)) <= 0 ||
+        sscanf(buf, "%u.%2u", &whole, &frac) != 2) {
+        return false;
+    }
+    *load = whole * 100 + frac;
+    return true;
+}
+
+// "  eth0: rx_bytes packets errs drop fifo frame compressed multicast tx_bytes ..."
+static bool read_net(unsigned long *rx, unsigned long *tx) {
+    char buf[PROC_BUF_SIZE];
+    const char *line;
+
+    if (read_proc(netdev_fd, buf, sizeof(buf)) <= 0) return false;
+
+    *rx = *tx = 0;
+    for (line = buf; (line = strchr(line, '\n')) != NULL;) {
+        line++;
+        const char *colon = strchr(line, ':');
+        const char *eol = strchr(line, '\n');
+        if (colon == NULL || (eol && colon > eol)) continue;
+
+        const char *name = line;
+        while (*name == ' ') name++;
+        if (colon - name == 2 && strncmp(name, "lo", 2) == 0) continue;
+
+        const char *p = colon + 1;
+        *rx += (unsigned long)next_number(&p);
+        for (int i = 0; i < 7; i++) next_number(&p);
+        *tx += (unsigned long)next_number(&p);
+    }
+    return true;
+}
+
+static void tier_push(struct tier *t, uint32_t time, const struct slot *values) {
+    t->time[t->head] = time;
+    memcpy(t->slots[t->head], values, sizeof(struct slot) * SERIES_COUNT);
+    t->head = (t->head + 1) % t->capacity;
+    if (t->count < t->capacity) t->count++;
+}
+
+static void tier_flush(struct tier *t) {
+    if (t->acc_samples == 0) return;
+    for (int s = 0; s < SERIES_COUNT; s++) {
+        t->acc[s].avg = (uint32_t)((t->acc_sum[s] + t->acc_samples / 2) / t->acc_samples);
+    }
+    tier_push(t, t->acc_time, t->acc);
+    t->acc_samples = 0;
+}
+
+// Add a 1 s sample to a downsampled tier, closing the slot when the
+// sample falls into the next one
+static void tier_add(struct tier *t, uint32_t time, const uint32_t *values) {
+    uint32_t slot_time = time - time % t->interval;
+
+    if (t->acc_samples && slot_time != t->acc_time) tier_flush(t);
+    if (t->acc_samples == 0) {
+        t->acc_time = slot_time;
+        for (int s = 0; s < SERIES_COUNT; s++) {
+            t->acc[s].min = UINT32_MAX;
+            t->acc[s].max = 0;
+            t->acc_sum[s] = 0;
+        }
+    }
+    for (int s = 0; s < SERIES_COUNT; s++) {
+        if (values[s] < t->acc[s].min) t->acc[s].min = values[s];
+        if (values[s] > t->acc[s].max) t->acc[s].max = values[s];
+        t->acc_sum[s] += values[s];
+    }
+    t->acc_samples++;
+}
+
+static void take_sample(void) {
+    uint32_t values[SERIES_COUNT] = {0};
+    unsigned long long cpu_total = 0, cpu_busy = 0;
+    unsigned long rx = 0, tx = 0;
+    struct timespec now;
+    bool have_cpu, have_net;
+    bool primed = prev.valid;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    have_cpu = read_cpu(&cpu_total, &cpu_busy);
+    have_net = read_net(&rx, &tx);
+    read_mem(&values[SERIES_MEM]);
+    read_load(&values[SERIES_LOAD]);
+
+    if (!prev.valid) {
+        // Rates need a previous sample
+        prev.valid = have_cpu && have_net;
+    } else {
+        double elapsed = (double)(now.tv_sec - prev.at.tv_sec) +
+                         (double)(now.tv_nsec - prev.at.tv_nsec) / 1e9;
+        if (have_cpu && cpu_total > prev.cpu_total && cpu_busy >= prev.cpu_busy) {
+            values[SERIES_CPU] = (uint32_t)((cpu_busy - prev.cpu_busy) * 1000 /
+                                            (cpu_total - prev.cpu_total));
+        }
+        if (have_net && elapsed > 0) {
+            values[SERIES_RX] = (uint32_t)((unsigned long)(rx - prev.rx) / elapsed);
+            values[SERIES_TX] = (uint32_t)((unsigned long)(tx - prev.tx) / elapsed);
+        }
+    }
+    prev.cpu_total = cpu_total;
+    prev.cpu_busy = cpu_busy;
+    prev.rx = rx;
+    prev.tx = tx;
+    prev.at = now;
+
+    // The first sample has no rates to report; recording it would put a
+    // zero CPU and network slot into every tier's min and avg
+    if (!primed) return;
+
+    uint32_t time_now = (uint32_t)time(NULL);
+    struct slot raw[SERIES_COUNT];
+    for (int s = 0; s < SERIES_COUNT; s++) {
+        raw[s] = (struct slot){ values[s], values[s], values[s] };
+    }
+
+    pthread_mutex_lock(&history_lock);
+    tier_push(&tiers[0], time_now, raw);
+    for (size_t i = 1; i < TIER_COUNT; i++) tier_add(&tiers[i], time_now, values);
+    pthread_mutex_unlock(&history_lock);
+}
+
+static void *sampler_thread(void *arg) {
+    struct timespec next;
+    (void)arg;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (1) {
+        next.tv_sec++;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+        take_sample();
+    }
+    return NULL;
+}
+
+int sysstats_start(void) {
+    pthread_t thread;
+    size_t bytes = 0;
+
+    stat_fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+    meminfo_fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+    loadavg_fd = open("/proc/loadavg", O_RDONLY | O_CLOEXEC);
+    netdev_fd = open("/proc/net/dev", O_RDONLY | O_CLOEXEC);
+    if (stat_fd == -1 || meminfo_fd == -1 || loadavg_fd == -1 || netdev_fd == -1) {
+        fprintf(stderr, "sysstats: cannot open /proc: %s\n", strerror(errno));
+        return -1;
+    }
+
+    for (size_t i = 0; i < TIER_COUNT; i++) {
+        bytes += tiers[i].capacity * (sizeof(uint32_t) + sizeof(struct slot) * SERIES_COUNT);
+    }
+    printf("sysstats: %zu KiB of history\n", bytes / 1024);
+
+    take_sample();
+    if (pthread_create(&thread, NULL, sampler_thread, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+// One column of the selected slots
+static void write_column(struct json_writer *w, const struct tier *t, unsigned int first,
+                         unsigned int count, int series, size_t field) {
+    jw_begin_array(w);
+    for (unsigned int i = 0; i < count; i++) {
+        const char *slot = (const char *)&t->slots[(first + i) % t->capacity][series];
+        uint32_t value;
+        memcpy(&value, slot + field, sizeof(value));
+        jw_uint(w, value);
+    }
+    jw_end_array(w);
+}
+
+// GET /api/system/history?tier=1s|1m|15m&since=
+//
+// Columnar: a "time" array with the start of each slot, then per series
+// arrays of the same length. The 1s tier has only "avg" (the samples
+// themselves). since returns only slots that started after it, for polling.
+enum MHD_Result handle_system_history(struct MHD_Connection *connection, const struct request *request) {
+    const char *tier_arg = request_arg(connection, request, "tier");
+    const char *since_arg = request_arg(connection, request, "since");
+    const struct tier *t = &tiers[0];
+    unsigned long long since = 0;
+    struct json_writer w;
+
+    if (tier_arg) {
+        t = NULL;
+        for (size_t i = 0; i < TIER_COUNT; i++) {
+            if (strcmp(tier_arg, tiers[i].name) == 0) t = &tiers[i];
+        }
+    }
+    if (since_arg) {
+        char *end;
+        errno = 0;
+        since = strtoull(since_arg, &end, 10);
+        if (errno != 0 || end == since_arg || *end != '\0') t = NULL;
+    }
+    if (t == NULL) {
+        return send_error_response(connection, request->method, request->url,
+            "Invalid query parameter", MHD_HTTP_BAD_REQUEST);
+    }
+
+    pthread_mutex_lock(&history_lock);
+
+    unsigned int first = (t->head + t->capacity - t->count) % t->capacity;
+    unsigned int count = t->count;
+    while (count > 0 && t->time[first] <= since) {
+        first = (first + 1) % t->capacity;
+        count--;
+    }
+
+    jw_init_pooled(&w, 256 + (size_t)count * (t->interval == 1 ? 40 : 100));
+    jw_begin_object(&w);
+    jw_kv_string(&w, "tier", t->name);
+    jw_kv_uint(&w, "interval", t->interval);
+    jw_kv_uint(&w, "capacity", t->capacity);
+
+    jw_key(&w, "units");
+    jw_begin_object(&w);
+    for (int s = 0; s < SERIES_COUNT; s++) jw_kv_string(&w, series_names[s], series_units[s]);
+    jw_end_object(&w);
+
+    jw_key(&w, "time");
+    jw_begin_array(&w);
+    for (unsigned int i = 0; i < count; i++) jw_uint(&w, t->time[(first + i) % t->capacity]);
+    jw_end_array(&w);
+
+    jw_key(&w, "series");
+    jw_begin_object(&w);
+    for (int s = 0; s < SERIES_COUNT; s++) {
+        jw_key(&w, series_names[s]);
+        jw_begin_object(&w);
+        if (t->interval > 1) {
+            jw_key(&w, "min");
+            write_column(&w, t, first, count, s, offsetof(struct slot, min));
+            jw_key(&w, "max");
+            write_column(&w, t, first, count, s, offsetof(struct slot, max));
+        }
+        jw_key(&w, "avg");
+        write_column(&w, t, first, count, s, offsetof(struct slot, avg));
+        jw_end_object(&w);
+    }
+    jw_end_object(&w);
+    jw_end_object(&w);
+
+    pthread_mutex_unlock(&history_lock);
+
+    return send_json_writer(connection, request->method, request->url, &w, MHD_HTTP_OK);
+}
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Benchmark a host build of httpd (make httpd-host).
+#
+# Starts work/httpd-host on a local port with scratch NVRAM, firmware and log
+# files under work/bench, runs the httpd_bench scenarios against it and
+# appends the results, labelled with the current commit, to
+# work/bench/results.tsv for comparison with earlier runs.
+#
+# Usage: bench_host.sh [connections] [seconds]
+# SCENARIOS, PORT and HTTPD_OPTS (extra httpd options) can be overridden.
+
+set -e
+
+HTTPD=${HTTPD:-work/httpd-host}
+BENCH=${BENCH:-work/httpd_bench}
+SCENARIOS=${SCENARIOS:-"static dashboard settings"}
+PORT=${PORT:-8080}
+OUT=${OUT:-work/bench}
+
+CONNECTIONS=${1:-16}
+SECONDS_PER_SCENARIO=${2:-10}
+LABEL=$(git describe --always --dirty 2>/dev/null || echo unknown)
+
+mkdir -p "$OUT"
+: > "$OUT/messages"
+
+$HTTPD -p "$PORT" -n "$OUT/nvram.img" -f "$OUT/firmware.img" -l "$OUT/messages" \
+    -a "$OUT/access.log" -q off -Q off $HTTPD_OPTS > "$OUT/httpd.log" 2>&1 &
+PID=$!
+trap 'kill $PID 2>/dev/null' EXIT INT TERM
+sleep 1
+
+ARGS=""
+for scenario in $SCENARIOS; do
+    ARGS="$ARGS -s $scenario"
+done
+
+echo "== $LABEL: $CONNECTIONS connections, ${SECONDS_PER_SCENARIO}s per scenario"
+$BENCH -c "$CONNECTIONS" -d "$SECONDS_PER_SCENARIO" -l "$LABEL" -o "$OUT/results.tsv" $ARGS "127.0.0.1:$PORT"
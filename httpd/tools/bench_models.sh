@@ -0,0 +1,38 @@
+#!/bin/sh
+# Compare httpd threading models on a device.
+#
+# Restarts httpd on the device once per model (-m epoll|pool|thread) and runs
+# httpd_bench from this host against the static and API routes.
+#
+# Usage: bench_models.sh <ip> [connections] [seconds]
+# The device root password is taken from $PASSWORD, as in the Makefile.
+
+set -e
+
+BENCH=${BENCH:-work/httpd_bench}
+MODELS=${MODELS:-"epoll pool thread"}
+PATHS=${PATHS:-"/ /api/gateway/status /api/settings /api/logs"}
+
+IP=$1
+CONNECTIONS=${2:-8}
+SECONDS_PER_PATH=${3:-10}
+
+if [ -z "$IP" ] || [ -z "$PASSWORD" ]; then
+    echo "Usage: PASSWORD=<password> $0 <ip> [connections] [seconds]"
+    exit 1
+fi
+
+remote() {
+    SSHPASS=$PASSWORD sshpass -e ssh root@$IP "$@"
+}
+
+for model in $MODELS; do
+    echo "== model: $model, $CONNECTIONS connections, ${SECONDS_PER_PATH}s per path"
+    remote "HTTPD_OPTS='-m $model -q off -Q off' /tmp/tuya/httpd_srv restart" >/dev/null
+    sleep 1
+    $BENCH -c "$CONNECTIONS" -d "$SECONDS_PER_PATH" "$IP" $PATHS
+    echo
+done
+
+# Back to the configured default
+remote "/tmp/tuya/httpd_srv restart" >/dev/null
@@ -0,0 +1,215 @@
+// Host tool: compile the built web UI into a C source file for httpd.
+//
+// Usage: gen_assets <www_dir> <output.c>
+//
+// Every regular file below www_dir becomes a const byte array together with
+// its precomputed Content-Type, ETag, Cache-Control and Last-Modified. The
+// file table is ordered by a minimal perfect hash of the URL path, so httpd
+// finds an asset with one hash computation and one strcmp().
+//
+// www_dir is rebuilt from scratch, so its mtimes are clamped to
+// SOURCE_DATE_EPOCH when that is set; the Makefile sets it to the time of
+// the last commit, which keeps the output the same for the same sources.
+
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "mph.h"
+#include "mime.h"
+
+#define MAX_ASSETS 1024
+#define MAX_PATH_LEN 1024
+
+struct input_file {
+    char path[MAX_PATH_LEN];        // URL path
+    char fs_path[MAX_PATH_LEN];
+    unsigned char *data;
+    size_t size;
+    time_t mtime;
+};
+
+static struct input_file files[MAX_ASSETS];
+static size_t file_count = 0;
+static size_t root_len = 0;
+static time_t source_date = -1;
+
+static int collect_file(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    (void)ftwbuf;
+
+    if (typeflag != FTW_F || !S_ISREG(sb->st_mode)) return 0;
+
+    if (file_count == MAX_ASSETS) {
+        fprintf(stderr, "Too many files, limit is %d\n", MAX_ASSETS);
+        return -1;
+    }
+
+    struct input_file *f = &files[file_count++];
+    snprintf(f->path, sizeof(f->path), "%s", fpath + root_len);
+    snprintf(f->fs_path, sizeof(f->fs_path), "%s", fpath);
+    f->mtime = sb->st_mtime;
+    if (source_date >= 0 && f->mtime > source_date) f->mtime = source_date;
+    return 0;
+}
+
+static int load_file(struct input_file *f) {
+    FILE *fp = fopen(f->fs_path, "rb");
+    if (!fp) {
+        perror(f->fs_path);
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    f->size = size > 0 ? (size_t)size : 0;
+    f->data = malloc(f->size ? f->size : 1);
+    if (!f->data || fread(f->data, 1, f->size, fp) != f->size) {
+        fprintf(stderr, "Failed to read %s\n", f->fs_path);
+        fclose(fp);
+        return -1;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+// 64-bit FNV-1a of the content, used as a strong ETag
+static uint64_t content_hash(const unsigned char *data, size_t size) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static int path_cmp(const void *a, const void *b) {
+    return strcmp(((const struct input_file *)a)->path, ((const struct input_file *)b)->path);
+}
+
+static void write_c_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <www_dir> <output.c>\n", argv[0]);
+        return 1;
+    }
+
+    const char *epoch = getenv("SOURCE_DATE_EPOCH");
+    if (epoch && *epoch) {
+        char *end;
+        long long v = strtoll(epoch, &end, 10);
+        if (*end != '\0' || v < 0) {
+            fprintf(stderr, "Invalid SOURCE_DATE_EPOCH: %s\n", epoch);
+            return 1;
+        }
+        source_date = (time_t)v;
+    }
+
+    char root[MAX_PATH_LEN];
+    snprintf(root, sizeof(root), "%s", argv[1]);
+    root_len = strlen(root);
+    while (root_len > 1 && root[root_len - 1] == '/') root[--root_len] = '\0';
+
+    if (nftw(root, collect_file, 16, FTW_PHYS) != 0) {
+        fprintf(stderr, "Failed to walk %s\n", root);
+        return 1;
+    }
+
+    // Stable input order keeps the generated file reproducible
+    qsort(files, file_count, sizeof(files[0]), path_cmp);
+
+    const char *keys[MAX_ASSETS];
+    uint32_t slots[MAX_ASSETS];
+    size_t by_slot[MAX_ASSETS];
+    size_t nseeds = mph_bucket_count(file_count);
+    uint32_t *seeds = calloc(nseeds, sizeof(*seeds));
+
+    if (!seeds) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < file_count; i++) {
+        if (load_file(&files[i]) != 0) return 1;
+        keys[i] = files[i].path;
+    }
+
+    if (mph_build(keys, file_count, seeds, slots) != 0) {
+        fprintf(stderr, "Failed to build perfect hash\n");
+        return 1;
+    }
+    for (size_t i = 0; i < file_count; i++) {
+        by_slot[slots[i]] = i;
+    }
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    fprintf(out, "// Generated by gen_assets from %s, do not edit.\n\n", root);
+    fprintf(out, "#include \"assets.h\"\n\n");
+
+    for (size_t i = 0; i < file_count; i++) {
+        fprintf(out, "// %s\nstatic const unsigned char asset_%zu[%zu] = {", files[i].path, i,
+                files[i].size ? files[i].size : 1);
+        for (size_t j = 0; j < files[i].size; j++) {
+            fprintf(out, "%s0x%02x,", (j % 16) ? " " : "\n    ", files[i].data[j]);
+        }
+        fprintf(out, "\n};\n\n");
+    }
+
+    fprintf(out, "const struct asset assets[%zu] = {\n", file_count ? file_count : 1);
+    for (size_t s = 0; s < file_count; s++) {
+        const struct input_file *f = &files[by_slot[s]];
+        char last_modified[64];
+
+        strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&f->mtime));
+
+        fprintf(out, "    { ");
+        write_c_string(out, f->path);
+        fprintf(out, ", asset_%zu, %zu, ", by_slot[s], f->size);
+        write_c_string(out, get_content_type(f->path));
+        fprintf(out, ", \"\\\"%016llx\\\"\", ", (unsigned long long)content_hash(f->data, f->size));
+        write_c_string(out, get_cache_control(f->path));
+        fprintf(out, ", ");
+        write_c_string(out, last_modified);
+        fprintf(out, ", %lld },\n", (long long)f->mtime);
+    }
+    if (file_count == 0) {
+        fprintf(out, "    { \"\", 0, 0, 0, 0, 0, 0, 0 },\n");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "const unsigned int assets_count = %zu;\n\n", file_count);
+
+    fprintf(out, "const uint32_t assets_seeds[%zu] = {", nseeds);
+    for (size_t b = 0; b < nseeds; b++) {
+        fprintf(out, "%s%u,", (b % 8) ? " " : "\n    ", seeds[b]);
+    }
+    fprintf(out, "\n};\n");
+
+    if (fclose(out) != 0) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    printf("Embedded %zu files from %s\n", file_count, root);
+    return 0;
+}
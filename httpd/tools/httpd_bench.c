@@ -0,0 +1,592 @@
+// Host tool: HTTP/1.1 keep-alive load generator for httpd.
+//
+// Usage: httpd_bench [-c connections] [-d seconds] [-s scenario]...
+//                    [-o file] [-l label] <host[:port]> [path...]
+//
+// Every scenario, and every path given as a single-GET scenario, runs on its
+// own: the given number of connections issue back-to-back requests for the
+// given duration, each picking the next request from the scenario's weighted
+// mix. One line with requests per second, the latency distribution, errors
+// and the server's RSS (from /api/metrics) is printed per scenario; -o
+// appends the same numbers tab-separated, tagged with -l, so runs of
+// different commits can be compared. Request sequences come from a fixed
+// per-connection seed and are the same on every run.
+//
+// Scenarios:
+//   static     the web UI: index.html and every asset it references
+//   dashboard  status polling with history, logs, settings and batch loads
+//   settings   back-to-back settings PATCHes
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MAX_CONNECTIONS 1024
+#define MAX_SCENARIOS 32
+#define MAX_REQUESTS 64             // per scenario
+#define RECV_BUFFER 16384
+
+// Log-linear latency histogram in microseconds, ~1.5% resolution
+#define HIST_SUB_BITS 6
+#define HIST_SUB (1u << HIST_SUB_BITS)
+#define HIST_BUCKETS ((40 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct histogram {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max_us;
+};
+
+struct bench_request {
+    char *wire;                     // the whole HTTP request
+    size_t len;
+    unsigned int weight;
+};
+
+struct scenario {
+    char name[64];
+    struct bench_request requests[MAX_REQUESTS];
+    size_t count;
+    unsigned int total_weight;
+};
+
+struct worker {
+    pthread_t thread;
+    const struct scenario *scenario;
+    uint32_t seed;
+    struct histogram hist;
+    uint64_t errors;
+    uint64_t bytes;
+};
+
+static struct addrinfo *server_addr;
+static const char *host_header;
+static volatile bool running;
+
+static unsigned int hist_index(uint64_t us) {
+    if (us < HIST_SUB) return (unsigned int)us;
+
+    unsigned int shift = 63 - __builtin_clzll(us) - HIST_SUB_BITS;
+    unsigned int index = (shift + 1) * HIST_SUB + (unsigned int)((us >> shift) - HIST_SUB);
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+static uint64_t hist_value(unsigned int index) {
+    if (index < HIST_SUB) return index;
+
+    unsigned int shift = index / HIST_SUB - 1;
+    return ((uint64_t)(index % HIST_SUB) + HIST_SUB) << shift;
+}
+
+static void hist_add(struct histogram *h, uint64_t us) {
+    h->counts[hist_index(us)]++;
+    h->total++;
+    if (us > h->max_us) h->max_us = us;
+}
+
+static void hist_merge(struct histogram *dst, const struct histogram *src) {
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    if (src->max_us > dst->max_us) dst->max_us = src->max_us;
+}
+
+static uint64_t hist_percentile(const struct histogram *h, double p) {
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)h->total);
+    uint64_t seen = 0;
+
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen > rank) return hist_value(i);
+    }
+    return h->max_us;
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int connect_server(void) {
+    int fd = socket(server_addr->ai_family, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // A stalled server must not keep the workers from finishing
+    struct timeval timeout = { .tv_sec = 5 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if (connect(fd, server_addr->ai_addr, server_addr->ai_addrlen) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) continue;
+            return false;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// Read one response. Returns the status code, or -1 if the connection broke.
+// Bodies are either Content-Length delimited or chunked.
+static int read_response(int fd, char *buf, size_t *buffered, uint64_t *body_bytes) {
+    size_t len = *buffered;
+    char *header_end = NULL;
+
+    while (!(header_end = memmem(buf, len, "\r\n\r\n", 4))) {
+        if (len == RECV_BUFFER) return -1;
+        ssize_t n = recv(fd, buf + len, RECV_BUFFER - len, 0);
+        if (n <= 0) return -1;
+        len += (size_t)n;
+    }
+
+    int status = 0;
+    if (sscanf(buf, "HTTP/1.%*d %d", &status) != 1) return -1;
+
+    *header_end = '\0';
+    bool chunked = strcasestr(buf, "\r\nTransfer-Encoding: chunked") != NULL;
+    const char *cl = strcasestr(buf, "\r\nContent-Length:");
+    uint64_t remaining = cl ? strtoull(cl + 17, NULL, 10) : 0;
+
+    size_t consumed = (size_t)(header_end - buf) + 4;
+    memmove(buf, buf + consumed, len - consumed);
+    len -= consumed;
+
+    if (!chunked) {
+        while (len < remaining) {
+            // Discard what we have and keep reading
+            remaining -= len;
+            *body_bytes += len;
+            len = 0;
+            ssize_t n = recv(fd, buf, RECV_BUFFER, 0);
+            if (n <= 0) return -1;
+            len = (size_t)n;
+        }
+        *body_bytes += remaining;
+        memmove(buf, buf + remaining, len - remaining);
+        *buffered = len - remaining;
+        return status;
+    }
+
+    for (;;) {
+        char *line_end;
+        while (!(line_end = memmem(buf, len, "\r\n", 2))) {
+            if (len == RECV_BUFFER) return -1;
+            ssize_t n = recv(fd, buf + len, RECV_BUFFER - len, 0);
+            if (n <= 0) return -1;
+            len += (size_t)n;
+        }
+
+        uint64_t chunk = strtoull(buf, NULL, 16);
+        size_t line_len = (size_t)(line_end - buf) + 2;
+        memmove(buf, buf + line_len, len - line_len);
+        len -= line_len;
+
+        // Chunk data plus its trailing CRLF; the last chunk is followed by
+        // an empty trailer line only
+        remaining = chunk + 2;
+        while (len < remaining) {
+            remaining -= len;
+            len = 0;
+            ssize_t n = recv(fd, buf, RECV_BUFFER, 0);
+            if (n <= 0) return -1;
+            len = (size_t)n;
+        }
+        memmove(buf, buf + remaining, len - remaining);
+        len -= remaining;
+        *body_bytes += chunk;
+
+        if (chunk == 0) break;
+    }
+
+    *buffered = len;
+    return status;
+}
+
+// xorshift32, so every run issues the same request sequence
+static uint32_t next_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static const struct bench_request *pick_request(const struct scenario *s, uint32_t *seed) {
+    if (s->count == 1) return &s->requests[0];
+
+    unsigned int r = next_random(seed) % s->total_weight;
+    for (size_t i = 0; i < s->count; i++) {
+        if (r < s->requests[i].weight) return &s->requests[i];
+        r -= s->requests[i].weight;
+    }
+    return &s->requests[s->count - 1];
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    char *buf = malloc(RECV_BUFFER);
+    int fd = -1;
+    size_t buffered = 0;
+
+    if (!buf) return NULL;
+
+    while (running) {
+        if (fd == -1) {
+            fd = connect_server();
+            buffered = 0;
+            if (fd == -1) {
+                w->errors++;
+                usleep(10000);
+                continue;
+            }
+        }
+
+        const struct bench_request *r = pick_request(w->scenario, &w->seed);
+        uint64_t start = now_us();
+        int status = -1;
+        if (send_all(fd, r->wire, r->len)) {
+            status = read_response(fd, buf, &buffered, &w->bytes);
+        }
+
+        if (status < 0) {
+            close(fd);
+            fd = -1;
+            if (running) w->errors++;
+            continue;
+        }
+
+        hist_add(&w->hist, now_us() - start);
+        if (status >= 400) w->errors++;
+    }
+
+    if (fd != -1) close(fd);
+    free(buf);
+    return NULL;
+}
+
+static void add_request(struct scenario *s, const char *method, const char *path,
+                        const char *body, unsigned int weight) {
+    struct bench_request *r;
+    char *wire;
+
+    if (s->count == MAX_REQUESTS) return;
+    int len = body ?
+        asprintf(&wire, "%s %s HTTP/1.1\r\nHost: %s\r\nAccept: */*\r\n"
+                 "Content-Type: application/json\r\nContent-Length: %zu\r\n\r\n%s",
+                 method, path, host_header, strlen(body), body) :
+        asprintf(&wire, "%s %s HTTP/1.1\r\nHost: %s\r\nAccept: */*\r\n\r\n",
+                 method, path, host_header);
+    if (len < 0) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    r = &s->requests[s->count++];
+    r->wire = wire;
+    r->len = (size_t)len;
+    r->weight = weight;
+    s->total_weight += weight;
+}
+
+// GET path on a fresh connection and return its body (NUL-terminated), or
+// NULL. Used outside the measured runs only.
+static char *fetch(const char *path) {
+    char request[512];
+    size_t len = 0, cap = 65536;
+    char *buf = malloc(cap);
+    int fd = connect_server();
+
+    if (buf == NULL || fd == -1) goto fail;
+
+    int request_len = snprintf(request, sizeof(request),
+                               "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                               path, host_header);
+    if (!send_all(fd, request, (size_t)request_len)) goto fail;
+
+    for (;;) {
+        if (len + 1 == cap) {
+            char *bigger = realloc(buf, cap * 2);
+            if (bigger == NULL) goto fail;
+            buf = bigger;
+            cap *= 2;
+        }
+        ssize_t n = recv(fd, buf + len, cap - len - 1, 0);
+        if (n < 0) goto fail;
+        if (n == 0) break;
+        len += (size_t)n;
+    }
+    close(fd);
+    buf[len] = '\0';
+
+    char *body = strstr(buf, "\r\n\r\n");
+    int status = 0;
+    if (body == NULL || sscanf(buf, "HTTP/1.%*d %d", &status) != 1 || status != 200) {
+        free(buf);
+        return NULL;
+    }
+    memmove(buf, body + 4, len - (size_t)(body + 4 - buf) + 1);
+    return buf;
+
+fail:
+    if (fd != -1) close(fd);
+    free(buf);
+    return NULL;
+}
+
+// The page and every local src/href it references
+static void build_static(struct scenario *s) {
+    char *index = fetch("/");
+
+    add_request(s, "GET", "/", NULL, 1);
+    for (const char *p = index; p && (p = strpbrk(p, "sh")) != NULL; p++) {
+        const char *value;
+        if (strncmp(p, "src=\"/", 6) == 0) {
+            value = p + 5;
+        } else if (strncmp(p, "href=\"/", 7) == 0) {
+            value = p + 6;
+        } else {
+            continue;
+        }
+
+        char path[256];
+        size_t len = strcspn(value, "\"");
+        if (len >= sizeof(path) || value[1] == '/') continue;
+        memcpy(path, value, len);
+        path[len] = '\0';
+        add_request(s, "GET", path, NULL, 1);
+    }
+    if (index == NULL) fprintf(stderr, "static: cannot fetch /, only / is requested\n");
+    free(index);
+}
+
+// What open dashboards do: mostly status polls
+static void build_dashboard(struct scenario *s) {
+    add_request(s, "GET", "/api/gateway/status", NULL, 8);
+    add_request(s, "GET", "/api/system/history?tier=1s", NULL, 2);
+    add_request(s, "GET", "/api/logs?limit=100", NULL, 1);
+    add_request(s, "GET", "/api/settings", NULL, 1);
+    add_request(s, "POST", "/api/batch", "{\"requests\":[\"/api/gateway/status\",\"/api/settings\","
+                "\"/api/system/history?tier=1m\"]}", 1);
+}
+
+static void build_settings(struct scenario *s) {
+    add_request(s, "PATCH", "/api/settings", "{\"system\":{\"log_level\":\"debug\"}}", 1);
+    add_request(s, "PATCH", "/api/settings", "{\"system\":{\"log_level\":\"info\"}}", 1);
+}
+
+static const struct {
+    const char *name;
+    void (*build)(struct scenario *s);
+} builtin_scenarios[] = {
+    { "static", build_static },
+    { "dashboard", build_dashboard },
+    { "settings", build_settings },
+};
+
+// Server RSS in KiB from /api/metrics, 0 if unavailable
+static unsigned long long server_rss(void) {
+    static const char key[] = "\nprocess_resident_memory_bytes ";
+    char *metrics = fetch("/api/metrics");
+    unsigned long long rss = 0;
+
+    if (metrics) {
+        char *p = strstr(metrics, key);
+        if (p) rss = strtoull(p + sizeof(key) - 1, NULL, 10) / 1024;
+        free(metrics);
+    }
+    return rss;
+}
+
+static int run_scenario(const struct scenario *s, unsigned int connections, unsigned int seconds,
+                        FILE *out, const char *label) {
+    struct worker *workers = calloc(connections, sizeof(*workers));
+    struct histogram *total = calloc(1, sizeof(*total));
+    uint64_t errors = 0, bytes = 0;
+
+    if (!workers || !total) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    running = true;
+    uint64_t start = now_us();
+    for (unsigned int i = 0; i < connections; i++) {
+        workers[i].scenario = s;
+        workers[i].seed = 2463534242u + i;
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            fprintf(stderr, "Failed to start worker thread\n");
+            exit(1);
+        }
+    }
+
+    sleep(seconds);
+    running = false;
+
+    for (unsigned int i = 0; i < connections; i++) {
+        pthread_join(workers[i].thread, NULL);
+        hist_merge(total, &workers[i].hist);
+        errors += workers[i].errors;
+        bytes += workers[i].bytes;
+    }
+    double elapsed = (double)(now_us() - start) / 1e6;
+    double rps = (double)total->total / elapsed;
+    unsigned long long rss = server_rss();
+
+    printf("%-28s %10.1f %9.2f %9.2f %9.2f %9.2f %8llu %10.1f %9llu\n", s->name, rps,
+           hist_percentile(total, 50) / 1000.0,
+           hist_percentile(total, 90) / 1000.0,
+           hist_percentile(total, 99) / 1000.0,
+           total->max_us / 1000.0,
+           (unsigned long long)errors,
+           (double)bytes / elapsed / 1024.0,
+           rss);
+    fflush(stdout);
+
+    if (out) {
+        fprintf(out, "%s\t%s\t%u\t%u\t%.1f\t%.3f\t%.3f\t%.3f\t%llu\t%llu\n", label, s->name,
+                connections, seconds, rps,
+                hist_percentile(total, 50) / 1000.0,
+                hist_percentile(total, 90) / 1000.0,
+                hist_percentile(total, 99) / 1000.0,
+                (unsigned long long)errors, rss);
+        fflush(out);
+    }
+
+    free(total);
+    free(workers);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-c connections] [-d seconds] [-s scenario]... [-o file] [-l label] "
+            "<host[:port]> [path...]\n", prog);
+    fprintf(stderr, "Scenarios:");
+    for (size_t i = 0; i < sizeof(builtin_scenarios) / sizeof(builtin_scenarios[0]); i++) {
+        fprintf(stderr, " %s", builtin_scenarios[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+    static struct scenario scenarios[MAX_SCENARIOS];
+    const char *names[MAX_SCENARIOS];
+    size_t name_count = 0, count = 0;
+    unsigned int connections = 8;
+    unsigned int seconds = 10;
+    const char *out_path = NULL;
+    const char *label = "-";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:d:s:o:l:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            connections = (unsigned int)atoi(optarg);
+            break;
+        case 'd':
+            seconds = (unsigned int)atoi(optarg);
+            break;
+        case 's':
+            if (name_count < MAX_SCENARIOS) names[name_count++] = optarg;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (argc - optind < 1 || (argc - optind < 2 && name_count == 0) ||
+        connections == 0 || connections > MAX_CONNECTIONS || seconds == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char host[256];
+    const char *port = "80";
+    snprintf(host, sizeof(host), "%s", argv[optind]);
+    char *colon = strrchr(host, ':');
+    if (colon) {
+        *colon = '\0';
+        port = colon + 1;
+    }
+    host_header = argv[optind];
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    int err = getaddrinfo(host, port, &hints, &server_addr);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind], gai_strerror(err));
+        return 1;
+    }
+
+    for (size_t i = 0; i < name_count; i++) {
+        size_t b;
+        for (b = 0; b < sizeof(builtin_scenarios) / sizeof(builtin_scenarios[0]); b++) {
+            if (strcmp(names[i], builtin_scenarios[b].name) == 0) break;
+        }
+        if (b == sizeof(builtin_scenarios) / sizeof(builtin_scenarios[0])) {
+            fprintf(stderr, "Unknown scenario: %s\n", names[i]);
+            usage(argv[0]);
+            return 1;
+        }
+        snprintf(scenarios[count].name, sizeof(scenarios[count].name), "%s", names[i]);
+        builtin_scenarios[b].build(&scenarios[count++]);
+    }
+    for (int i = optind + 1; i < argc && count < MAX_SCENARIOS; i++) {
+        snprintf(scenarios[count].name, sizeof(scenarios[count].name), "%s", argv[i]);
+        add_request(&scenarios[count++], "GET", argv[i], NULL, 1);
+    }
+
+    FILE *out = NULL;
+    if (out_path) {
+        out = fopen(out_path, "a");
+        if (out == NULL) {
+            fprintf(stderr, "%s: %s\n", out_path, strerror(errno));
+            return 1;
+        }
+        if (ftell(out) == 0) {
+            fprintf(out, "label\tscenario\tconnections\tseconds\treq_s\tp50_ms\tp90_ms\tp99_ms\terrors\trss_kib\n");
+        }
+    }
+
+    printf("%-28s %10s %9s %9s %9s %9s %8s %10s %9s\n", "scenario", "req/s",
+           "p50 ms", "p90 ms", "p99 ms", "max ms", "errors", "KiB/s", "RSS KiB");
+    for (size_t i = 0; i < count; i++) {
+        if (run_scenario(&scenarios[i], connections, seconds, out, label) != 0) return 1;
+    }
+
+    if (out) fclose(out);
+    freeaddrinfo(server_addr);
+    return 0;
+}
@@ -0,0 +1,298 @@
+#include "trigram.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_BITS 10                    // log2(TRIGRAM_BLOCK_LINES)
+#define BITMAP_WORDS (TRIGRAM_BLOCK_LINES / 64)
+
+// Posting bytes of a block fit 16-bit offsets: at most 2 bytes per pair
+#define MAX_PAIRS 32767
+
+struct block {
+    struct block *older;
+    struct block *newer;
+    uint64_t first_id;
+    uint32_t lines;                     // ids first_id .. first_id + lines - 1
+
+    // Open (newest) block: unsorted bucket << LINE_BITS | line pairs
+    uint32_t *pairs;
+    size_t pair_count;
+    size_t pair_capacity;
+
+    // Sealed block: posting list of bucket b is postings[offsets[b]..offsets[b + 1])
+    uint16_t *offsets;
+    uint8_t *postings;
+};
+
+static struct block *oldest = NULL;
+static struct block *newest = NULL;
+static struct block *open_block = NULL;
+static size_t memory = 0;
+static size_t budget = 0;
+
+void trigram_init(size_t bytes) {
+    budget = bytes;
+}
+
+static uint8_t fold(uint8_t c) {
+    return c >= 'A' && c <= 'Z' ? (uint8_t)(c + 'a' - 'A') : c;
+}
+
+static uint16_t hash_trigram(const char *p) {
+    uint32_t t = (uint32_t)fold((uint8_t)p[0]) << 16 | (uint32_t)fold((uint8_t)p[1]) << 8 |
+                 fold((uint8_t)p[2]);
+    return (uint16_t)((t * 2654435761u) >> 20);
+}
+
+static size_t block_memory(const struct block *b) {
+    size_t bytes = sizeof(*b) + b->pair_capacity * sizeof(*b->pairs);
+    if (b->offsets) bytes += (TRIGRAM_BUCKETS + 1) * sizeof(*b->offsets) + b->offsets[TRIGRAM_BUCKETS];
+    return bytes;
+}
+
+static void drop_oldest(void) {
+    struct block *b = oldest;
+
+    oldest = b->newer;
+    if (oldest) {
+        oldest->older = NULL;
+    } else {
+        newest = NULL;
+    }
+    if (b == open_block) open_block = NULL;
+    memory -= block_memory(b);
+    free(b->pairs);
+    free(b->offsets);
+    free(b->postings);
+    free(b);
+}
+
+// Turn the pairs of the open block into per-bucket posting lists of line
+// deltas (LEB128). Pairs were appended in line order, so a counting sort by
+// bucket leaves every list sorted; lines are distinct within a bucket, so
+// after the first entry every delta is at least 1.
+static void seal(struct block *b) {
+    uint32_t *start = calloc(TRIGRAM_BUCKETS + 1, sizeof(*start));
+    uint16_t *sorted = malloc(b->pair_count * sizeof(*sorted) + 1);
+    uint16_t *offsets = malloc((TRIGRAM_BUCKETS + 1) * sizeof(*offsets));
+    uint8_t *postings = malloc(b->pair_count * 2 + 1);
+    size_t len = 0;
+
+    if (start == NULL || sorted == NULL || offsets == NULL || postings == NULL) {
+        // Keep it open; it stops growing once full
+        free(start);
+        free(sorted);
+        free(offsets);
+        free(postings);
+        return;
+    }
+
+    for (size_t i = 0; i < b->pair_count; i++) {
+        start[(b->pairs[i] >> LINE_BITS) + 1]++;
+    }
+    for (uint32_t bucket = 0; bucket < TRIGRAM_BUCKETS; bucket++) {
+        start[bucket + 1] += start[bucket];
+    }
+    for (size_t i = 0; i < b->pair_count; i++) {
+        sorted[start[b->pairs[i] >> LINE_BITS]++] = (uint16_t)(b->pairs[i] & (TRIGRAM_BLOCK_LINES - 1));
+    }
+
+    // start[bucket] now is the end of the bucket's lines
+    size_t i = 0;
+    for (uint32_t bucket = 0; bucket < TRIGRAM_BUCKETS; bucket++) {
+        uint32_t prev = 0;
+        offsets[bucket] = (uint16_t)len;
+        for (; i < start[bucket]; i++) {
+            uint32_t delta = sorted[i] - prev;
+            prev = sorted[i];
+            if (delta >= 0x80) {
+                postings[len++] = (uint8_t)(delta | 0x80);
+                delta >>= 7;
+            }
+            postings[len++] = (uint8_t)delta;
+        }
+    }
+    offsets[TRIGRAM_BUCKETS] = (uint16_t)len;
+    free(start);
+    free(sorted);
+
+    uint8_t *shrunk = realloc(postings, len ? len : 1);
+    if (shrunk) postings = shrunk;
+
+    memory -= block_memory(b);
+    free(b->pairs);
+    b->pairs = NULL;
+    b->pair_count = 0;
+    b->pair_capacity = 0;
+    b->offsets = offsets;
+    b->postings = postings;
+    memory += block_memory(b);
+}
+
+static struct block *start_block(uint64_t id) {
+    struct block *b = calloc(1, sizeof(*b));
+    if (b == NULL) return NULL;
+
+    b->first_id = id;
+    b->older = newest;
+    if (newest) {
+        newest->newer = b;
+    } else {
+        oldest = b;
+    }
+    newest = b;
+    memory += block_memory(b);
+    return b;
+}
+
+static bool reserve_pairs(struct block *b, size_t n) {
+    if (b->pair_count + n <= b->pair_capacity) return true;
+
+    size_t capacity = b->pair_capacity ? b->pair_capacity * 2 : 1024;
+    while (capacity < b->pair_count + n) capacity *= 2;
+    if (capacity > MAX_PAIRS) capacity = MAX_PAIRS;
+
+    uint32_t *pairs = realloc(b->pairs, capacity * sizeof(*pairs));
+    if (pairs == NULL) return false;
+    memory += (capacity - b->pair_capacity) * sizeof(*pairs);
+    b->pairs = pairs;
+    b->pair_capacity = capacity;
+    return true;
+}
+
+void trigram_add(uint64_t id, const char *text, size_t len) {
+    static uint8_t seen[TRIGRAM_BUCKETS / 8];
+    size_t trigrams = len >= 3 ? len - 2 : 0;
+
+    if (trigrams > TRIGRAM_BLOCK_LINES) trigrams = TRIGRAM_BLOCK_LINES;
+
+    struct block *b = open_block;
+    if (b && (id - b->first_id >= TRIGRAM_BLOCK_LINES || b->pair_count + trigrams > MAX_PAIRS)) {
+        seal(b);
+        if (b->offsets) b = open_block = NULL;
+    }
+    if (b == NULL) {
+        b = open_block = start_block(id);
+        if (b == NULL) return;
+    }
+    if (id - b->first_id >= TRIGRAM_BLOCK_LINES) return;   // could not seal the previous one
+
+    uint32_t line = (uint32_t)(id - b->first_id);
+    if (trigrams > 0 && reserve_pairs(b, trigrams)) {
+        size_t first = b->pair_count;
+        for (size_t i = 0; i < trigrams && b->pair_count < b->pair_capacity; i++) {
+            uint16_t bucket = hash_trigram(text + i);
+            if (seen[bucket >> 3] & (1u << (bucket & 7))) continue;
+            seen[bucket >> 3] |= (uint8_t)(1u << (bucket & 7));
+            b->pairs[b->pair_count++] = (uint32_t)bucket << LINE_BITS | line;
+        }
+        for (size_t i = first; i < b->pair_count; i++) {
+            seen[b->pairs[i] >> (LINE_BITS + 3)] = 0;
+        }
+    }
+    b->lines = line + 1;
+
+    while (memory > budget && oldest != open_block) {
+        drop_oldest();
+    }
+}
+
+void trigram_forget(uint64_t id) {
+    while (oldest && oldest->first_id + oldest->lines <= id) {
+        drop_oldest();
+    }
+}
+
+uint64_t trigram_first_id(void) {
+    return oldest ? oldest->first_id : UINT64_MAX;
+}
+
+size_t trigram_memory(void) {
+    return memory;
+}
+
+bool trigram_query_init(struct trigram_query *q, const char *text, size_t len) {
+    q->count = 0;
+    if (len < 3) return false;
+
+    for (size_t i = 0; i + 2 < len && q->count < TRIGRAM_MAX_QUERY; i++) {
+        uint16_t bucket = hash_trigram(text + i);
+        size_t j;
+        for (j = 0; j < q->count && q->buckets[j] != bucket; j++) {
+        }
+        if (j == q->count) q->buckets[q->count++] = bucket;
+    }
+    return true;
+}
+
+static void decode_postings(const struct block *b, uint16_t bucket, uint64_t bitmap[BITMAP_WORDS]) {
+    const uint8_t *p = b->postings + b->offsets[bucket];
+    const uint8_t *end = b->postings + b->offsets[bucket + 1];
+    uint32_t line = 0;
+
+    memset(bitmap, 0, BITMAP_WORDS * sizeof(bitmap[0]));
+    while (p < end) {
+        uint32_t delta = *p & 0x7f;
+        if (*p++ & 0x80) delta |= (uint32_t)*p++ << 7;
+        line += delta;
+        bitmap[line / 64] |= 1ull << (line % 64);
+    }
+}
+
+// Lines of block b that have every trigram of q
+static bool candidates(const struct block *b, const struct trigram_query *q, uint64_t result[BITMAP_WORDS]) {
+    uint64_t bitmap[BITMAP_WORDS];
+    uint64_t any = 0;
+
+    memset(result, 0xff, BITMAP_WORDS * sizeof(result[0]));
+
+    if (b->offsets) {
+        for (size_t i = 0; i < q->count; i++) {
+            decode_postings(b, q->buckets[i], bitmap);
+            any = 0;
+            for (int w = 0; w < BITMAP_WORDS; w++) any |= result[w] &= bitmap[w];
+            if (any == 0) return false;
+        }
+        return true;
+    }
+
+    // Open block: one pass over its pairs fills a bitmap per query trigram
+    uint64_t (*maps)[BITMAP_WORDS] = calloc(q->count, sizeof(*maps));
+    uint8_t *slot = malloc(TRIGRAM_BUCKETS);
+    if (maps == NULL || slot == NULL) {
+        // Verify every line instead
+        free(maps);
+        free(slot);
+        return true;
+    }
+    memset(slot, 0xff, TRIGRAM_BUCKETS);
+    for (size_t j = 0; j < q->count; j++) slot[q->buckets[j]] = (uint8_t)j;
+
+    for (size_t i = 0; i < b->pair_count; i++) {
+        uint8_t j = slot[b->pairs[i] >> LINE_BITS];
+        uint32_t line = b->pairs[i] & (TRIGRAM_BLOCK_LINES - 1);
+        if (j != 0xff) maps[j][line / 64] |= 1ull << (line % 64);
+    }
+    free(slot);
+    for (size_t j = 0; j < q->count; j++) {
+        any = 0;
+        for (int w = 0; w < BITMAP_WORDS; w++) any |= result[w] &= maps[j][w];
+    }
+    free(maps);
+    return any != 0 || q->count == 0;
+}
+
+void trigram_search(const struct trigram_query *q, uint64_t before,
+                    bool (*fn)(uint64_t id, void *arg), void *arg) {
+    uint64_t result[BITMAP_WORDS];
+
+    for (const struct block *b = newest; b; b = b->older) {
+        if (b->first_id >= before || !candidates(b, q, result)) continue;
+
+        for (uint32_t line = b->lines; line-- > 0;) {
+            if (!(result[line / 64] & (1ull << (line % 64)))) continue;
+            if (b->first_id + line >= before) continue;
+            if (!fn(b->first_id + line, arg)) return;
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Trigram index over log lines, for substring search.
+//
+// Lines are added in id order. Every case-folded trigram of a line is
+// hashed to one of TRIGRAM_BUCKETS posting lists, so a search only has to
+// read the lines whose lists all contain it; hash collisions merely add
+// candidates, which the caller verifies against the line itself.
+//
+// The index is cut into blocks of TRIGRAM_BLOCK_LINES consecutive ids. The
+// newest block collects (bucket, line) pairs; a full block is sorted into
+// one delta-encoded posting list per bucket, usually a byte per entry.
+// Whole blocks are dropped, oldest first, to stay within the memory budget.
+//
+// Not thread-safe: the caller serializes all calls.
+
+#define TRIGRAM_BUCKETS 4096
+#define TRIGRAM_BLOCK_LINES 1024
+#define TRIGRAM_MAX_QUERY 64        // trigrams of a query that are looked up
+
+struct trigram_query {
+    uint16_t buckets[TRIGRAM_MAX_QUERY];
+    size_t count;
+};
+
+void trigram_init(size_t budget);
+
+// Index text as line id; ids must increase
+void trigram_add(uint64_t id, const char *text, size_t len);
+
+// Drop the blocks that only hold lines older than id
+void trigram_forget(uint64_t id);
+
+// Oldest id still indexed, UINT64_MAX if none
+uint64_t trigram_first_id(void);
+
+// Bytes held by the index
+size_t trigram_memory(void);
+
+// Trigrams of a search string; false if it is shorter than three bytes
+bool trigram_query_init(struct trigram_query *q, const char *text, size_t len);
+
+// Call fn with the ids below before whose lines may contain the query,
+// newest first, until it returns false
+void trigram_search(const struct trigram_query *q, uint64_t before,
+                    bool (*fn)(uint64_t id, void *arg), void *arg);
+
+#endif // TRIGRAM_H
@@ -1,54 +1,13 @@
+#define _GNU_SOURCE
 #include "handlers.h"
+#include "compress.h"
+#include "metrics.h"
+#include "respool.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
 #include <time.h>
-#include <sys/time.h>
-#include <arpa/inet.h>
-#include <netinet/in.h>
-
-#define MAX_LOG_LINE 512
-
-// Function to log requests with client IP and timestamp
-void log_request(struct MHD_Connection *connection,
-                const char *method,
-                const char *url,
-                unsigned int status_code) {
-    char timestamp[32];
-    char client_ip[INET6_ADDRSTRLEN];
-    const union MHD_ConnectionInfo *info;
-    struct timeval tv;
-    struct tm *tm_info;
-    char log_line[MAX_LOG_LINE];
-    
-    // Get current timestamp
-    gettimeofday(&tv, NULL);
-    tm_info = localtime(&tv.tv_sec);
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
-    
-    // Get client IP address
-    info = MHD_get_connection_info(connection, MHD_CONNECTION_INFO_CLIENT_ADDRESS);
-    if (info && info->client_addr) {
-        struct sockaddr *addr = (struct sockaddr *)info->client_addr;
-        if (addr->sa_family == AF_INET) {
-            struct sockaddr_in *addr_in = (struct sockaddr_in *)addr;
-            inet_ntop(AF_INET, &(addr_in->sin_addr), client_ip, INET6_ADDRSTRLEN);
-        } else if (addr->sa_family == AF_INET6) {
-            struct sockaddr_in6 *addr_in6 = (struct sockaddr_in6 *)addr;
-            inet_ntop(AF_INET6, &(addr_in6->sin6_addr), client_ip, INET6_ADDRSTRLEN);
-        } else {
-            strcpy(client_ip, "unknown");
-        }
-    } else {
-        strcpy(client_ip, "unknown");
-    }
-    
-    // Format and print log line
-    snprintf(log_line, sizeof(log_line),
-             "[%s] %s - %s %s %u",
-             timestamp, client_ip, method, url, status_code);
-    printf("%s\n", log_line);
-    fflush(stdout);
-}
 
 enum MHD_Result send_error_response(struct MHD_Connection *connection,
                                   const char *method,
@@ -57,13 +16,18 @@ enum MHD_Result send_error_response(struct MHD_Connection *connection,
                                   unsigned int status_code) {
     struct MHD_Response *response;
     enum MHD_Result ret;
+
+    if (batch_capture(status_code, error_msg, strlen(error_msg), false)) {
+        log_request(connection, method, url, status_code);
+        return MHD_YES;
+    }
     
     response = MHD_create_response_from_buffer(strlen(error_msg),
                                              (void*)error_msg,
                                              MHD_RESPMEM_MUST_COPY);
     if (response == NULL) return MHD_NO;
     
-    ret = MHD_queue_response(connection, status_code, response);
+    ret = queue_response(connection, status_code, response, strlen(error_msg));
     MHD_destroy_response(response);
     
     // Log the request after sending the response
@@ -72,6 +36,23 @@ enum MHD_Result send_error_response(struct MHD_Connection *connection,
     return ret;
 }
 
+enum MHD_Result queue_response(struct MHD_Connection *connection,
+                               unsigned int status_code,
+                               struct MHD_Response *response,
+                               uint64_t body_size) {
+    enum MHD_Result ret = MHD_queue_response(connection, status_code, response);
+    if (ret == MHD_YES) metrics_response(status_code, body_size);
+    return ret;
+}
+
+void add_json_headers(struct MHD_Response *response) {
+    MHD_add_response_header(response, "Content-Type", "application/json");
+    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+    MHD_add_response_header(response, "Access-Control-Allow-Methods", "GET, POST, PATCH, OPTIONS");
+    MHD_add_response_header(response, "Access-Control-Allow-Headers", "Content-Type");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_VARY, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+}
+
 enum MHD_Result send_json_response(struct MHD_Connection *connection,
                                  const char *method,
                                  const char *url,
@@ -79,18 +60,24 @@ enum MHD_Result send_json_response(struct MHD_Connection *connection,
                                  unsigned int status_code) {
     struct MHD_Response *response;
     enum MHD_Result ret;
+    size_t len = strlen(json_str);
+
+    if (batch_capture(status_code, json_str, len, true)) {
+        log_request(connection, method, url, status_code);
+        return MHD_YES;
+    }
     
-    response = MHD_create_response_from_buffer(strlen(json_str),
-                                             (void*)json_str,
-                                             MHD_RESPMEM_MUST_COPY);
+    response = compress_response(connection, json_str, len, &len);
+    if (response == NULL) {
+        response = MHD_create_response_from_buffer(len,
+                                                 (void*)json_str,
+                                                 MHD_RESPMEM_MUST_COPY);
+    }
     if (response == NULL) return MHD_NO;
     
-    MHD_add_response_header(response, "Content-Type", "application/json");
-    MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
-    MHD_add_response_header(response, "Access-Control-Allow-Methods", "GET, POST, PATCH, OPTIONS");
-    MHD_add_response_header(response, "Access-Control-Allow-Headers", "Content-Type");
+    add_json_headers(response);
     
-    ret = MHD_queue_response(connection, status_code, response);
+    ret = queue_response(connection, status_code, response, len);
     MHD_destroy_response(response);
     
     // Log the request after sending the response
@@ -98,3 +85,241 @@ enum MHD_Result send_json_response(struct MHD_Connection *connection,
     
     return ret;
 }
+
+enum MHD_Result send_json_writer(struct MHD_Connection *connection,
+                               const char *method,
+                               const char *url,
+                               struct json_writer *w,
+                               unsigned int status_code) {
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+    size_t len;
+
+    char *json = jw_finish(w, &len);
+    if (json == NULL) {
+        return send_error_response(connection, method, url,
+            "Internal server error", MHD_HTTP_INTERNAL_SERVER_ERROR);
+    }
+
+    if (batch_capture(status_code, json, len, true)) {
+        respool_free(json);
+        log_request(connection, method, url, status_code);
+        return MHD_YES;
+    }
+
+    response = compress_response(connection, json, len, &len);
+    if (response) {
+        respool_free(json);
+    } else {
+        // A pooled buffer goes back to the pool once MHD is done with it
+        response = MHD_create_response_from_buffer_with_free_callback(len, json, &respool_free);
+        if (response == NULL) {
+            respool_free(json);
+            return MHD_NO;
+        }
+    }
+
+    add_json_headers(response);
+
+    ret = queue_response(connection, status_code, response, len);
+    MHD_destroy_response(response);
+
+    log_request(connection, method, url, status_code);
+
+    return ret;
+}
+
+void format_http_date(time_t t, char *buf, size_t len) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// If-None-Match uses the weak comparison, so W/ prefixes are ignored
+static bool etag_list_matches(const char *list, const char *etag) {
+    size_t etag_len = strlen(etag);
+    const char *p = list;
+
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (*p == '*') return true;
+        if (strncmp(p, "W/", 2) == 0) p += 2;
+
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\t')) len--;
+
+        if (len == etag_len && strncmp(p, etag, len) == 0) return true;
+        if (!end) break;
+        p = end + 1;
+    }
+    return false;
+}
+
+// Parse an HTTP-date, -1 if it is not one
+static time_t parse_http_date(const char *s) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(s, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return end && *end == '\0' ? timegm(&tm) : (time_t)-1;
+}
+
+bool request_is_fresh(struct MHD_Connection *connection,
+                      const char *etag,
+                      time_t last_modified) {
+    // Sub-requests of a batch always get the full body
+    if (batch_active()) return false;
+
+    const char *inm = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+                                                  MHD_HTTP_HEADER_IF_NONE_MATCH);
+    if (inm) {
+        return etag && etag_list_matches(inm, etag);
+    }
+
+    const char *ims = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+                                                  MHD_HTTP_HEADER_IF_MODIFIED_SINCE);
+    if (ims && last_modified > 0) {
+        time_t since = parse_http_date(ims);
+        if (since != -1) return last_modified <= since;
+    }
+    return false;
+}
+
+// Digits only, no sign or whitespace as strtoull() would accept
+static bool parse_u64(const char *s, const char *end, uint64_t *out) {
+    uint64_t v = 0;
+
+    if (s == end) return false;
+    for (; s < end; s++) {
+        if (*s < '0' || *s > '9') return false;
+        if (v > (UINT64_MAX - 9) / 10) return false;
+        v = v * 10 + (uint64_t)(*s - '0');
+    }
+    *out = v;
+    return true;
+}
+
+enum range_result request_range(struct MHD_Connection *connection,
+                                const char *method,
+                                uint64_t size,
+                                const char *etag,
+                                time_t last_modified,
+                                struct byte_range *range) {
+    range->offset = 0;
+    range->length = size;
+
+    if (batch_active() || strcmp(method, "GET") != 0) return RANGE_FULL;
+
+    const char *value = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+                                                    MHD_HTTP_HEADER_RANGE);
+    if (value == NULL) return RANGE_FULL;
+
+    // If-Range needs an exact match: a strong ETag or the Last-Modified date.
+    // A weak ETag never matches (RFC 9110 13.1.5, strong comparison).
+    const char *if_range = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+                                                       MHD_HTTP_HEADER_IF_RANGE);
+    if (if_range) {
+        if (strncmp(if_range, "W/", 2) == 0) {
+            return RANGE_FULL;
+        } else if (if_range[0] == '"') {
+            if (etag == NULL || strcmp(if_range, etag) != 0) return RANGE_FULL;
+        } else if (last_modified <= 0 || parse_http_date(if_range) != last_modified) {
+            return RANGE_FULL;
+        }
+    }
+
+    if (strncasecmp(value, "bytes=", 6) != 0) return RANGE_FULL;
+    const char *spec = value + 6;
+    while (*spec == ' ') spec++;
+    const char *end = spec + strcspn(spec, " ,");
+    const char *rest = end;
+    while (*rest == ' ') rest++;
+    if (*rest != '\0') return RANGE_FULL;     // several ranges, send it all
+
+    const char *dash = memchr(spec, '-', (size_t)(end - spec));
+    if (dash == NULL) return RANGE_FULL;
+
+    uint64_t first, last;
+    if (dash == spec) {
+        // Suffix: the last n bytes
+        if (!parse_u64(dash + 1, end, &last)) return RANGE_FULL;
+        if (last == 0 || size == 0) return RANGE_UNSATISFIABLE;
+        if (last > size) last = size;
+        range->offset = size - last;
+        range->length = last;
+        return RANGE_PARTIAL;
+    }
+
+    if (!parse_u64(spec, dash, &first)) return RANGE_FULL;
+    if (dash + 1 == end) {
+        last = UINT64_MAX;
+    } else if (!parse_u64(dash + 1, end, &last) || last < first) {
+        return RANGE_FULL;
+    }
+    if (first >= size) return RANGE_UNSATISFIABLE;
+    if (last >= size) last = size - 1;
+    range->offset = first;
+    range->length = last - first + 1;
+    return RANGE_PARTIAL;
+}
+
+unsigned int add_range_headers(struct MHD_Response *response,
+                               enum range_result result,
+                               const struct byte_range *range,
+                               uint64_t size) {
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ACCEPT_RANGES, "bytes");
+    if (result != RANGE_PARTIAL) return MHD_HTTP_OK;
+
+    char content_range[64];
+    snprintf(content_range, sizeof(content_range), "bytes %llu-%llu/%llu",
+             (unsigned long long)range->offset,
+             (unsigned long long)(range->offset + range->length - 1),
+             (unsigned long long)size);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_RANGE, content_range);
+    return MHD_HTTP_PARTIAL_CONTENT;
+}
+
+enum MHD_Result send_range_not_satisfiable(struct MHD_Connection *connection,
+                                         const char *method,
+                                         const char *url,
+                                         uint64_t size) {
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+    char content_range[32];
+
+    response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+    if (response == NULL) return MHD_NO;
+
+    snprintf(content_range, sizeof(content_range), "bytes */%llu", (unsigned long long)size);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_RANGE, content_range);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ACCEPT_RANGES, "bytes");
+
+    ret = queue_response(connection, MHD_HTTP_RANGE_NOT_SATISFIABLE, response, 0);
+    MHD_destroy_response(response);
+
+    log_request(connection, method, url, MHD_HTTP_RANGE_NOT_SATISFIABLE);
+    return ret;
+}
+
+enum MHD_Result send_not_modified(struct MHD_Connection *connection,
+                                const char *method,
+                                const char *url,
+                                const char *etag,
+                                const char *cache_control,
+                                const char *last_modified) {
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+
+    response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+    if (response == NULL) return MHD_NO;
+
+    if (etag) MHD_add_response_header(response, MHD_HTTP_HEADER_ETAG, etag);
+    if (cache_control) MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, cache_control);
+    if (last_modified) MHD_add_response_header(response, MHD_HTTP_HEADER_LAST_MODIFIED, last_modified);
+
+    ret = queue_response(connection, MHD_HTTP_NOT_MODIFIED, response, 0);
+    MHD_destroy_response(response);
+
+    log_request(connection, method, url, MHD_HTTP_NOT_MODIFIED);
+    return ret;
+}
@@ -1,6 +1,87 @@
-import { getApiUrl } from '../config';
+import { getApiUrl, MOCK_MODE } from '../config';
 
-// Common API client utility
+// GET endpoints httpd can answer inside /api/batch: the routes marked
+// .batch in httpd/main.c, keep the two in sync. A path httpd refuses to
+// batch is dropped from the set and fetched on its own from then on.
+const BATCHABLE_PATHS = new Set([
+  '/api/gateway/status',
+  '/api/settings',
+  '/api/logs',
+  '/api/logs/search',
+  '/api/system/history',
+  '/api/system/services',
+]);
+const NOT_BATCHABLE = 'Endpoint cannot be batched';
+const MAX_BATCH = 16;
+
+interface PendingRequest {
+  path: string;
+  resolve: (data: unknown) => void;
+  reject: (error: unknown) => void;
+}
+
+interface BatchResponse {
+  responses: { status: number; body?: unknown; error?: string }[];
+}
+
+let pending: PendingRequest[] = [];
+
+async function send<T>(path: string, method: string, body?: unknown): Promise<T> {
+  const response = await fetch(getApiUrl(path), {
+    method,
+    headers: {
+      'Content-Type': 'application/json',
+    },
+    body: body ? JSON.stringify(body) : undefined,
+  });
+
+  if (!response.ok) {
+    throw new Error(`API request failed: ${response.statusText}`);
+  }
+
+  const data: T = await response.json();
+  return data;
+}
+
+// Send the GETs queued during the last tick, as one /api/batch request
+// when there is more than one
+function flush(): void {
+  const queued = pending;
+  pending = [];
+
+  for (let i = 0; i < queued.length; i += MAX_BATCH) {
+    const chunk = queued.slice(i, i + MAX_BATCH);
+
+    if (chunk.length === 1) {
+      send(chunk[0].path, 'GET').then(chunk[0].resolve, chunk[0].reject);
+      continue;
+    }
+
+    send<BatchResponse>('/api/batch', 'POST', { requests: chunk.map((r) => r.path) }).then(
+      ({ responses }) => {
+        chunk.forEach((r, index) => {
+          const result = responses[index];
+          if (result && result.status >= 200 && result.status < 300) {
+            r.resolve(result.body);
+          } else if (result?.status === 400 && result.error === NOT_BATCHABLE) {
+            BATCHABLE_PATHS.delete(r.path.split('?')[0]);
+            send(r.path, 'GET').then(r.resolve, r.reject);
+          } else {
+            r.reject(new Error(`API request failed: ${result?.error ?? 'no response'}`));
+          }
+        });
+      },
+      (error) => chunk.forEach((r) => r.reject(error))
+    );
+  }
+}
+
+function isBatchable(path: string): boolean {
+  return !MOCK_MODE && BATCHABLE_PATHS.has(path.split('?')[0]);
+}
+
+// Common API client utility. GETs issued in the same tick are sent together
+// through /api/batch.
 export async function apiRequest<T>(
   path: string,
   options: {
@@ -10,22 +91,15 @@ export async function apiRequest<T>(
 ): Promise<T> {
   try {
     const { method = 'GET', body } = options;
-    const url = getApiUrl(path);
-
-    const response = await fetch(url, {
-      method,
-      headers: {
-        'Content-Type': 'application/json',
-      },
-      body: body ? JSON.stringify(body) : undefined,
-    });
 
-    if (!response.ok) {
-      throw new Error(`API request failed: ${response.statusText}`);
+    if (method === 'GET' && isBatchable(path)) {
+      return await new Promise<T>((resolve, reject) => {
+        pending.push({ path, resolve: resolve as (data: unknown) => void, reject });
+        if (pending.length === 1) queueMicrotask(flush);
+      });
     }
 
-    const data: T = await response.json();
-    return data;
+    return await send<T>(path, method, body);
   } catch (error) {
     console.error('API request failed:', error);
     throw error;
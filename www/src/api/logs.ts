@@ -1,11 +1,28 @@
-import { Log } from '../types/logs';
+import { LogEntry } from '../types/logs';
 import { apiRequest } from './client';
 
-interface LogsResponse {
-  logs: Log[];
+export interface LogsQuery {
+  // Return lines older than this id, for paging back
+  cursor?: number;
+  level?: LogEntry['level'];
+  limit?: number;
+  // Only lines whose message contains this text (at least 3 characters)
+  search?: string;
 }
 
-export async function fetchLogs(): Promise<Log[]> {
-  const response = await apiRequest<LogsResponse>('/api/logs');
-  return response.logs;
+export interface LogsPage {
+  logs: LogEntry[];
+  next_cursor: number | null;
+}
+
+export async function fetchLogs(query: LogsQuery = {}): Promise<LogsPage> {
+  const params = new URLSearchParams();
+  if (query.cursor !== undefined) params.set('cursor', String(query.cursor));
+  if (query.level) params.set('level', query.level);
+  if (query.limit) params.set('limit', String(query.limit));
+  if (query.search) params.set('q', query.search);
+
+  const path = query.search ? '/api/logs/search' : '/api/logs';
+  const search = params.toString();
+  return apiRequest<LogsPage>(search ? `${path}?${search}` : path);
 }
@@ -6,7 +6,9 @@ import { PageHeader } from './shared/PageHeader'
 import { LoadingButton } from './shared/LoadingButton'
 import { SkeletonCard } from './shared/Skeleton'
 import { ErrorAlert } from './shared/ErrorAlert'
+import { LiveIndicator } from './shared/LiveIndicator'
 import { useAsyncData } from '../hooks/useAsyncData'
+import { useEventStream } from '../hooks/useEventStream'
 
 interface Props {
   path?: string
@@ -79,13 +81,21 @@ export function Dashboard({ MenuButton }: Props) {
     error, 
     loading,
     refreshing,
-    refresh: loadGatewayData 
+    refresh: loadGatewayData,
+    setData: setGatewayData
   } = useAsyncData(fetchGatewayData)
 
+  // Status changes are pushed by the gateway, no polling needed
+  const { connected } = useEventStream({
+    status: (status: GatewayData) => setGatewayData(status)
+  })
+
   const deviceCounts = gatewayData ? getDeviceCounts(gatewayData.devices) : { total: 0, zigbee: 0, matter: 0 }
   const stats = gatewayData ? getGatewayStats(gatewayData.gateway) : []
 
-  const headerActions = (
+  const headerActions = connected ? (
+    <LiveIndicator />
+  ) : (
     <LoadingButton
       onClick={loadGatewayData}
       loading={refreshing}
@@ -1,12 +1,14 @@
-import { useState } from 'preact/hooks'
+import { useCallback, useState } from 'preact/hooks'
 import { Card } from './shared/Card'
 import { LoadingButton } from './shared/LoadingButton'
 import { PageHeader } from './shared/PageHeader'
 import { Select } from './shared/Select'
 import { ErrorAlert } from './shared/ErrorAlert'
+import { LiveIndicator } from './shared/LiveIndicator'
 import { useAsyncData } from '../hooks/useAsyncData'
+import { useEventStream } from '../hooks/useEventStream'
 import { SkeletonCard } from './shared/Skeleton'
-import { fetchLogs } from '../api/logs'
+import { fetchLogs, LogsPage } from '../api/logs'
 import { LogEntry } from '../types/logs'
 
 interface Props {
@@ -21,6 +23,12 @@ const LOG_FILTER_OPTIONS = [
   { value: 'error', label: 'Errors' }
 ]
 
+// Live lines kept in the view before the oldest ones are dropped
+const MAX_LIVE_LOGS = 500
+
+// Shortest text /api/logs/search accepts
+const MIN_SEARCH_LENGTH = 3
+
 const LEVEL_COLORS = {
   info: 'text-primary',
   warning: 'text-warning',
@@ -40,21 +48,87 @@ function LogsSkeleton() {
 }
 
 export function Logs({ MenuButton }: Props) {
+  const [filter, setFilter] = useState('all')
+  const [searchInput, setSearchInput] = useState('')
+  const [search, setSearch] = useState('')
+  const [loadingOlder, setLoadingOlder] = useState(false)
+  const level = filter === 'all' ? undefined : filter as LogEntry['level']
+
+  const loadPage = useCallback(() => fetchLogs({ level, search: search || undefined }), [level, search])
   const { 
-    data: logs, 
+    data: page, 
     error, 
     loading,
     refreshing,
-    refresh: loadLogs
-  } = useAsyncData(fetchLogs)
+    refresh: loadLogs,
+    setData: setPage
+  } = useAsyncData<LogsPage>(loadPage)
+  const logs = page?.logs
+
+  // New lines are pushed as they are logged; a reset means the stream
+  // skipped lines, so reload the latest page
+  const { connected } = useEventStream({
+    log: (entry: LogEntry) => setPage(current => {
+      if (!current || (level && entry.level !== level)) return current
+      if (search && !entry.message.toLowerCase().includes(search.toLowerCase())) return current
+      const last = current.logs[current.logs.length - 1]
+      if (last && entry.id <= last.id) return current
+
+      const logs = [...current.logs, entry]
+      if (logs.length <= MAX_LIVE_LOGS) return { ...current, logs }
+
+      // Lines dropped from the view can be loaded again as an older page
+      const kept = logs.slice(-MAX_LIVE_LOGS)
+      return { logs: kept, next_cursor: kept[0].id }
+    }),
+    reset: () => loadLogs()
+  })
+
+  const loadOlder = async () => {
+    if (!page || page.next_cursor === null) return
+    setLoadingOlder(true)
+    try {
+      const older = await fetchLogs({ level, search: search || undefined, cursor: page.next_cursor })
+      setPage(current => current && {
+        logs: [...older.logs, ...current.logs],
+        next_cursor: older.next_cursor
+      })
+    } catch (err) {
+      console.error(err)
+    } finally {
+      setLoadingOlder(false)
+    }
+  }
+
+  const submitSearch = (event: Event) => {
+    event.preventDefault()
+    const text = searchInput.trim()
+    setSearch(text.length >= MIN_SEARCH_LENGTH ? text : '')
+  }
 
   const headerActions = (
-    <LoadingButton
-      onClick={loadLogs}
-      loading={refreshing}
-      loadingText="Refreshing..."
-      text="Refresh"
-    />
+    <div className="flex items-center gap-2">
+      <form onSubmit={submitSearch}>
+        <input
+          type="search"
+          value={searchInput}
+          onInput={(e) => setSearchInput((e.target as HTMLInputElement).value)}
+          placeholder="Search logs"
+          className="bg-bg-accent text-text-primary px-3 py-2 rounded-md border border-bg-accent focus:border-primary focus:outline-none w-[180px]"
+        />
+      </form>
+      <Select value={filter} onChange={setFilter} options={LOG_FILTER_OPTIONS} />
+      {connected ? (
+        <LiveIndicator />
+      ) : (
+        <LoadingButton
+          onClick={loadLogs}
+          loading={refreshing}
+          loadingText="Refreshing..."
+          text="Refresh"
+        />
+      )}
+    </div>
   )
 
   return (
@@ -77,6 +151,17 @@ export function Logs({ MenuButton }: Props) {
               <div className="col-span-2 sm:col-span-1">Level</div>
               <div className="col-span-7 sm:col-span-9">Message</div>
             </div>
+            {page?.next_cursor != null && (
+              <div className="p-4 border-b border-bg-accent flex justify-center">
+                <LoadingButton
+                  onClick={loadOlder}
+                  loading={loadingOlder}
+                  loadingText="Loading..."
+                  text="Load older"
+                  variant="secondary"
+                />
+              </div>
+            )}
             <div className="divide-y divide-bg-accent">
               {logs.map(log => (
                 <div key={log.id} className="p-4 grid grid-cols-12 items-center hover:bg-bg-accent transition-colors min-w-[640px]">
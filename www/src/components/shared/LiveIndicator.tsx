@@ -0,0 +1,12 @@
+interface Props {
+  className?: string
+}
+
+export function LiveIndicator({ className = '' }: Props) {
+  return (
+    <div className={`flex items-center px-3 py-2 text-sm text-text-secondary ${className}`}>
+      <div className="h-2.5 w-2.5 rounded-full bg-success animate-pulse mr-2"></div>
+      Live
+    </div>
+  )
+}
@@ -12,7 +12,8 @@ export const API_CONFIG = {
 // Construct the full API URL
 export const getApiUrl = (path: string): string => {
   if (MOCK_MODE) {
-    return `/mocks${path}.json`;
+    // Mock files cannot take query parameters
+    return `/mocks${path.split('?')[0]}.json`;
   }
   return path;
 };
@@ -0,0 +1,37 @@
+import { useEffect, useRef, useState } from 'preact/hooks'
+import { MOCK_MODE, getApiUrl } from '../config'
+
+type EventHandlers = Record<string, (data: any, id: string) => void>
+
+// Subscribe to the server-sent event stream at /api/events. Handlers are
+// keyed by event type and receive the parsed JSON payload. The browser
+// reconnects by itself and resumes from the last event id it saw.
+export function useEventStream(handlers: EventHandlers) {
+  const [connected, setConnected] = useState(false)
+  const handlersRef = useRef(handlers)
+  handlersRef.current = handlers
+
+  useEffect(() => {
+    if (MOCK_MODE || typeof EventSource === 'undefined') return
+
+    const source = new EventSource(getApiUrl('/api/events'))
+    source.onopen = () => setConnected(true)
+    source.onerror = () => setConnected(false)
+
+    for (const type of Object.keys(handlersRef.current)) {
+      source.addEventListener(type, (event: MessageEvent) => {
+        let data: unknown
+        try {
+          data = JSON.parse(event.data)
+        } catch {
+          return
+        }
+        handlersRef.current[type]?.(data, event.lastEventId)
+      })
+    }
+
+    return () => source.close()
+  }, [])
+
+  return { connected }
+}
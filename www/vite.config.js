@@ -8,7 +8,7 @@ export default defineConfig({
     port: 3000
   },
   build: {
-    outDir: resolve('../alt_app/www'),
+    outDir: resolve('../work/www'),
     emptyOutDir: true
   }
 })